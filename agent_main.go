@@ -1,72 +1,78 @@
 package main
 
 import (
-	"bytes"
 	"context"
-	"encoding/binary"
-	"encoding/json"
 	"errors"
 	"fmt"
 	"log"
-	"net"
 	"os"
 	"os/signal"
-	"regexp"
 	"strings"
 	"sync"
+	"sync/atomic"
 	"syscall"
 	"time"
 
-	"github.com/cilium/ebpf/link"
-	"github.com/cilium/ebpf/perf"
+	"github.com/cilium/ebpf"
 	"github.com/cilium/ebpf/rlimit"
 	"github.com/nats-io/nats.go"
 )
 
 // Configuration - can be overridden by environment variables
 var (
-	NatsURL         = getEnv("NATS_URL", "nats://localhost:4222")
-	AppID           = getEnv("APP_ID", "arbitrum-node-service")
-	TargetBinary    = getEnv("TARGET_BINARY", "/usr/local/bin/geth")
-	TargetSymbolRet = getEnv("TARGET_SYMBOL", "github.com/ethereum/go-ethereum/rpc.(*Server).serveRequest")
-	TargetPID       = getEnvInt("TARGET_PID", 0) // 0 means attach to all processes
-	DebugMode       = getEnv("DEBUG", "false") == "true"
+	NatsURL        = getEnv("NATS_URL", "nats://localhost:4222")
+	AppID          = getEnv("APP_ID", "arbitrum-node-service")
+	TargetBinary   = getEnv("TARGET_BINARY", "/usr/local/bin/geth")
+	TargetSymbol   = getEnv("TARGET_SYMBOL", "github.com/ethereum/go-ethereum/rpc.(*handler).handleCallMsg")
+	TargetPID      = getEnvInt("TARGET_PID", 0) // 0 means attach to all processes
+	DebugMode      = getEnv("DEBUG", "false") == "true"
+	PayloadCapture = getEnvInt("PAYLOAD_CAPTURE_BYTES", maxPayloadSize) // 0 = metadata only
+	CaptureMode    = getEnv("CAPTURE_MODE", CaptureEvents)
+	HistInterval   = getEnvDuration("HISTOGRAM_INTERVAL", 10*time.Second)
 )
 
-//go:generate go run github.com/cilium/ebpf/cmd/bpf2go -cc clang -target bpfel rpc rpc_tracer.c -- -D__TARGET_ARCH_x86 -I/usr/include/x86_64-linux-gnu
+// Capture modes
+const (
+	CaptureEvents = "events"    // One record per tcp_sendmsg
+	CaptureFlows  = "flows"     // One record per completed request/response pair
+	CaptureHist   = "histogram" // No records; in-kernel histograms swept every HistInterval
+)
+
+//go:generate go run github.com/cilium/ebpf/cmd/bpf2go -cc clang -target amd64,arm64 rpc rpc_tracer.c -- -I./headers
 
 // Agent holds the core components for the tracing service.
 type Agent struct {
-	NatsConn     *nats.Conn
-	Ctx          context.Context
-	Cancel       context.CancelFunc
-	EBPFObjs     *rpcObjects
-	FeatureCache *sync.Map
-	PerfReader   *perf.Reader
-}
-
-// RPCEvent represents data sent from the BPF program to the Go User-Space Agent.
-// Must match the C struct (network_event_t) defined in rpc_tracer.c exactly.
-type RPCEvent struct {
-	PID         uint64
-	TimestampNs uint64
-	DataLen     uint32
-	IsSend      uint32 // 1 = send (tcp_sendmsg), 0 = recv (tcp_recvmsg)
-	DestIP      uint32 // Destination IPv4 address
-	DestPort    uint16 // Destination port
-	Comm        [16]byte
-	Data        [512]byte // HTTP headers + JSON-RPC payload
+	NatsConn  *nats.Conn
+	Ctx       context.Context
+	Cancel    context.CancelFunc
+	EBPFObjs  *tracerObjects
+	DNS       *hostnameCache
+	Pods      *podIndex // Cgroup ID to pod, nil without pod attribution
+	Subjects  *subjectCache
+	Publisher *publisher
+	Events    eventReader
+	Transport string         // TransportRingBuf or TransportPerf
+	Recorder  *eventRecorder // RECORD_EVENTS_FILE, nil when not recording
+
+	pipeline    *eventPipeline
+	generation  uint32        // prog_gen of the loaded programs
+	ready       chan struct{} // Closed once the reader is running, if set
+	recordsRead atomic.Uint64 // Records read from the transport
+	samplesLost atomic.Uint64 // Records the perf transport reported lost
+
+	bpfMu       sync.Mutex
+	bpfPrograms []bpfProgram // Programs reported in the BPF stats
 }
 
 // MonitoringFeature is the standard structure published to NATS.
 type MonitoringFeature struct {
-	AppID       string                 `json:"app_id"`
-	Protocol    string                 `json:"protocol"`
-	FeatureType string                 `json:"feature_type"`
-	Timestamp   time.Time              `json:"timestamp"`
-	Value       float64                `json:"value"`
-	ContextHash string                 `json:"context_hash"`
-	Details     map[string]interface{} `json:"details"`
+	AppID       string         `json:"app_id"`
+	Protocol    string         `json:"protocol"`
+	FeatureType string         `json:"feature_type"`
+	Timestamp   time.Time      `json:"timestamp"`
+	Value       float64        `json:"value"`
+	ContextHash string         `json:"context_hash"`
+	Details     featureDetails `json:"details"` // Encoded by fieldEncoder, see MarshalJSON
 }
 
 // getEnv retrieves an environment variable or returns a default value
@@ -88,13 +94,42 @@ func getEnvInt(key string, defaultVal int) int {
 	return defaultVal
 }
 
+// getEnvDuration retrieves a duration environment variable (e.g. "10s") or returns a default value
+func getEnvDuration(key string, defaultVal time.Duration) time.Duration {
+	if value := os.Getenv(key); value != "" {
+		if d, err := time.ParseDuration(value); err == nil && d > 0 {
+			return d
+		}
+	}
+	return defaultVal
+}
+
 // connectNATS establishes a connection to the NATS server with retry logic.
-func connectNATS(url string) (*nats.Conn, error) {
+// With a spool the connection is retried forever in the background and the
+// client does not buffer while disconnected, so messages go to the spool.
+func connectNATS(url string, spooled bool) (*nats.Conn, error) {
 	log.Printf("Connecting to NATS at %s...", url)
+	opts := []nats.Option{nats.Timeout(5 * time.Second)}
+	if spooled {
+		opts = append(opts,
+			nats.RetryOnFailedConnect(true),
+			nats.MaxReconnects(-1),
+			nats.ReconnectBufSize(-1),
+			nats.DisconnectErrHandler(func(_ *nats.Conn, err error) {
+				log.Printf("Disconnected from NATS (%v), spooling to %s", err, SpoolDir)
+			}),
+			nats.ReconnectHandler(func(*nats.Conn) {
+				log.Printf("Reconnected to NATS, replaying the spool at %d messages/s", SpoolReplayRate)
+			}))
+	}
 	for i := 0; i < 5; i++ {
-		nc, err := nats.Connect(url, nats.Timeout(5*time.Second))
+		nc, err := nats.Connect(url, opts...)
 		if err == nil {
-			log.Println("Successfully connected to NATS.")
+			if nc.IsConnected() {
+				log.Println("Successfully connected to NATS.")
+			} else {
+				log.Printf("NATS unreachable, spooling to %s until it connects", SpoolDir)
+			}
 			return nc, nil
 		}
 		log.Printf("NATS connection attempt %d failed: %v. Retrying in %d seconds...", i+1, err, 1<<i)
@@ -103,273 +138,411 @@ func connectNATS(url string) (*nats.Conn, error) {
 	return nil, fmt.Errorf("failed to connect to NATS after multiple retries")
 }
 
-// PublishFeature sends a MonitoringFeature to NATS on the appropriate topic
+// PublishFeature hands a MonitoringFeature to the publishing stage, which
+// encodes it and sends it to NATS on the subject in ContextHash
+// (rpc.{destination}.{protocol}.{method}.{metric}). It never blocks.
+// Ownership of feature.Details passes to the publisher, even on error.
 func (a *Agent) PublishFeature(feature MonitoringFeature) error {
-	// Construct the NATS subject with hierarchical structure
-	// Format: rpc.{destination}.{protocol}.{method}.{metric}
-	subject := feature.ContextHash // This now contains the full subject
+	return a.Publisher.Publish(feature)
+}
 
-	data, err := json.Marshal(feature)
-	if err != nil {
-		return fmt.Errorf("failed to marshal feature: %w", err)
+// RunTracer initializes eBPF, attaches the probes, and starts the event loop.
+func (a *Agent) RunTracer() error {
+	// Allow the BPF programs to be loaded (required for Kubernetes/restricted environments)
+	if err := rlimit.RemoveMemlock(); err != nil {
+		return fmt.Errorf("failed to remove memlock limit: %w", err)
 	}
 
-	if err := a.NatsConn.Publish(subject, data); err != nil {
-		return fmt.Errorf("failed to publish to subject %s: %w", subject, err)
+	// Pick the event transport before loading, since it changes the events map type
+	transport, err := selectTransport(EventTransport)
+	if err != nil {
+		return err
 	}
+	a.Transport = transport
 
-	log.Printf("Published to NATS [%s]: %s", subject, string(data))
-	return nil
-}
-
-// ipToString converts uint32 IP to dotted notation
-func ipToString(ip uint32) string {
-	return fmt.Sprintf("%d.%d.%d.%d",
-		byte(ip), byte(ip>>8), byte(ip>>16), byte(ip>>24))
-}
-
-// getHostnameFromIP tries to resolve IP to hostname, returns sanitized version for NATS subject
-func getHostnameFromIP(ipStr string) string {
-	// Try reverse DNS lookup (with timeout)
-	names, err := net.LookupAddr(ipStr)
-	if err == nil && len(names) > 0 {
-		// Use first hostname, sanitize for NATS subject
-		hostname := names[0]
-		// Remove trailing dot
-		hostname = strings.TrimSuffix(hostname, ".")
-		// Replace dots and special chars with hyphens for NATS subject
-		hostname = strings.ReplaceAll(hostname, ".", "-")
-		return hostname
-	}
-	
-	// If DNS fails, use IP with hyphens
-	return strings.ReplaceAll(ipStr, ".", "-")
-}
+	spec, err := loadRpc()
+	if err != nil {
+		return fmt.Errorf("failed to load eBPF spec: %w", err)
+	}
+	if err := configureTransport(spec, transport); err != nil {
+		return fmt.Errorf("failed to configure %s transport: %w", transport, err)
+	}
+	if err := configurePinning(spec, transport); err != nil {
+		return err
+	}
+	tracers, err := selectTracers(Tracers)
+	if err != nil {
+		return err
+	}
+	filters, err := loadFilterConfig()
+	if err != nil {
+		return err
+	}
 
-// extractETHMethodFromPayload attempts to extract eth_* method from HTTP/JSON-RPC payload
-func extractETHMethodFromPayload(payload string) string {
-	// Look for JSON-RPC method in payload
-	// Patterns: {"method":"eth_call",...} or {"jsonrpc":"2.0","method":"eth_getBalance",...}
-	
-	re := regexp.MustCompile(`"method"\s*:\s*"(eth_[a-zA-Z0-9_]+)"`)
-	matches := re.FindStringSubmatch(payload)
-	if len(matches) > 1 {
-		return matches[1]
-	}
-	
-	// Also check for HTTP POST path (some RPC endpoints use path-based routing)
-	if strings.Contains(payload, "POST /") {
-		// Look for common patterns
-		if strings.Contains(payload, "eth_call") {
-			return "eth_call"
-		}
-		if strings.Contains(payload, "eth_sendTransaction") {
-			return "eth_sendTransaction"
-		}
-		if strings.Contains(payload, "eth_getBalance") {
-			return "eth_getBalance"
-		}
+	// The programs are loaded as the next generation and stay idle until
+	// takeOver, so a running agent keeps tracing while this one starts.
+	prev, err := readPinnedConfig()
+	if err != nil {
+		return err
+	}
+	a.generation = prev.ActiveGen + 1
+	if err := spec.RewriteConstants(map[string]interface{}{
+		"prog_gen": a.generation,
+	}); err != nil {
+		return fmt.Errorf("failed to configure program generation: %w", err)
+	}
+	if PayloadCapture < 0 || PayloadCapture > maxPayloadSize {
+		return fmt.Errorf("PAYLOAD_CAPTURE_BYTES must be between 0 and %d, got %d", maxPayloadSize, PayloadCapture)
+	}
+	var captureMode uint32
+	switch CaptureMode {
+	case CaptureEvents:
+		captureMode = captureModeEvents
+	case CaptureFlows:
+		captureMode = captureModeFlows
+	case CaptureHist:
+		captureMode = captureModeHist
+	default:
+		return fmt.Errorf("unknown CAPTURE_MODE %q (want events, flows or histogram)", CaptureMode)
+	}
+	sslEnabled := uint32(0)
+	if tracerEnabled("ssl") {
+		sslEnabled = 1
+	}
+	reassembly := uint32(0)
+	if reassemblyEnabled() {
+		reassembly = 1
+	}
+	if err := spec.RewriteConstants(map[string]interface{}{
+		"payload_cap":  uint32(PayloadCapture),
+		"capture_mode": captureMode,
+		"ssl_enabled":  sslEnabled,
+		"reassembly":   reassembly,
+	}); err != nil {
+		return fmt.Errorf("failed to configure payload capture: %w", err)
+	}
+	if err := configureSampling(spec); err != nil {
+		return fmt.Errorf("failed to configure sampling: %w", err)
+	}
+	if err := configureServer(spec); err != nil {
+		return fmt.Errorf("failed to configure server probes: %w", err)
+	}
+	if err := configureCaptureDepth(spec); err != nil {
+		return fmt.Errorf("failed to configure capture depth: %w", err)
 	}
-	
-	return "unknown"
-}
 
-// RunTracer initializes eBPF, attaches the probes, and starts the event loop.
-func (a *Agent) RunTracer() error {
-	// Allow the BPF programs to be loaded (required for Kubernetes/restricted environments)
-	if err := rlimit.RemoveMemlock(); err != nil {
-		return fmt.Errorf("failed to remove memlock limit: %w", err)
+	// Per-program run time and count, reported with the self-metrics
+	if BPFStats {
+		stats, err := ebpf.EnableStats(bpfStatsRunTime)
+		if err != nil {
+			log.Printf("BPF stats unavailable: %v", err)
+		} else {
+			defer stats.Close()
+		}
 	}
 
-	// Load pre-compiled eBPF programs
-	objs := &rpcObjects{}
-	if err := loadRpcObjects(objs, nil); err != nil {
-		return fmt.Errorf("failed to load eBPF objects: %w", err)
+	// Create the shared maps, reusing those a previous agent pinned with
+	// their contents, and fill the method table and filter maps before any
+	// program runs. Then attach the selected tracers on top of them.
+	objs, err := loadMaps(spec)
+	if err != nil {
+		return err
 	}
 	a.EBPFObjs = objs
+	if err := loadMethodTable(objs.MethodIds); err != nil {
+		return err
+	}
+	if err := syncFilters(&objs.rpcMaps, filters); err != nil {
+		return err
+	}
+	started, err := a.startTracers(spec, tracers)
+	if err != nil {
+		return err
+	}
+	defer stopTracers(started)
+	log.Printf("In-kernel filters: %s", filters)
 
-	log.Println("Attaching Kprobe to tcp_sendmsg...")
+	// Everything is attached: switch the hooks over from the previous agent
+	if err := a.takeOver(started); err != nil {
+		return err
+	}
+	if pinningEnabled() {
+		go a.watchGeneration(a.Ctx, time.Second)
+	}
+	if FilterFile != "" {
+		go a.watchFilters(a.Ctx, filters, FilterReloadInterval)
+		log.Printf("Reloading filters from %s every %s and on SIGHUP", FilterFile, FilterReloadInterval)
+	}
 
-	// Attach Kprobe to tcp_sendmsg (kernel function for sending TCP data)
-	kp, err := link.Kprobe("tcp_sendmsg", a.EBPFObjs.TraceTcpSendmsg, nil)
+	// Start reading from the event transport
+	rd, err := newEventReader(transport, a.EBPFObjs.Events)
 	if err != nil {
-		return fmt.Errorf("failed to attach Kprobe to tcp_sendmsg: %w", err)
+		return err
+	}
+	a.Events = rd
+
+	if RecordEventsFile != "" {
+		rec, err := newEventRecorder(RecordEventsFile, RecordEventsMax)
+		if err != nil {
+			return err
+		}
+		a.Recorder = rec
+		defer rec.Close()
+		log.Printf("Recording up to %d events to %s", RecordEventsMax, RecordEventsFile)
 	}
-	defer kp.Close()
-	log.Println("Kprobe attached successfully to tcp_sendmsg")
 
-	// Start reading from the Perf Buffer
-	rd, err := perf.NewReader(a.EBPFObjs.Events, os.Getpagesize()*64)
+	pipeline, err := newEventPipeline(a)
 	if err != nil {
-		return fmt.Errorf("failed to create perf event reader: %w", err)
+		return err
+	}
+	a.pipeline = pipeline
+	pipeline.start()
+	go pipeline.reportDrops(a.Ctx, 10*time.Second)
+	go a.reportKernelCounters(a.Ctx, 10*time.Second)
+	go a.serveMetrics(a.Ctx)
+	if a.ready != nil {
+		close(a.ready)
 	}
-	a.PerfReader = rd
 
-	log.Println("Starting Perf Buffer reader...")
+	log.Printf("Starting %s event reader with %d workers (sharded by %s, %s when full)...",
+		transport, EventWorkers, EventShardBy, EventBackpressure)
 	if DebugMode {
 		log.Println("DEBUG: Debug mode enabled - verbose logging active")
 	}
-	go a.readAndProcessEvents()
+	readerDone := make(chan struct{})
+	go func() {
+		defer close(readerDone)
+		a.readAndProcessEvents(pipeline)
+		pipeline.stop()
+	}()
 
-	// Wait for context cancellation
+	if CaptureMode == CaptureHist || tracerEnabled("server") {
+		log.Printf("Sweeping in-kernel histograms every %s", HistInterval)
+		go a.runHistogramSweeper(a.EBPFObjs.Hists, HistInterval)
+	}
+	if captureDepthEnabled() && CaptureReprobeInterval > 0 {
+		go a.runCaptureReprobe(a.EBPFObjs.CaptureSocks, CaptureReprobeInterval)
+	}
+
+	// Wait for context cancellation, then let the workers drain. Pinned
+	// programs stay attached, buffering records for the next agent.
 	<-a.Ctx.Done()
+	a.Events.Close()
+	<-readerDone
+	a.releaseReader()
 	return nil
 }
 
-// readAndProcessEvents continuously reads raw events from the kernel and processes them.
-func (a *Agent) readAndProcessEvents() {
-	var event RPCEvent
-	eventCount := 0
+// readAndProcessEvents continuously reads raw events from the kernel and
+// hands them to the worker pipeline, which decodes and processes them.
+func (a *Agent) readAndProcessEvents(pipeline *eventPipeline) {
+	var record eventRecord
 
 	for {
-		record, err := a.PerfReader.Read()
+		err := a.Events.ReadInto(&record)
 		if err != nil {
-			if errors.Is(err, perf.ErrClosed) {
-				log.Println("Perf buffer reader closed.")
+			if errors.Is(err, errTransportClosed) {
+				log.Printf("%s event reader closed.", a.Transport)
 				return
 			}
-			log.Printf("Error reading perf buffer: %v", err)
+			log.Printf("Error reading %s events: %v", a.Transport, err)
 			continue
 		}
 
 		if record.LostSamples > 0 {
-			log.Printf("Warning: Lost %d samples due to a full buffer", record.LostSamples)
+			a.samplesLost.Add(record.LostSamples)
+			recordLost(record.CPU, record.LostSamples)
+			log.Printf("Warning: Lost %d samples on CPU %d due to a full buffer", record.LostSamples, record.CPU)
 		}
-
-		// Parse binary data into our Go struct
-		if err := binary.Read(bytes.NewBuffer(record.RawSample), binary.LittleEndian, &event); err != nil {
-			log.Printf("Failed to parse event: %v", err)
-			continue
+		if len(record.RawSample) == 0 {
+			continue // Perf lost-samples notification
 		}
+		a.recordsRead.Add(1)
 
-		eventCount++
-		if DebugMode {
-			log.Printf("DEBUG: Received event #%d: PID=%d, DataLen=%d, IsSend=%d, Comm=%s",
-				eventCount, event.PID, event.DataLen, event.IsSend, 
-				string(bytes.TrimRight(event.Comm[:], "\x00")))
+		if a.Recorder != nil {
+			a.Recorder.write(record.RawSample)
 		}
-
-		// Feature Engineering and Publishing
-		a.processAndPublishRPCEvent(event)
+		pipeline.dispatch(record.RawSample)
 	}
 }
 
 // processAndPublishRPCEvent performs feature extraction and sends the feature over NATS.
-func (a *Agent) processAndPublishRPCEvent(event RPCEvent) {
-	processName := string(bytes.TrimRight(event.Comm[:], "\x00"))
-	
-	// Convert destination IP to string
-	destIPStr := ipToString(event.DestIP)
-	destHostname := getHostnameFromIP(destIPStr)
-	
+func (a *Agent) processAndPublishRPCEvent(event *RPCEvent) {
+	// Cached, never blocks on DNS
+	destIPStr, destHostname := a.DNS.Lookup(event.DestAddr)
+
 	// Determine direction and metric type
 	direction := "recv"
-	metricType := "response"
-	if event.IsSend == 1 {
+	metric := metricResponseSize
+	if event.Kind == recordSend {
 		direction = "send"
-		metricType = "request"
-	}
-	
-	// Try to extract ETH JSON-RPC method from payload
-	payload := string(bytes.TrimRight(event.Data[:], "\x00"))
-	ethMethod := extractETHMethodFromPayload(payload)
-	
-	// Construct hierarchical NATS subject
+		metric = metricRequestSize
+	}
+
+	// Use the in-kernel classification unless the payload was shipped, for
+	// an unknown name or a batch. A batch is enumerated in one pass and
+	// published once per method, each with its count and share of the bytes.
+	methodID, size, count := event.MethodID, event.DataLen, uint32(0)
+	if len(event.Data) > 0 {
+		var buf [maxBatchMethods + 1]methodCount
+		methods := extractMethods(buf[:0], event.Data, event.DataLen)
+		if len(methods) > 1 || len(methods) == 1 && methods[0].Count > 1 {
+			for _, m := range methods {
+				a.publishRPCEvent(event, direction, metric, destIPStr, destHostname, m.ID, m.Bytes, m.Count)
+			}
+			return
+		}
+		if len(methods) == 1 {
+			methodID = methods[0].ID
+		}
+	}
+	a.publishRPCEvent(event, direction, metric, destIPStr, destHostname, methodID, size, count)
+}
+
+// publishRPCEvent publishes one send or receive feature. count is the
+// number of requests of a batch it stands for, or 0 outside batches. The
+// value and batch count are scaled by the sample weight, so they sum to
+// the traffic the record stands for; size_bytes stays per event.
+func (a *Agent) publishRPCEvent(event *RPCEvent, direction string, metric subjectMetric, destIPStr, destHostname string, methodID uint16, size, count uint32) {
+	ethMethod := methodName(methodID)
+	if ethMethod == "" {
+		ethMethod = "unknown"
+	}
+
+	// Hierarchical NATS subject, cached per (destination, method, metric)
 	// Format: rpc.{destination}.{protocol}.{method}.{metric}
 	// Example: rpc.rpc-reya-cronos-gelato-digital.https.eth_call.request_size
-	protocol := "https"
-	if event.DestPort == 8545 || event.DestPort == 8547 {
-		protocol = "http"
-	}
-	
-	subject := fmt.Sprintf("rpc.%s.%s.%s.%s_size", 
-		destHostname, protocol, ethMethod, metricType)
-	
+	subject := a.Subjects.Subject(event.DestAddr, event.DestPort, methodID, metric, destHostname)
+
 	if DebugMode {
-		log.Printf("DEBUG: Processing %s to %s:%d (PID %d): method=%s, size=%d",
-			direction, destIPStr, event.DestPort, event.PID, ethMethod, event.DataLen)
-		if len(payload) > 0 && len(payload) < 200 {
-			log.Printf("DEBUG: Payload preview: %s", payload)
+		log.Printf("DEBUG: Processing %s to %s:%d (PID %d): method=%s, size=%d, batch=%d",
+			direction, destIPStr, event.DestPort, event.PID, ethMethod, size, count)
+		if len(event.Data) > 0 && len(event.Data) < 200 {
+			log.Printf("DEBUG: Payload preview: %s", event.Data)
 		}
 	}
 
 	// Create monitoring feature
+	details := newEventDetails()
+	*details = eventDetails{
+		PID:          event.PID,
+		Process:      commName(event.Comm),
+		Method:       ethMethod,
+		Direction:    direction,
+		SizeBytes:    size,
+		TimestampNs:  event.TimestampNs,
+		DestIP:       destIPStr,
+		DestPort:     event.DestPort,
+		DestHostname: destHostname,
+		Weight:       event.Weight,
+		BatchCount:   count * event.Weight,
+		Pod:          a.Pods.Lookup(event.CgroupID),
+	}
 	feature := MonitoringFeature{
 		AppID:       AppID,
 		Protocol:    "jsonrpc",
-		FeatureType: fmt.Sprintf("%s_size", metricType),
+		FeatureType: metric.String(),
 		Timestamp:   time.Now(),
-		Value:       float64(event.DataLen),
+		Value:       float64(size) * float64(event.Weight),
 		ContextHash: subject, // Full subject path
-		Details: map[string]interface{}{
-			"pid":           event.PID,
-			"process":       processName,
-			"method":        ethMethod,
-			"direction":     direction,
-			"size_bytes":    event.DataLen,
-			"timestamp_ns":  event.TimestampNs,
-			"dest_ip":       destIPStr,
-			"dest_port":     event.DestPort,
-			"dest_hostname": destHostname,
-		},
+		Details:     details,
 	}
 
 	// Publish to NATS
 	if err := a.PublishFeature(feature); err != nil {
 		log.Printf("Failed to publish RPC feature: %v", err)
 	} else if DebugMode {
-		log.Printf("DEBUG: Published to NATS [%s]: method=%s, size=%d",
-			subject, ethMethod, event.DataLen)
+		log.Printf("DEBUG: Queued for NATS [%s]: method=%s, size=%d",
+			subject, ethMethod, size)
 	}
 }
 
-// min returns the minimum of two integers
-func min(a, b int) int {
-	if a < b {
-		return a
+// rpcCompletionFeatures are published for every completed request/response pair
+var rpcCompletionFeatures = [...]subjectMetric{metricRequestSize, metricResponseSize, metricLatencyMs}
+
+// processAndPublishRPCCompletion publishes request size, response size and
+// latency for a request/response pair completed in kernel (CAPTURE_MODE=flows).
+func (a *Agent) processAndPublishRPCCompletion(event *RPCEvent) {
+	processName := commName(event.Comm)
+	destIPStr, destHostname := a.DNS.Lookup(event.DestAddr)
+
+	ethMethod := methodName(event.MethodID)
+	if ethMethod == "" {
+		ethMethod = "unknown"
+	}
+	latencyMs := float64(event.LatencyNs) / float64(time.Millisecond)
+
+	if DebugMode {
+		log.Printf("DEBUG: Completed RPC to %s:%d (PID %d): method=%s, request=%d, response=%d, latency=%.3fms",
+			destIPStr, event.DestPort, event.PID, ethMethod, event.DataLen, event.RespLen, latencyMs)
+	}
+
+	// One details object is shared by the three features
+	details := newRPCDetails(int32(len(rpcCompletionFeatures)))
+	details.PID = event.PID
+	details.Process = processName
+	details.Method = ethMethod
+	details.RequestBytes = event.DataLen
+	details.ResponseBytes = event.RespLen
+	details.LatencyMs = latencyMs
+	details.TimestampNs = event.TimestampNs
+	details.DestIP = destIPStr
+	details.DestPort = event.DestPort
+	details.DestHostname = destHostname
+	details.Weight = event.Weight
+	details.Pod = a.Pods.Lookup(event.CgroupID)
+
+	// Sizes are volumes and scale with the sample weight; latency does not
+	weight := float64(event.Weight)
+	values := [len(rpcCompletionFeatures)]float64{float64(event.DataLen) * weight, float64(event.RespLen) * weight, latencyMs}
+	now := time.Now()
+	for i, metric := range rpcCompletionFeatures {
+		feature := MonitoringFeature{
+			AppID:       AppID,
+			Protocol:    "jsonrpc",
+			FeatureType: metric.String(),
+			Timestamp:   now,
+			Value:       values[i],
+			ContextHash: a.Subjects.Subject(event.DestAddr, event.DestPort, event.MethodID, metric, destHostname),
+			Details:     details,
+		}
+		if err := a.PublishFeature(feature); err != nil {
+			log.Printf("Failed to publish RPC feature: %v", err)
+		}
 	}
-	return b
 }
 
-// extractJSONRPCMethod attempts to extract the "method" field from a JSON-RPC payload
-func extractJSONRPCMethod(payload string) string {
-	// Simple string search for "method":"xxx"
-	// More robust parsing could use json.Unmarshal
-	if len(payload) == 0 {
-		return "unknown"
-	}
-	
-	// Look for "method":"
-	methodStart := bytes.Index([]byte(payload), []byte(`"method":"`))
-	if methodStart == -1 {
-		methodStart = bytes.Index([]byte(payload), []byte(`"method": "`))
-	}
-	if methodStart == -1 {
-		return "unknown"
-	}
-	
-	// Find the start of the method value
-	valueStart := methodStart + bytes.Index([]byte(payload[methodStart:]), []byte(`"`))
-	valueStart = valueStart + bytes.Index([]byte(payload[valueStart+1:]), []byte(`"`)) + 1
-	
-	// Find the end quote
-	valueEnd := valueStart + 1 + bytes.Index([]byte(payload[valueStart+1:]), []byte(`"`))
-	
-	if valueEnd > valueStart && valueEnd < len(payload) {
-		return payload[valueStart+1 : valueEnd]
-	}
-	
-	return "unknown"
+// protocolForPort maps a destination port to the protocol segment of the subject
+func protocolForPort(port uint16) string {
+	switch port {
+	case 0:
+		return "server" // Server probes: no destination
+	case 8545, 8547:
+		return "http"
+	}
+	return "https"
 }
 
 func main() {
+	if len(os.Args) > 1 && os.Args[1] == "bench" {
+		os.Exit(runBench(os.Args[2:]))
+	}
+	if len(os.Args) > 1 && os.Args[1] == "unpin" {
+		os.Exit(runUnpin())
+	}
+
 	log.Println("Starting JSON-RPC eBPF Agent for Arbitrum traffic monitoring...")
 	log.Printf("Configuration:")
 	log.Printf("  NATS URL: %s", NatsURL)
 	log.Printf("  App ID: %s", AppID)
 	log.Printf("  Target Binary: %s", TargetBinary)
-	log.Printf("  Target Symbol: %s", TargetSymbolRet)
+	log.Printf("  Target Symbol: %s", TargetSymbol)
 	log.Printf("  Target PID: %d (0 = all processes)", TargetPID)
+	log.Printf("  Event Transport: %s", EventTransport)
+	log.Printf("  Payload Capture: %d bytes (first %d sends per socket, 0 = all)", PayloadCapture, CaptureDepth)
+	log.Printf("  Tracers: %s", strings.Join(Tracers, ","))
+	log.Printf("  Sampling: 1 in %d, rate limit %d/s per key (0 = off)", SampleEvery, RateLimit)
+	log.Printf("  Publish Encoding: %s (batch size %d)", PublishEncoding, PublishBatchSize)
 
 	ctx, cancel := context.WithCancel(context.Background())
 	defer cancel()
@@ -383,18 +556,50 @@ func main() {
 		cancel()
 	}()
 
-	// 1. Connect to NATS
-	nc, err := connectNATS(NatsURL)
+	// 1. Connect to NATS, unless capturing to the spool
+	sp, err := openSpool()
 	if err != nil {
 		log.Fatalf("Fatal: %v", err)
 	}
-	defer nc.Close()
+	var nc *nats.Conn
+	if sp != nil && sp.capture {
+		log.Printf("Capturing features to %s instead of publishing them to NATS", SpoolDir)
+	} else {
+		if nc, err = connectNATS(NatsURL, sp != nil); err != nil {
+			log.Fatalf("Fatal: %v", err)
+		}
+		defer nc.Close()
+	}
+
+	// Publishing runs on its own goroutine until Close
+	pub, err := newPublisher(nc, sp)
+	if err != nil {
+		log.Fatalf("Fatal: %v", err)
+	}
+	go pub.run()
 
 	agent := &Agent{
-		NatsConn:     nc,
-		Ctx:          ctx,
-		Cancel:       cancel,
-		FeatureCache: &sync.Map{},
+		NatsConn:  nc,
+		Ctx:       ctx,
+		Cancel:    cancel,
+		DNS:       newHostnameCache(ctx, DNSCacheSize, DNSWorkers),
+		Subjects:  newSubjectCache(),
+		Publisher: pub,
+	}
+	pods, err := newPodIndex()
+	if err != nil {
+		log.Fatalf("Fatal: %v", err)
+	}
+	if pods != nil {
+		agent.Pods = pods
+		go pods.run(ctx)
+	}
+	if DNSCacheFile != "" {
+		if n, err := agent.DNS.load(DNSCacheFile); err == nil {
+			log.Printf("Loaded %d hostnames from %s", n, DNSCacheFile)
+		} else if !errors.Is(err, os.ErrNotExist) {
+			log.Printf("Failed to load DNS cache: %v", err)
+		}
 	}
 
 	// 2. Start the eBPF Tracer
@@ -403,12 +608,17 @@ func main() {
 	}
 
 	// Clean up resources
-	if agent.PerfReader != nil {
-		agent.PerfReader.Close()
-	}
 	if agent.EBPFObjs != nil {
 		agent.EBPFObjs.Close()
 	}
+	if DNSCacheFile != "" {
+		if err := agent.DNS.save(DNSCacheFile); err != nil {
+			log.Printf("Failed to save DNS cache: %v", err)
+		}
+	}
+
+	// Make sure queued features reach NATS before the connection closes
+	pub.Close()
 
 	log.Println("Agent stopped gracefully.")
 }
@@ -0,0 +1,268 @@
+package main
+
+import (
+	"errors"
+	"fmt"
+	"log"
+	"reflect"
+
+	"github.com/cilium/ebpf"
+	"github.com/cilium/ebpf/btf"
+	"github.com/cilium/ebpf/features"
+	"github.com/cilium/ebpf/link"
+)
+
+// Attach modes
+const (
+	AttachAuto   = "auto"   // fentry/fexit when the kernel supports them, else kprobes
+	AttachFentry = "fentry" // BPF trampolines (5.5+ on x86_64, 6.0+ on arm64)
+	AttachKprobe = "kprobe"
+)
+
+// AttachMode can be overridden by the ATTACH_MODE environment variable
+var AttachMode = getEnv("ATTACH_MODE", AttachAuto)
+
+// tracerPrograms is the set of programs of one attach mode.
+type tracerPrograms interface {
+	// attach links the programs. recv adds the receive hooks that pair
+	// requests with responses; closeHook adds tcp_close, which forgets a
+	// closed socket's flow and TLS state.
+	attach(recv, closeHook bool) ([]link.Link, error)
+	Close() error
+}
+
+// kprobePrograms attach through kprobes and a kretprobe.
+type kprobePrograms struct {
+	TraceTcpSendmsg       *ebpf.Program `ebpf:"trace_tcp_sendmsg"`
+	TraceTcpRecvmsg       *ebpf.Program `ebpf:"trace_tcp_recvmsg"`
+	TraceTcpRecvmsgReturn *ebpf.Program `ebpf:"trace_tcp_recvmsg_return"`
+	TraceTcpClose         *ebpf.Program `ebpf:"trace_tcp_close"`
+}
+
+func (p *kprobePrograms) attach(recv, closeHook bool) ([]link.Link, error) {
+	var links []link.Link
+
+	kp, err := link.Kprobe("tcp_sendmsg", p.TraceTcpSendmsg, nil)
+	if err != nil {
+		return links, fmt.Errorf("failed to attach Kprobe to tcp_sendmsg: %w", err)
+	}
+	links = append(links, kp)
+
+	if recv {
+		recvKp, err := link.Kprobe("tcp_recvmsg", p.TraceTcpRecvmsg, nil)
+		if err != nil {
+			return links, fmt.Errorf("failed to attach Kprobe to tcp_recvmsg: %w", err)
+		}
+		links = append(links, recvKp)
+
+		recvKrp, err := link.Kretprobe("tcp_recvmsg", p.TraceTcpRecvmsgReturn, nil)
+		if err != nil {
+			return links, fmt.Errorf("failed to attach Kretprobe to tcp_recvmsg: %w", err)
+		}
+		links = append(links, recvKrp)
+	}
+	if !closeHook {
+		return links, nil
+	}
+
+	closeKp, err := link.Kprobe("tcp_close", p.TraceTcpClose, nil)
+	if err != nil {
+		return links, fmt.Errorf("failed to attach Kprobe to tcp_close: %w", err)
+	}
+	return append(links, closeKp), nil
+}
+
+func (p *kprobePrograms) Close() error {
+	return closePrograms(p.TraceTcpSendmsg, p.TraceTcpRecvmsg, p.TraceTcpRecvmsgReturn, p.TraceTcpClose)
+}
+
+// fentryPrograms attach through BPF trampolines. fexit on tcp_recvmsg
+// replaces both the entry kprobe and the kretprobe.
+type fentryPrograms struct {
+	FentryTcpSendmsg *ebpf.Program `ebpf:"fentry_tcp_sendmsg"`
+	FexitTcpRecvmsg  *ebpf.Program `ebpf:"fexit_tcp_recvmsg"`
+	FentryTcpClose   *ebpf.Program `ebpf:"fentry_tcp_close"`
+}
+
+func (p *fentryPrograms) attach(recv, closeHook bool) ([]link.Link, error) {
+	var links []link.Link
+
+	progs := []*ebpf.Program{p.FentryTcpSendmsg}
+	if recv {
+		progs = append(progs, p.FexitTcpRecvmsg)
+	}
+	if closeHook {
+		progs = append(progs, p.FentryTcpClose)
+	}
+	for _, prog := range progs {
+		l, err := link.AttachTracing(link.TracingOptions{Program: prog})
+		if err != nil {
+			return links, fmt.Errorf("failed to attach %s: %w", prog, err)
+		}
+		links = append(links, l)
+	}
+	return links, nil
+}
+
+func (p *fentryPrograms) Close() error {
+	return closePrograms(p.FentryTcpSendmsg, p.FexitTcpRecvmsg, p.FentryTcpClose)
+}
+
+func closePrograms(progs ...*ebpf.Program) error {
+	var errs []error
+	for _, prog := range progs {
+		if prog != nil {
+			errs = append(errs, prog.Close())
+		}
+	}
+	return errors.Join(errs...)
+}
+
+// tracerObjects are the maps shared by every tracer, plus the programs of
+// the tcp tracer's attach mode when it is loaded.
+type tracerObjects struct {
+	rpcMaps
+	programs tracerPrograms // nil without the tcp tracer
+	mode     string
+}
+
+func (o *tracerObjects) Close() error {
+	var err error
+	if o.programs != nil {
+		err = o.programs.Close()
+	}
+	return errors.Join(err, o.rpcMaps.Close())
+}
+
+// byName returns the loaded maps keyed by their name in the spec, for
+// loading further programs that share them (CollectionOptions.MapReplacements).
+func (m *rpcMaps) byName() map[string]*ebpf.Map {
+	v := reflect.ValueOf(m).Elem()
+	maps := make(map[string]*ebpf.Map, v.NumField())
+	for i := 0; i < v.NumField(); i++ {
+		name := v.Type().Field(i).Tag.Get("ebpf")
+		if m, ok := v.Field(i).Interface().(*ebpf.Map); ok && m != nil && name != "" {
+			maps[name] = m
+		}
+	}
+	return maps
+}
+
+// fentryRecvmsgVariant returns the fexit program matching the kernel's
+// tcp_recvmsg prototype, which lost its nonblock argument in 5.19.
+// It also reports whether trampolines look usable at all.
+func fentryRecvmsgVariant() (string, error) {
+	if err := features.HaveProgramType(ebpf.Tracing); err != nil {
+		return "", fmt.Errorf("tracing programs unsupported: %w", err)
+	}
+	kernel, err := btf.LoadKernelSpec()
+	if err != nil {
+		return "", fmt.Errorf("kernel BTF unavailable: %w", err)
+	}
+	var fn *btf.Func
+	if err := kernel.TypeByName("tcp_recvmsg", &fn); err != nil {
+		return "", fmt.Errorf("tcp_recvmsg not found in kernel BTF: %w", err)
+	}
+	proto, ok := fn.Type.(*btf.FuncProto)
+	if !ok {
+		return "", fmt.Errorf("tcp_recvmsg has no prototype in kernel BTF")
+	}
+	switch len(proto.Params) {
+	case 5:
+		return "fexit_tcp_recvmsg", nil
+	case 6:
+		return "fexit_tcp_recvmsg_nonblock", nil
+	default:
+		return "", fmt.Errorf("unexpected tcp_recvmsg prototype with %d arguments", len(proto.Params))
+	}
+}
+
+// loadMaps creates the shared maps, or opens the ones a previous agent
+// pinned.
+func loadMaps(spec *ebpf.CollectionSpec) (*tracerObjects, error) {
+	objs := &tracerObjects{}
+	err := spec.LoadAndAssign(&objs.rpcMaps, collectionOptions(nil))
+	if errors.Is(err, ebpf.ErrMapIncompatible) && pinningEnabled() {
+		// Maps pinned by a build with other map definitions. The previous
+		// generation keeps its maps until takeOver detaches it.
+		log.Printf("Pinned maps in %s do not match this build (%v), replacing them", BPFPinPath, err)
+		if err = removePinnedMaps(); err == nil {
+			err = spec.LoadAndAssign(&objs.rpcMaps, collectionOptions(nil))
+		}
+	}
+	if err != nil {
+		return nil, fmt.Errorf("failed to load eBPF maps: %w", err)
+	}
+	return objs, nil
+}
+
+// loadPrograms loads the programs for mode on top of maps.
+func loadPrograms(spec *ebpf.CollectionSpec, mode string, maps *rpcMaps) (tracerPrograms, error) {
+	opts := collectionOptions(maps.byName())
+	switch mode {
+	case AttachFentry:
+		variant, err := fentryRecvmsgVariant()
+		if err != nil {
+			return nil, err
+		}
+		spec = spec.Copy()
+		spec.Programs["fexit_tcp_recvmsg"] = spec.Programs[variant]
+
+		var progs fentryPrograms
+		if err := spec.LoadAndAssign(&progs, opts); err != nil {
+			return nil, err
+		}
+		return &progs, nil
+	default:
+		var progs kprobePrograms
+		if err := spec.LoadAndAssign(&progs, opts); err != nil {
+			return nil, err
+		}
+		return &progs, nil
+	}
+}
+
+// attachTCP loads and attaches the tcp programs in the configured attach
+// mode, with the hooks selected by recv and closeHook (see tracerPrograms). In
+// auto mode a failure to load or attach the fentry programs falls back to
+// kprobes.
+func attachTCP(spec *ebpf.CollectionSpec, objs *tracerObjects, recv, closeHook bool) ([]link.Link, error) {
+	switch AttachMode {
+	case AttachAuto, AttachFentry, AttachKprobe:
+	default:
+		return nil, fmt.Errorf("unknown ATTACH_MODE %q (want auto, fentry or kprobe)", AttachMode)
+	}
+
+	if AttachMode != AttachKprobe {
+		links, err := tryAttach(spec, objs, AttachFentry, recv, closeHook)
+		if err == nil {
+			return links, nil
+		}
+		if AttachMode == AttachFentry {
+			return nil, fmt.Errorf("fentry attach mode: %w", err)
+		}
+		log.Printf("fentry/fexit unavailable (%v), falling back to kprobes", err)
+	}
+	return tryAttach(spec, objs, AttachKprobe, recv, closeHook)
+}
+
+func tryAttach(spec *ebpf.CollectionSpec, objs *tracerObjects, mode string, recv, closeHook bool) ([]link.Link, error) {
+	progs, err := loadPrograms(spec, mode, &objs.rpcMaps)
+	if err != nil {
+		return nil, fmt.Errorf("failed to load eBPF programs: %w", err)
+	}
+	links, err := progs.attach(recv, closeHook)
+	if err != nil {
+		closeLinks(links)
+		progs.Close()
+		return nil, err
+	}
+	objs.programs, objs.mode = progs, mode
+	return links, nil
+}
+
+func closeLinks(links []link.Link) {
+	for _, l := range links {
+		l.Close()
+	}
+}
@@ -0,0 +1,348 @@
+package main
+
+import (
+	"bufio"
+	"context"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"log"
+	"net"
+	"os"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"time"
+)
+
+// Benchmark configuration - can be overridden by environment variables
+var (
+	BenchDuration = getEnvDuration("BENCH_DURATION", 3*time.Second) // Per load generator run
+)
+
+// Event recording - can be overridden by environment variables
+var (
+	RecordEventsFile = getEnv("RECORD_EVENTS_FILE", "")       // Raw records are appended here for BENCH_REPLAY_FILE
+	RecordEventsMax  = getEnvInt("RECORD_EVENTS_MAX", 100000) // Records written before recording stops
+)
+
+// maxLatencySamples bounds the per-call latencies kept by the load generator
+const maxLatencySamples = 1 << 20
+
+// eventRecorder appends raw records to a file, each prefixed with its
+// little-endian uint32 length. Only the reader goroutine writes to it.
+type eventRecorder struct {
+	f    *os.File
+	w    *bufio.Writer
+	left int
+}
+
+func newEventRecorder(path string, max int) (*eventRecorder, error) {
+	f, err := os.OpenFile(path, os.O_WRONLY|os.O_CREATE|os.O_APPEND, 0o644)
+	if err != nil {
+		return nil, fmt.Errorf("failed to open RECORD_EVENTS_FILE: %w", err)
+	}
+	return &eventRecorder{f: f, w: bufio.NewWriter(f), left: max}, nil
+}
+
+func (r *eventRecorder) write(raw []byte) {
+	if r.left <= 0 {
+		return
+	}
+	r.left--
+	var n [4]byte
+	binary.LittleEndian.PutUint32(n[:], uint32(len(raw)))
+	r.w.Write(n[:])
+	r.w.Write(raw)
+	if r.left == 0 {
+		r.w.Flush()
+		log.Printf("Recorded %d events to %s", RecordEventsMax, RecordEventsFile)
+	}
+}
+
+func (r *eventRecorder) Close() error {
+	return errors.Join(r.w.Flush(), r.f.Close())
+}
+
+// benchAgent is an Agent wired for benchmarks: no NATS, no DNS, and a
+// publisher whose queue is drained and encoded by drain.
+func benchAgent(ctx context.Context) (*Agent, error) {
+	pub, err := newPublisher(nil, nil)
+	if err != nil {
+		return nil, err
+	}
+	dns := newHostnameCache(ctx, DNSCacheSize, 1)
+	dns.lookupAddr = func(context.Context, string) ([]string, error) {
+		return []string{"rpc.bench.example."}, nil
+	}
+	return &Agent{Ctx: ctx, DNS: dns, Subjects: newSubjectCache(), Publisher: pub}, nil
+}
+
+// releaseQueued discards queued features until ctx is done.
+func releaseQueued(ctx context.Context, p *publisher) {
+	for {
+		select {
+		case f := <-p.queue:
+			releaseFeature(&f)
+		case <-ctx.Done():
+			return
+		}
+	}
+}
+
+// runBench runs the kernel benchmark and returns the process exit code.
+// The userspace benchmarks are Benchmark functions in bench_test.go.
+func runBench(args []string) int {
+	if len(args) > 0 && args[0] != "kernel" {
+		log.Printf("Unknown benchmark %q (want kernel; run the userspace ones with go test -bench)", args[0])
+		return 1
+	}
+	if err := benchKernel(); err != nil {
+		log.Printf("Benchmark failed: %v", err)
+		return 1
+	}
+	return 0
+}
+
+func percentiles(lat []time.Duration) (p50, p99 time.Duration) {
+	if len(lat) == 0 {
+		return 0, 0
+	}
+	sort.Slice(lat, func(i, j int) bool { return lat[i] < lat[j] })
+	return lat[len(lat)/2], lat[len(lat)*99/100]
+}
+
+// loadResult is one load generator run.
+type loadResult struct {
+	sends    uint64
+	elapsed  time.Duration
+	mean     time.Duration // Of one write(2), probes included
+	p99      time.Duration
+	records  uint64 // Read from the transport
+	lost     uint64 // Reported lost by the transport
+	overflow uint64 // Counted by the kernel as not fitting in the transport
+	dropped  uint64 // Dropped by the worker queues
+	tracerOn bool
+}
+
+// benchKernel drives tcp_sendmsg over loopback at each of BENCH_RATES,
+// untraced and then under each transport, and reports the probe cost per
+// call and how many records the transport lost. Requires root.
+func benchKernel() error {
+	portList := getEnvList("BENCH_PORTS", "8545,443")
+	var ports []uint16
+	for _, item := range portList {
+		port, err := strconv.ParseUint(item, 10, 16)
+		if err != nil {
+			return fmt.Errorf("invalid BENCH_PORTS entry %q: %w", item, err)
+		}
+		ports = append(ports, uint16(port))
+	}
+	var rates []int
+	for _, item := range getEnvList("BENCH_RATES", "10000,50000,0") { // 0 = as fast as possible
+		rate, err := strconv.Atoi(item)
+		if err != nil || rate < 0 {
+			return fmt.Errorf("invalid BENCH_RATES entry %q", item)
+		}
+		rates = append(rates, rate)
+	}
+
+	// Trace this process only, whatever the filters say
+	TargetPID = os.Getpid()
+	os.Setenv("FILTER_COMMS", "")
+	os.Setenv("FILTER_PORTS", strings.Join(portList, ","))
+	CaptureMode = CaptureEvents
+	Tracers = []string{"tcp"}
+	MetricsAddr = "off"
+	BPFPinPath = "off" // Never take over from a running agent
+	DebugMode = false
+
+	stop, err := loopbackSinks(ports)
+	if err != nil {
+		return err
+	}
+	defer stop()
+	payload := []byte("POST / HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json\r\nContent-Length: 64\r\n\r\n" +
+		`{"jsonrpc":"2.0","id":1,"method":"eth_call","params":[{},"latest"]}`)
+
+	fmt.Printf("Kernel probes, %s per run, ports %s\n", BenchDuration, strings.Join(portList, ","))
+	fmt.Printf("%-10s %10s %12s %10s %10s %10s %10s %8s\n", "transport", "rate", "sends/s", "mean", "p99", "overhead", "p99 over", "lost")
+	for _, rate := range rates {
+		base, err := generateLoad(ports, rate, BenchDuration, payload)
+		if err != nil {
+			return err
+		}
+		printLoadResult("none", rate, base, base)
+		for _, transport := range getEnvList("BENCH_TRANSPORTS", "ringbuf,perf") {
+			res, err := tracedLoad(transport, ports, rate, payload)
+			if err != nil {
+				return fmt.Errorf("%s: %w", transport, err)
+			}
+			printLoadResult(transport, rate, res, base)
+		}
+	}
+	return nil
+}
+
+// tracedLoad attaches the tracer with transport, generates load and
+// detaches again.
+func tracedLoad(transport string, ports []uint16, rate int, payload []byte) (loadResult, error) {
+	ctx, cancel := context.WithCancel(context.Background())
+	defer cancel()
+	a, err := benchAgent(ctx)
+	if err != nil {
+		return loadResult{}, err
+	}
+	a.Cancel = cancel
+	a.ready = make(chan struct{})
+	go releaseQueued(ctx, a.Publisher)
+
+	EventTransport = transport
+	errc := make(chan error, 1)
+	go func() { errc <- a.RunTracer() }()
+	select {
+	case err := <-errc:
+		return loadResult{}, err
+	case <-a.ready:
+	}
+
+	res, err := generateLoad(ports, rate, BenchDuration, payload)
+	time.Sleep(200 * time.Millisecond) // Let the reader catch up
+	res.records, res.lost, res.dropped = a.recordsRead.Load(), a.samplesLost.Load(), a.pipeline.dropped.Load()
+	if counters, cerr := readKernelCounters(a.EBPFObjs.DropCounters); cerr == nil {
+		for _, n := range counters[counterOutput] {
+			res.overflow += n
+		}
+	}
+	res.tracerOn = true
+	cancel()
+	if rerr := <-errc; err == nil {
+		err = rerr
+	}
+	if a.EBPFObjs != nil {
+		a.EBPFObjs.Close()
+	}
+	return res, err
+}
+
+// loopbackSinks listens on 127.0.0.1 at each port and discards what it
+// receives. The returned function closes the listeners.
+func loopbackSinks(ports []uint16) (func(), error) {
+	var listeners []net.Listener
+	stop := func() {
+		for _, l := range listeners {
+			l.Close()
+		}
+	}
+	for _, port := range ports {
+		l, err := net.Listen("tcp4", fmt.Sprintf("127.0.0.1:%d", port))
+		if err != nil {
+			stop()
+			return nil, fmt.Errorf("failed to listen on port %d: %w", port, err)
+		}
+		listeners = append(listeners, l)
+		go func() {
+			for {
+				c, err := l.Accept()
+				if err != nil {
+					return
+				}
+				go func() {
+					io.Copy(io.Discard, c)
+					c.Close()
+				}()
+			}
+		}()
+	}
+	return stop, nil
+}
+
+// generateLoad writes payload over one connection per port for d, at rate
+// sends per second in total (0 = unthrottled), timing each write.
+func generateLoad(ports []uint16, rate int, d time.Duration, payload []byte) (loadResult, error) {
+	type sender struct {
+		sends uint64
+		lat   []time.Duration
+		err   error
+	}
+	senders := make([]sender, len(ports))
+	perConn := float64(rate) / float64(len(ports))
+
+	var wg sync.WaitGroup
+	start := time.Now()
+	for i, port := range ports {
+		conn, err := net.Dial("tcp4", fmt.Sprintf("127.0.0.1:%d", port))
+		if err != nil {
+			return loadResult{}, fmt.Errorf("failed to connect to port %d: %w", port, err)
+		}
+		wg.Add(1)
+		go func(s *sender) {
+			defer wg.Done()
+			defer conn.Close()
+			s.lat = make([]time.Duration, 0, maxLatencySamples/len(ports))
+			for {
+				now := time.Now()
+				elapsed := now.Sub(start)
+				if elapsed >= d {
+					return
+				}
+				// Pace by count rather than per send, since sleeps are coarse
+				if perConn > 0 && float64(s.sends) >= perConn*elapsed.Seconds() {
+					time.Sleep(100 * time.Microsecond)
+					continue
+				}
+				if _, err := conn.Write(payload); err != nil {
+					s.err = err
+					return
+				}
+				if len(s.lat) < cap(s.lat) {
+					s.lat = append(s.lat, time.Since(now))
+				}
+				s.sends++
+			}
+		}(&senders[i])
+	}
+	wg.Wait()
+
+	res := loadResult{elapsed: time.Since(start)}
+	var lat []time.Duration
+	for _, s := range senders {
+		if s.err != nil {
+			return res, fmt.Errorf("send failed: %w", s.err)
+		}
+		res.sends += s.sends
+		lat = append(lat, s.lat...)
+	}
+	var total time.Duration
+	for _, l := range lat {
+		total += l
+	}
+	if len(lat) > 0 {
+		res.mean = total / time.Duration(len(lat))
+	}
+	_, res.p99 = percentiles(lat)
+	return res, nil
+}
+
+func printLoadResult(transport string, rate int, res, base loadResult) {
+	rateStr := "max"
+	if rate > 0 {
+		rateStr = strconv.Itoa(rate)
+	}
+	lost := "-"
+	if res.tracerOn && res.sends > 0 {
+		missing := uint64(0)
+		if res.sends > res.records {
+			missing = res.sends - res.records
+		}
+		lost = fmt.Sprintf("%.2f%%", 100*float64(missing)/float64(res.sends))
+		if res.lost > 0 || res.overflow > 0 || res.dropped > 0 {
+			lost += fmt.Sprintf(" (%d lost, %d overflowed, %d dropped)", res.lost, res.overflow, res.dropped)
+		}
+	}
+	fmt.Printf("%-10s %10s %12.0f %10s %10s %10s %10s %8s\n", transport, rateStr,
+		float64(res.sends)/res.elapsed.Seconds(), res.mean, res.p99,
+		res.mean-base.mean, res.p99-base.p99, lost)
+}
@@ -0,0 +1,361 @@
+package main
+
+import (
+	"bytes"
+	"context"
+	"encoding/binary"
+	"fmt"
+	"os"
+	"strconv"
+	"testing"
+	"time"
+)
+
+// Benchmark configuration - can be overridden by environment variables
+var (
+	BenchReplayFile = getEnv("BENCH_REPLAY_FILE", "")   // Records written with RECORD_EVENTS_FILE; synthetic if unset
+	BenchSamples    = getEnvInt("BENCH_SAMPLES", 10000) // Individually timed events per stage, for percentiles (0 = off)
+	BenchMaxAllocs  = getEnvInt("BENCH_MAX_ALLOCS", -1) // Fail when a stage allocates more per event (-1 = off)
+	BenchSpoolDir   = getEnv("BENCH_SPOOL_DIR", "")     // Capture made with SPOOL_MODE=capture; synthetic if unset
+)
+
+// readRecords loads a file written by eventRecorder.
+func readRecords(path string) ([][]byte, error) {
+	data, err := os.ReadFile(path)
+	if err != nil {
+		return nil, err
+	}
+	var records [][]byte
+	for len(data) >= 4 {
+		n := int(binary.LittleEndian.Uint32(data))
+		if 4+n > len(data) {
+			return nil, fmt.Errorf("%s: truncated record", path)
+		}
+		records = append(records, data[4:4+n])
+		data = data[4+n:]
+	}
+	if len(records) == 0 {
+		return nil, fmt.Errorf("%s: no records", path)
+	}
+	return records, nil
+}
+
+// benchRecord builds a raw record as the BPF program emits it.
+func benchRecord(hdr RPCEventHeader, payload string, trailer *rpcRecordTrailer) []byte {
+	le := binary.LittleEndian
+	raw := make([]byte, rpcEventHeaderSize, maxRecordSize)
+	le.PutUint64(raw[offPID:], hdr.PID)
+	le.PutUint64(raw[offTimestampNs:], hdr.TimestampNs)
+	le.PutUint32(raw[offDataLen:], hdr.DataLen)
+	le.PutUint32(raw[offSockID:], hdr.SockID)
+	le.PutUint32(raw[offDestIP:], hdr.DestIP)
+	le.PutUint16(raw[offDestPort:], hdr.DestPort)
+	le.PutUint16(raw[offCapLen:], uint16(len(payload)))
+	copy(raw[offComm:], hdr.Comm[:])
+	le.PutUint16(raw[offMethodID:], hdr.MethodID)
+	le.PutUint16(raw[offKind:], hdr.Kind)
+	le.PutUint32(raw[offWeight:], 1)
+	le.PutUint64(raw[offCgroupID:], hdr.CgroupID)
+	if trailer != nil {
+		raw = le.AppendUint64(raw, trailer.LatencyNs)
+		raw = le.AppendUint32(raw, trailer.RespLen)
+		raw = le.AppendUint32(raw, 0)
+	}
+	return append(raw, payload...)
+}
+
+// syntheticRecords is a mix of the records a busy client produces: mostly
+// sends classified in kernel, plus unknown names and batches that ship
+// their payload, and flow completions.
+func syntheticRecords() [][]byte {
+	const body = `{"jsonrpc":"2.0","id":1,"method":"%s","params":[]}`
+	http := func(json string) string {
+		return "POST / HTTP/1.1\r\nHost: rpc\r\nContent-Type: application/json\r\nContent-Length: " +
+			strconv.Itoa(len(json)) + "\r\n\r\n" + json
+	}
+	var comm [16]byte
+	copy(comm[:], "node")
+
+	var records [][]byte
+	for i := 0; i < 64; i++ {
+		hdr := RPCEventHeader{
+			PID:         uint64(1000+i%4) << 32,
+			TimestampNs: uint64(i) * 1000,
+			SockID:      uint32(i % 16),
+			DestIP:      binary.LittleEndian.Uint32([]byte{10, 0, byte(i % 8), 1}),
+			DestPort:    []uint16{8545, 443}[i%2],
+			Comm:        comm,
+			Kind:        recordSend,
+		}
+		payload := ""
+		switch {
+		case i%16 == 0:
+			payload = http(fmt.Sprintf(body, "custom_method"))
+		case i%16 == 1:
+			payload = http(`[` + fmt.Sprintf(body, "eth_call") + `,` + fmt.Sprintf(body, "eth_getBalance") + `]`)
+			hdr.MethodID = uint16(1)
+		case i%16 == 2:
+			hdr.Kind = recordRPC
+			hdr.MethodID = uint16(i%len(knownMethods) + 1)
+			hdr.DataLen = 300
+			records = append(records, benchRecord(hdr, "", &rpcRecordTrailer{LatencyNs: 2e6, RespLen: 900}))
+			continue
+		default:
+			hdr.MethodID = uint16(i%len(knownMethods) + 1)
+		}
+		hdr.DataLen = uint32(len(payload))
+		if payload == "" {
+			hdr.DataLen = 300
+		}
+		records = append(records, benchRecord(hdr, payload, nil))
+	}
+	return records
+}
+
+// benchRecords returns the records of BENCH_REPLAY_FILE, or the synthetic
+// ones when it is unset.
+func benchRecords(b *testing.B) [][]byte {
+	DebugMode = false
+	if BenchReplayFile == "" {
+		return syntheticRecords()
+	}
+	records, err := readRecords(BenchReplayFile)
+	if err != nil {
+		b.Fatalf("failed to read BENCH_REPLAY_FILE: %v", err)
+	}
+	return records
+}
+
+// drain encodes and releases queued features, as the publisher does
+// before handing a message to NATS.
+func drain(p *publisher) {
+	var one [1]MonitoringFeature
+	for {
+		select {
+		case one[0] = <-p.queue:
+			p.encode(one[:], false)
+			releaseFeature(&one[0])
+		default:
+			return
+		}
+	}
+}
+
+// benchStage times run over records, one record per op. It fails when run
+// allocates more than BENCH_MAX_ALLOCS per record, and reports p50 and p99
+// over BENCH_SAMPLES individually timed records.
+func benchStage(b *testing.B, records [][]byte, run func(raw []byte)) {
+	for _, raw := range records {
+		run(raw) // Warm the method, subject, DNS and comm caches
+	}
+	if BenchMaxAllocs >= 0 {
+		i := 0
+		n := testing.AllocsPerRun(len(records), func() {
+			run(records[i%len(records)])
+			i++
+		})
+		if n > float64(BenchMaxAllocs) {
+			b.Fatalf("allocates %.1f times per record, more than BENCH_MAX_ALLOCS=%d", n, BenchMaxAllocs)
+		}
+	}
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		run(records[i%len(records)])
+	}
+	b.StopTimer()
+
+	if BenchSamples > 0 {
+		lat := make([]time.Duration, BenchSamples)
+		for i := range lat {
+			start := time.Now()
+			run(records[i%len(records)])
+			lat[i] = time.Since(start)
+		}
+		p50, p99 := percentiles(lat)
+		b.ReportMetric(float64(p50.Nanoseconds()), "p50-ns")
+		b.ReportMetric(float64(p99.Nanoseconds()), "p99-ns")
+	}
+}
+
+func BenchmarkDecode(b *testing.B) {
+	records := benchRecords(b)
+	var event RPCEvent
+	benchStage(b, records, func(raw []byte) { decodeRPCEvent(raw, &event) })
+}
+
+func BenchmarkMethodExtraction(b *testing.B) {
+	records := benchRecords(b)
+	var event RPCEvent
+	dst := make([]methodCount, 0, maxBatchMethods+1)
+	benchStage(b, records, func(raw []byte) {
+		if decodeRPCEvent(raw, &event) == nil && len(event.Data) > 0 {
+			dst = extractMethods(dst[:0], event.Data, event.DataLen)
+		}
+	})
+}
+
+func BenchmarkProcess(b *testing.B) {
+	records := benchRecords(b)
+	ctx, cancel := context.WithCancel(context.Background())
+	defer cancel()
+	a, err := benchAgent(ctx)
+	if err != nil {
+		b.Fatal(err)
+	}
+	p := &eventPipeline{agent: a}
+	var event RPCEvent
+	benchStage(b, records, func(raw []byte) {
+		p.process(raw, &event, nil, false)
+		drain(a.Publisher)
+	})
+}
+
+func BenchmarkReassemble(b *testing.B) {
+	records := benchRecords(b)
+	ctx, cancel := context.WithCancel(context.Background())
+	defer cancel()
+	a, err := benchAgent(ctx)
+	if err != nil {
+		b.Fatal(err)
+	}
+	p := &eventPipeline{agent: a}
+	reasm := newReassembler(ReassemblyConns, ReassemblyBufferBytes, ReassemblyIdle, a.processAndPublishRPCEvent)
+	var event RPCEvent
+	benchStage(b, records, func(raw []byte) {
+		p.process(raw, &event, reasm, false)
+		drain(a.Publisher)
+	})
+}
+
+// BenchmarkPipeline runs records from the reader through the workers, end
+// to end. The pipeline is rebuilt per run since stop closes its queues.
+func BenchmarkPipeline(b *testing.B) {
+	records := benchRecords(b)
+	ctx, cancel := context.WithCancel(context.Background())
+	defer cancel()
+	a, err := benchAgent(ctx)
+	if err != nil {
+		b.Fatal(err)
+	}
+	pl, err := newEventPipeline(a)
+	if err != nil {
+		b.Fatal(err)
+	}
+	pl.policy = BackpressureBlock
+	drainCtx, stopDrain := context.WithCancel(ctx)
+	drained := make(chan struct{})
+	go func() {
+		defer close(drained)
+		releaseQueued(drainCtx, a.Publisher)
+	}()
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	pl.start()
+	for i := 0; i < b.N; i++ {
+		pl.dispatch(records[i%len(records)])
+	}
+	pl.stop()
+	b.StopTimer()
+	stopDrain()
+	<-drained
+	drain(a.Publisher)
+}
+
+// syntheticMessages encodes the features of the synthetic records, one
+// message each, as the publisher would send them.
+func syntheticMessages() ([]spoolMessage, error) {
+	DebugMode = false
+	ctx, cancel := context.WithCancel(context.Background())
+	defer cancel()
+	a, err := benchAgent(ctx)
+	if err != nil {
+		return nil, err
+	}
+	p := &eventPipeline{agent: a}
+	var event RPCEvent
+	var msgs []spoolMessage
+	var one [1]MonitoringFeature
+	kind := spoolJSON
+	if a.Publisher.enc.msgpack {
+		kind = spoolMsgpack
+	}
+	for _, raw := range syntheticRecords() {
+		p.process(raw, &event, nil, false)
+		for len(a.Publisher.queue) > 0 {
+			one[0] = <-a.Publisher.queue
+			data := a.Publisher.encode(one[:], false)
+			msgs = append(msgs, spoolMessage{one[0].ContextHash, kind, bytes.Clone(data)})
+			releaseFeature(&one[0])
+		}
+	}
+	if len(msgs) == 0 {
+		return nil, fmt.Errorf("synthetic records produced no features")
+	}
+	return msgs, nil
+}
+
+// benchSpool opens a spool in a temporary directory and returns it with
+// the messages to write to it: the synthetic records' features, or a
+// capture made with SPOOL_MODE=capture when BENCH_SPOOL_DIR is set.
+func benchSpool(b *testing.B) (*spool, []spoolMessage) {
+	msgs, err := syntheticMessages()
+	if BenchSpoolDir != "" {
+		msgs, err = readSpool(BenchSpoolDir)
+	}
+	if err != nil {
+		b.Fatalf("failed to read messages: %v", err)
+	}
+	sp, err := newSpool(b.TempDir(), SpoolSegmentBytes, SpoolMaxBytes, false)
+	if err != nil {
+		b.Fatal(err)
+	}
+	b.Cleanup(func() { sp.Close() })
+	return sp, msgs
+}
+
+func discardMessage(string, byte, []byte) error { return nil }
+
+// emptySpool replays every message in sp.
+func emptySpool(sp *spool) {
+	for more := true; more; {
+		more, _ = sp.replay(discardMessage)
+	}
+}
+
+func BenchmarkSpoolAppend(b *testing.B) {
+	sp, msgs := benchSpool(b)
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		m := &msgs[i%len(msgs)]
+		sp.append(m.subject, m.kind, m.data)
+		if i%len(msgs) == 0 && sp.backlog() > int64(SpoolMaxBytes/2) {
+			b.StopTimer() // Stay below SPOOL_MAX_BYTES
+			emptySpool(sp)
+			b.StartTimer()
+		}
+	}
+	b.StopTimer()
+	if n := sp.dropped.Load(); n > 0 {
+		b.Errorf("%d messages dropped at SPOOL_MAX_BYTES=%d", n, SpoolMaxBytes)
+	}
+}
+
+func BenchmarkSpoolReplay(b *testing.B) {
+	sp, msgs := benchSpool(b)
+	fill := func() {
+		for _, m := range msgs {
+			sp.append(m.subject, m.kind, m.data)
+		}
+	}
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		if more, _ := sp.replay(discardMessage); !more {
+			b.StopTimer()
+			fill()
+			b.StartTimer()
+		}
+	}
+}
@@ -0,0 +1,115 @@
+package main
+
+import (
+	"fmt"
+	"log"
+	"time"
+
+	"github.com/cilium/ebpf"
+)
+
+// Adaptive capture depth - can be overridden by environment variables.
+// Payload is copied for a socket's first CAPTURE_DEPTH sends; once they all
+// named the same known method, later sends that open like the probed ones
+// are reported as metadata plus that method, and the rest as unknown.
+// Unclassified and mixed-method sockets keep their payload.
+var (
+	CaptureDepth           = getEnvInt("CAPTURE_DEPTH", 4)                             // Sends probed per socket (0 = copy every send)
+	CaptureVerifyEvery     = getEnvInt("CAPTURE_VERIFY_EVERY", 32)                     // Labelled sends per spot check of the learned method (0 = never)
+	CaptureReprobeInterval = getEnvDuration("CAPTURE_REPROBE_INTERVAL", 5*time.Minute) // Metadata-only sockets are probed again this often (0 = never)
+)
+
+// captureKey mirrors struct capture_key in rpc_tracer.c: the PID, SockID,
+// DestIP and DestPort of a socket's records.
+type captureKey struct {
+	TGID     uint32
+	SockID   uint32
+	DestIP   uint32
+	DestPort uint16
+	_        uint16
+}
+
+// captureState mirrors struct capture_state in rpc_tracer.c
+type captureState struct {
+	ProbesLeft  uint32
+	MethodID    uint16
+	NeedPayload uint8
+	Mixed       uint8
+	Stamped     uint16
+	Lead        uint8
+	_           uint8
+}
+
+func captureDepthEnabled() bool {
+	return CaptureDepth > 0 && PayloadCapture > 0
+}
+
+// configureCaptureDepth sets capture_depth and capture_verify in spec.
+func configureCaptureDepth(spec *ebpf.CollectionSpec) error {
+	if CaptureDepth < 0 {
+		return fmt.Errorf("CAPTURE_DEPTH must not be negative, got %d", CaptureDepth)
+	}
+	if CaptureVerifyEvery < 0 || CaptureVerifyEvery > 65535 {
+		return fmt.Errorf("CAPTURE_VERIFY_EVERY must be between 0 and 65535, got %d", CaptureVerifyEvery)
+	}
+	return spec.RewriteConstants(map[string]interface{}{
+		"capture_depth":  uint32(CaptureDepth),
+		"capture_verify": uint32(CaptureVerifyEvery),
+	})
+}
+
+// setNeedsPayload makes the kernel copy the payload of a socket's sends
+// again for CAPTURE_DEPTH sends, relearning its method and how its
+// requests open, or stops copying it and reports method for its sends that
+// start with lead from now on.
+func setNeedsPayload(m *ebpf.Map, key captureKey, need bool, method uint16, lead byte) error {
+	state := captureState{MethodID: method, Lead: lead}
+	if need {
+		state = captureState{ProbesLeft: uint32(CaptureDepth), NeedPayload: 1}
+	}
+	return m.Put(key, state)
+}
+
+// runCaptureReprobe re-probes the sockets reported metadata-only every
+// interval, so one whose requests moved to another method is noticed.
+func (a *Agent) runCaptureReprobe(m *ebpf.Map, interval time.Duration) {
+	ticker := time.NewTicker(interval)
+	defer ticker.Stop()
+	for {
+		select {
+		case <-a.Ctx.Done():
+			return
+		case <-ticker.C:
+			n, err := reprobeCaptures(m)
+			if err != nil {
+				log.Printf("Failed to re-probe sockets: %v", err)
+			} else if DebugMode {
+				log.Printf("DEBUG: Re-probing the method of %d metadata-only sockets", n)
+			}
+		}
+	}
+}
+
+// reprobeCaptures sets need_payload on every socket that has it clear.
+func reprobeCaptures(m *ebpf.Map) (int, error) {
+	var (
+		key   captureKey
+		state captureState
+		keys  []captureKey
+	)
+	iter := m.Iterate()
+	for iter.Next(&key, &state) {
+		if state.NeedPayload == 0 {
+			keys = append(keys, key)
+		}
+	}
+	if err := iter.Err(); err != nil {
+		return 0, fmt.Errorf("failed to iterate capture_socks: %w", err)
+	}
+	for _, k := range keys {
+		if err := setNeedsPayload(m, k, true, methodUnknown, 0); err != nil {
+			return 0, fmt.Errorf("failed to update capture_socks: %w", err)
+		}
+	}
+	return len(keys), nil
+}
@@ -0,0 +1,17 @@
+package main
+
+import (
+	"encoding/binary"
+	"testing"
+)
+
+// TestCaptureLayout checks the map mirrors against the sizes of struct
+// capture_key and struct capture_state in rpc_tracer.c.
+func TestCaptureLayout(t *testing.T) {
+	if n := binary.Size(captureKey{}); n != 16 {
+		t.Errorf("captureKey is %d bytes, want 16", n)
+	}
+	if n := binary.Size(captureState{}); n != 12 {
+		t.Errorf("captureState is %d bytes, want 12", n)
+	}
+}
@@ -0,0 +1,260 @@
+package main
+
+import (
+	"container/list"
+	"context"
+	"encoding/json"
+	"net"
+	"net/netip"
+	"os"
+	"path/filepath"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+// DNS cache configuration - can be overridden by environment variables
+var (
+	DNSCacheSize   = getEnvInt("DNS_CACHE_SIZE", 4096)
+	DNSWorkers     = getEnvInt("DNS_WORKERS", 4)
+	DNSTTL         = getEnvDuration("DNS_TTL", 5*time.Minute)
+	DNSNegativeTTL = getEnvDuration("DNS_NEGATIVE_TTL", time.Minute)
+	DNSTimeout     = getEnvDuration("DNS_TIMEOUT", 2*time.Second)
+	DNSCacheFile   = getEnv("DNS_CACHE_FILE", "") // Resolved names kept across restarts, if set
+)
+
+// hostnameEntry is a cached reverse lookup. Until the first resolution
+// completes, and after a failed one, hostname is the hyphenated IP.
+type hostnameEntry struct {
+	ip       netip.Addr
+	ipStr    string // Dotted (IPv4) or RFC 5952 (IPv6) notation
+	hostname string // Sanitized for use as a NATS subject token
+	expires  time.Time
+	pending  bool // Queued for (re)resolution
+}
+
+// hostnameCache resolves destination IPs to subject-safe hostnames without
+// ever blocking the caller: misses and expired entries are answered from
+// the IP fallback or the stale name while a worker pool resolves in the
+// background. Size is bounded by LRU eviction.
+type hostnameCache struct {
+	mu       sync.Mutex
+	entries  map[netip.Addr]*list.Element
+	lru      *list.List // Front = most recently used
+	capacity int
+	queue    chan netip.Addr
+	hits     atomic.Uint64 // Lookups of cached entries, fresh or stale
+	misses   atomic.Uint64
+
+	// lookupAddr is net.DefaultResolver.LookupAddr, replaceable for benchmarks
+	lookupAddr func(ctx context.Context, addr string) ([]string, error)
+}
+
+// newHostnameCache creates a cache and starts its resolver workers, which
+// exit when ctx is cancelled.
+func newHostnameCache(ctx context.Context, capacity, workers int) *hostnameCache {
+	if capacity < 1 {
+		capacity = 1
+	}
+	if workers < 1 {
+		workers = 1
+	}
+	c := &hostnameCache{
+		entries:    make(map[netip.Addr]*list.Element, capacity),
+		lru:        list.New(),
+		capacity:   capacity,
+		queue:      make(chan netip.Addr, capacity),
+		lookupAddr: net.DefaultResolver.LookupAddr,
+	}
+	for i := 0; i < workers; i++ {
+		go c.worker(ctx)
+	}
+	return c
+}
+
+// Lookup returns the printed IP and the best hostname currently known for ip.
+func (c *hostnameCache) Lookup(ip netip.Addr) (ipStr, hostname string) {
+	now := time.Now()
+
+	c.mu.Lock()
+	defer c.mu.Unlock()
+
+	if el, ok := c.entries[ip]; ok {
+		c.hits.Add(1)
+		c.lru.MoveToFront(el)
+		e := el.Value.(*hostnameEntry)
+		if now.After(e.expires) && !e.pending {
+			c.enqueueLocked(e)
+		}
+		return e.ipStr, e.hostname
+	}
+
+	c.misses.Add(1)
+	ipStr = ip.String()
+	e := &hostnameEntry{
+		ip:       ip,
+		ipStr:    ipStr,
+		hostname: ipToken(ipStr),
+	}
+	c.entries[ip] = c.lru.PushFront(e)
+	if c.lru.Len() > c.capacity {
+		oldest := c.lru.Back()
+		c.lru.Remove(oldest)
+		delete(c.entries, oldest.Value.(*hostnameEntry).ip)
+	}
+	c.enqueueLocked(e)
+	return e.ipStr, e.hostname
+}
+
+// enqueueLocked hands e to the workers. If the queue is full the entry
+// stays unresolved and is retried on a later Lookup.
+func (c *hostnameCache) enqueueLocked(e *hostnameEntry) {
+	select {
+	case c.queue <- e.ip:
+		e.pending = true
+	default:
+	}
+}
+
+func (c *hostnameCache) worker(ctx context.Context) {
+	for {
+		select {
+		case <-ctx.Done():
+			return
+		case ip := <-c.queue:
+			c.resolve(ctx, ip)
+		}
+	}
+}
+
+// resolve performs the reverse lookup for ip and stores the result,
+// caching failures for DNSNegativeTTL.
+func (c *hostnameCache) resolve(ctx context.Context, ip netip.Addr) {
+	c.mu.Lock()
+	el, ok := c.entries[ip]
+	if !ok {
+		c.mu.Unlock()
+		return // Evicted while queued
+	}
+	ipStr := el.Value.(*hostnameEntry).ipStr
+	c.mu.Unlock()
+
+	lookupCtx, cancel := context.WithTimeout(ctx, DNSTimeout)
+	names, err := c.lookupAddr(lookupCtx, ipStr)
+	cancel()
+
+	hostname := ""
+	ttl := DNSNegativeTTL
+	if err == nil && len(names) > 0 {
+		hostname = sanitizeHostname(names[0])
+		ttl = DNSTTL
+	}
+
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	if el, ok = c.entries[ip]; !ok {
+		return
+	}
+	e := el.Value.(*hostnameEntry)
+	if hostname != "" {
+		e.hostname = hostname
+	}
+	e.expires = time.Now().Add(ttl)
+	e.pending = false
+}
+
+// savedHostname is a resolved entry in DNS_CACHE_FILE
+type savedHostname struct {
+	IP       netip.Addr `json:"ip"`
+	Hostname string     `json:"hostname"`
+	Expires  time.Time  `json:"expires"`
+}
+
+// save writes the resolved entries to path, least recently used first.
+func (c *hostnameCache) save(path string) error {
+	c.mu.Lock()
+	saved := make([]savedHostname, 0, c.lru.Len())
+	for el := c.lru.Back(); el != nil; el = el.Prev() {
+		e := el.Value.(*hostnameEntry)
+		if !e.expires.IsZero() && e.hostname != ipToken(e.ipStr) {
+			saved = append(saved, savedHostname{e.ip, e.hostname, e.expires})
+		}
+	}
+	c.mu.Unlock()
+
+	data, err := json.Marshal(saved)
+	if err != nil {
+		return err
+	}
+	tmp, err := os.CreateTemp(filepath.Dir(path), filepath.Base(path)+".*")
+	if err != nil {
+		return err
+	}
+	defer os.Remove(tmp.Name())
+	if _, err := tmp.Write(data); err != nil {
+		tmp.Close()
+		return err
+	}
+	if err := tmp.Close(); err != nil {
+		return err
+	}
+	return os.Rename(tmp.Name(), path)
+}
+
+// load fills the cache from a file written by save. Expired names are
+// served stale and re-resolved on their next Lookup.
+func (c *hostnameCache) load(path string) (int, error) {
+	data, err := os.ReadFile(path)
+	if err != nil {
+		return 0, err
+	}
+	var saved []savedHostname
+	if err := json.Unmarshal(data, &saved); err != nil {
+		return 0, err
+	}
+
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	for _, s := range saved {
+		if !s.IP.IsValid() || s.Hostname == "" {
+			continue
+		}
+		if el, ok := c.entries[s.IP]; ok {
+			c.lru.Remove(el)
+		}
+		c.entries[s.IP] = c.lru.PushFront(&hostnameEntry{
+			ip:       s.IP,
+			ipStr:    s.IP.String(),
+			hostname: s.Hostname,
+			expires:  s.Expires,
+		})
+		if c.lru.Len() > c.capacity {
+			oldest := c.lru.Back()
+			c.lru.Remove(oldest)
+			delete(c.entries, oldest.Value.(*hostnameEntry).ip)
+		}
+	}
+	return len(c.entries), nil
+}
+
+// Subject token replacers, built once: a Replacer is safe for concurrent use
+var (
+	ipTokenReplacer  = strings.NewReplacer(".", "-", ":", "-")
+	hostnameReplacer = strings.NewReplacer(".", "-", "*", "-", ">", "-", " ", "-")
+)
+
+// ipToken is the subject token for an unresolved IP: 10-0-0-1, or for IPv6
+// 2001-db8--1 (colons are legal in subjects but kept out of tokens for
+// consistency with hostnames).
+func ipToken(ipStr string) string {
+	return ipTokenReplacer.Replace(ipStr)
+}
+
+// sanitizeHostname converts a DNS name into a single NATS subject token
+func sanitizeHostname(hostname string) string {
+	// Remove trailing dot
+	hostname = strings.TrimSuffix(hostname, ".")
+	// Replace dots and special chars with hyphens for NATS subject
+	return hostnameReplacer.Replace(hostname)
+}
@@ -0,0 +1,24 @@
+package main
+
+import "testing"
+
+func TestSubjectTokens(t *testing.T) {
+	tests := []struct {
+		fn       func(string) string
+		in, want string
+	}{
+		{ipToken, "10.0.0.1", "10-0-0-1"},
+		{ipToken, "2001:db8::1", "2001-db8--1"},
+		{sanitizeHostname, "rpc.example.com.", "rpc-example-com"},
+		{sanitizeHostname, "a*b>c d", "a-b-c-d"},
+	}
+	for _, tt := range tests {
+		if got := tt.fn(tt.in); got != tt.want {
+			t.Errorf("token(%q) = %q, want %q", tt.in, got, tt.want)
+		}
+	}
+	// The hostname is already a token: only the replacers' scan remains
+	if n := testing.AllocsPerRun(100, func() { sanitizeHostname("rpc-example-com") }); n != 0 {
+		t.Errorf("sanitizeHostname allocates %.0f times for a clean name, want 0", n)
+	}
+}
@@ -0,0 +1,193 @@
+package main
+
+import (
+	"bytes"
+	"encoding/binary"
+	"fmt"
+	"net/netip"
+	"sync"
+)
+
+// RPCEventHeader is the fixed-size header of every record sent from the BPF
+// program to the Go User-Space Agent.
+// Must match the C struct (event_hdr) defined in rpc_tracer.c exactly; the
+// off* constants below give each field's position in the raw record.
+type RPCEventHeader struct {
+	PID         uint64
+	TimestampNs uint64
+	DataLen     uint32 // Bytes passed to the syscall
+	SockID      uint32 // Compact socket identity, for per-connection state
+	DestIP      uint32 // Destination IPv4 address; a fold of the address for IPv6 destinations
+	DestPort    uint16 // Destination port
+	CapLen      uint16 // Payload bytes following the header (0 = metadata only)
+	Comm        [16]byte
+	MethodID    uint16 // In-kernel classification, methodUnknown if unclassified
+	Kind        uint16 // recordSend or recordRPC, without the recordIPv6 flag
+	Weight      uint32 // Events this record stands for after sampling/rate limiting (1 = unsampled)
+	CgroupID    uint64 // cgroup v2 ID of the sender, see podIndex
+}
+
+// rpcRecordTrailer follows the header of a recordRPC record.
+// Must match struct rpc_record in rpc_tracer.c.
+type rpcRecordTrailer struct {
+	LatencyNs uint64 // First request send to first response receive
+	RespLen   uint32 // Bytes returned by the first tcp_recvmsg
+	_         uint32
+}
+
+// maxPayloadSize is MAX_DATA_SIZE in rpc_tracer.c
+const maxPayloadSize = 512
+
+// Record kinds (event_hdr.kind in rpc_tracer.c)
+const (
+	recordSend uint16 = 0
+	recordRPC  uint16 = 1
+
+	// recordIPv6 flags a record whose IPv6 destination trails it (RECORD_IPV6)
+	recordIPv6 uint16 = 0x8000
+)
+
+// dest6Size is the size of the trailing IPv6 destination
+const dest6Size = 16
+
+// capture_mode values in rpc_tracer.c
+const (
+	captureModeEvents uint32 = 0
+	captureModeFlows  uint32 = 1
+	captureModeHist   uint32 = 2
+)
+
+// Field offsets within struct event_hdr and struct rpc_record. Decoding
+// reads these directly from the raw sample instead of going through
+// binary.Read, which allocates and walks the struct by reflection.
+const (
+	offPID         = 0
+	offTimestampNs = 8
+	offDataLen     = 16
+	offSockID      = 20
+	offDestIP      = 24
+	offDestPort    = 28
+	offCapLen      = 30
+	offComm        = 32
+	offMethodID    = 48
+	offKind        = 50
+	offWeight      = 52
+	offCgroupID    = 56
+
+	// rpcEventHeaderSize is sizeof(struct event_hdr)
+	rpcEventHeaderSize = 64
+
+	offLatencyNs = rpcEventHeaderSize
+	offRespLen   = rpcEventHeaderSize + 8
+
+	// rpcRecordTrailerSize is sizeof(struct rpc_record) - sizeof(struct event_hdr)
+	rpcRecordTrailerSize = 16
+)
+
+// RPCEvent is a decoded record: the header plus the captured payload prefix.
+type RPCEvent struct {
+	RPCEventHeader
+	rpcRecordTrailer            // Zero unless Kind == recordRPC
+	DestAddr         netip.Addr // Destination address, IPv4 or IPv6
+	Data             []byte     // HTTP headers + JSON-RPC payload prefix, nil for metadata-only records
+}
+
+// decodeRPCEvent parses a raw length-prefixed record into event without
+// allocating. event.Data aliases raw, so raw must not be reused while event
+// is in use.
+func decodeRPCEvent(raw []byte, event *RPCEvent) error {
+	if len(raw) < rpcEventHeaderSize {
+		return fmt.Errorf("short record: %d bytes, header is %d", len(raw), rpcEventHeaderSize)
+	}
+
+	le := binary.LittleEndian
+	hdr := &event.RPCEventHeader
+	hdr.PID = le.Uint64(raw[offPID:])
+	hdr.TimestampNs = le.Uint64(raw[offTimestampNs:])
+	hdr.DataLen = le.Uint32(raw[offDataLen:])
+	hdr.SockID = le.Uint32(raw[offSockID:])
+	hdr.DestIP = le.Uint32(raw[offDestIP:])
+	hdr.DestPort = le.Uint16(raw[offDestPort:])
+	hdr.CapLen = le.Uint16(raw[offCapLen:])
+	copy(hdr.Comm[:], raw[offComm:offComm+len(hdr.Comm)])
+	hdr.MethodID = le.Uint16(raw[offMethodID:])
+	kind := le.Uint16(raw[offKind:])
+	hdr.Kind = kind &^ recordIPv6
+	hdr.Weight = le.Uint32(raw[offWeight:])
+	if hdr.Weight == 0 {
+		hdr.Weight = 1
+	}
+	hdr.CgroupID = le.Uint64(raw[offCgroupID:])
+
+	event.rpcRecordTrailer = rpcRecordTrailer{}
+	event.Data = nil
+
+	var end int
+	if hdr.Kind == recordRPC {
+		end = rpcEventHeaderSize + rpcRecordTrailerSize
+		if len(raw) < end {
+			return fmt.Errorf("short RPC record: %d bytes, want %d", len(raw), end)
+		}
+		event.LatencyNs = le.Uint64(raw[offLatencyNs:])
+		event.RespLen = le.Uint32(raw[offRespLen:])
+	} else {
+		// Perf records are padded to 8 bytes, so trust cap_len rather than len(raw)
+		end = rpcEventHeaderSize + int(hdr.CapLen)
+		if end > len(raw) {
+			return fmt.Errorf("truncated record: cap_len %d exceeds %d payload bytes", hdr.CapLen, len(raw)-rpcEventHeaderSize)
+		}
+		if hdr.CapLen > 0 {
+			event.Data = raw[rpcEventHeaderSize:end]
+		}
+	}
+
+	if kind&recordIPv6 == 0 {
+		event.DestAddr = netip.AddrFrom4([4]byte(raw[offDestIP : offDestIP+4]))
+		return nil
+	}
+	if end+dest6Size > len(raw) {
+		return fmt.Errorf("truncated record: missing IPv6 destination")
+	}
+	event.DestAddr = netip.AddrFrom16([16]byte(raw[end : end+dest6Size]))
+	return nil
+}
+
+// maxRecordSize covers every record the BPF program emits (header plus the
+// largest payload or trailer, plus an IPv6 destination); pooled record
+// buffers are allocated at this size.
+const maxRecordSize = rpcEventHeaderSize + maxPayloadSize + dest6Size
+
+// recordPool recycles the buffers records are copied into when they are
+// handed from the reader to a worker.
+var recordPool = sync.Pool{New: func() any {
+	b := make([]byte, 0, maxRecordSize)
+	return &b
+}}
+
+// maxInternedComms bounds the process names cached by commName.
+const maxInternedComms = 1024
+
+// commTable maps raw task comm values to strings so steady-state events do
+// not allocate a process name each.
+var commTable = struct {
+	sync.RWMutex
+	names map[[16]byte]string
+}{names: make(map[[16]byte]string)}
+
+// commName returns the NUL-trimmed process name for a task comm.
+func commName(comm [16]byte) string {
+	commTable.RLock()
+	name, ok := commTable.names[comm]
+	commTable.RUnlock()
+	if ok {
+		return name
+	}
+
+	name = string(bytes.TrimRight(comm[:], "\x00"))
+	commTable.Lock()
+	if len(commTable.names) < maxInternedComms {
+		commTable.names[comm] = name
+	}
+	commTable.Unlock()
+	return name
+}
@@ -0,0 +1,162 @@
+package main
+
+import (
+	"errors"
+	"fmt"
+	"log"
+	"os"
+
+	"github.com/cilium/ebpf"
+	"github.com/cilium/ebpf/features"
+	"github.com/cilium/ebpf/perf"
+	"github.com/cilium/ebpf/ringbuf"
+)
+
+// Event transport modes
+const (
+	TransportAuto    = "auto"
+	TransportRingBuf = "ringbuf"
+	TransportPerf    = "perf"
+)
+
+// Transport configuration - can be overridden by environment variables
+var (
+	EventTransport  = getEnv("EVENT_TRANSPORT", TransportAuto)
+	RingBufSize     = getEnvInt("RINGBUF_SIZE", 8*1024*1024) // Shared across all CPUs
+	PerfBufferPages = getEnvInt("PERF_BUFFER_PAGES", 64)     // Per CPU
+)
+
+// errTransportClosed is returned by an eventReader after Close.
+var errTransportClosed = errors.New("event transport closed")
+
+// eventRecord is a single raw record read from the kernel, independent of transport.
+// RawSample is only valid until the next ReadInto on the same reader.
+type eventRecord struct {
+	RawSample   []byte
+	LostSamples uint64 // Only reported by the perf transport
+	CPU         int    // -1 for the ring buffer, which is shared by all CPUs
+}
+
+// eventReader abstracts the BPF ring buffer and perf event array readers.
+// ReadInto reuses the reader's sample buffer, so steady-state reads do not allocate.
+type eventReader interface {
+	ReadInto(rec *eventRecord) error
+	Close() error
+}
+
+// selectTransport resolves the configured transport mode against the running kernel.
+func selectTransport(mode string) (string, error) {
+	switch mode {
+	case TransportPerf:
+		return TransportPerf, nil
+	case TransportRingBuf:
+		if err := features.HaveMapType(ebpf.RingBuf); err != nil {
+			return "", fmt.Errorf("ring buffer transport requested but unavailable: %w", err)
+		}
+		return TransportRingBuf, nil
+	case TransportAuto:
+		err := features.HaveMapType(ebpf.RingBuf)
+		if err == nil {
+			return TransportRingBuf, nil
+		}
+		if errors.Is(err, ebpf.ErrNotSupported) {
+			log.Println("Kernel lacks BPF_MAP_TYPE_RINGBUF, falling back to perf event array")
+			return TransportPerf, nil
+		}
+		return "", fmt.Errorf("failed to probe for ring buffer support: %w", err)
+	default:
+		return "", fmt.Errorf("unknown EVENT_TRANSPORT %q (want auto, ringbuf or perf)", mode)
+	}
+}
+
+// configureTransport rewrites the events map in spec for the chosen transport
+// and tells the BPF program which output helper to use.
+func configureTransport(spec *ebpf.CollectionSpec, transport string) error {
+	events, ok := spec.Maps["events"]
+	if !ok {
+		return fmt.Errorf("events map not found in eBPF spec")
+	}
+
+	useRingBuf := uint32(0)
+	switch transport {
+	case TransportRingBuf:
+		size := RingBufSize
+		if size < os.Getpagesize() || size&(size-1) != 0 {
+			return fmt.Errorf("RINGBUF_SIZE must be a power of two and at least one page, got %d", size)
+		}
+		events.MaxEntries = uint32(size)
+		useRingBuf = 1
+	case TransportPerf:
+		events.Type = ebpf.PerfEventArray
+		events.KeySize = 4
+		events.ValueSize = 4
+		events.MaxEntries = 0 // One slot per possible CPU
+	}
+
+	return spec.RewriteConstants(map[string]interface{}{
+		"use_ringbuf": useRingBuf,
+	})
+}
+
+// newEventReader opens a reader on the events map for the chosen transport.
+func newEventReader(transport string, events *ebpf.Map) (eventReader, error) {
+	if transport == TransportRingBuf {
+		rd, err := ringbuf.NewReader(events)
+		if err != nil {
+			return nil, fmt.Errorf("failed to create ring buffer reader: %w", err)
+		}
+		return &ringBufReader{rd: rd}, nil
+	}
+
+	rd, err := perf.NewReader(events, os.Getpagesize()*PerfBufferPages)
+	if err != nil {
+		return nil, fmt.Errorf("failed to create perf event reader: %w", err)
+	}
+	return &perfReader{rd: rd}, nil
+}
+
+// ringBufReader reads events from a BPF_MAP_TYPE_RINGBUF.
+type ringBufReader struct {
+	rd  *ringbuf.Reader
+	rec ringbuf.Record
+}
+
+func (r *ringBufReader) ReadInto(rec *eventRecord) error {
+	if err := r.rd.ReadInto(&r.rec); err != nil {
+		if errors.Is(err, ringbuf.ErrClosed) {
+			return errTransportClosed
+		}
+		return err
+	}
+	rec.RawSample = r.rec.RawSample
+	rec.LostSamples = 0
+	rec.CPU = -1
+	return nil
+}
+
+func (r *ringBufReader) Close() error {
+	return r.rd.Close()
+}
+
+// perfReader reads events from a BPF_MAP_TYPE_PERF_EVENT_ARRAY.
+type perfReader struct {
+	rd  *perf.Reader
+	rec perf.Record
+}
+
+func (r *perfReader) ReadInto(rec *eventRecord) error {
+	if err := r.rd.ReadInto(&r.rec); err != nil {
+		if errors.Is(err, perf.ErrClosed) {
+			return errTransportClosed
+		}
+		return err
+	}
+	rec.RawSample = r.rec.RawSample
+	rec.LostSamples = r.rec.LostSamples
+	rec.CPU = r.rec.CPU
+	return nil
+}
+
+func (r *perfReader) Close() error {
+	return r.rd.Close()
+}
@@ -0,0 +1,214 @@
+package main
+
+import (
+	"sync"
+	"sync/atomic"
+)
+
+// featureDetails is the typed "details" object of a MonitoringFeature.
+// Hot-path implementations are pooled: the publisher calls release once the
+// feature has been encoded (or dropped).
+type featureDetails interface {
+	encode(e *fieldEncoder)
+	release()
+}
+
+// eventDetails describes a single send or receive (CAPTURE_MODE=events).
+type eventDetails struct {
+	PID          uint64
+	Process      string
+	Method       string
+	Direction    string
+	SizeBytes    uint32
+	TimestampNs  uint64
+	DestIP       string
+	DestPort     uint16
+	DestHostname string
+	Weight       uint32     // Sample weight, only encoded when above 1
+	BatchCount   uint32     // Requests of Method in a JSON-RPC batch times Weight, only encoded for batches
+	Pod          *podLabels // Only encoded when the sender was attributed to a pod
+}
+
+var eventDetailsPool = sync.Pool{New: func() any { return new(eventDetails) }}
+
+func newEventDetails() *eventDetails {
+	return eventDetailsPool.Get().(*eventDetails)
+}
+
+func (d *eventDetails) encode(e *fieldEncoder) {
+	n := 9
+	if d.Weight > 1 {
+		n++
+	}
+	if d.BatchCount > 0 {
+		n++
+	}
+	if d.Pod != nil {
+		n += 3
+	}
+	e.begin(n)
+	if d.BatchCount > 0 {
+		e.Uint("batch_count", uint64(d.BatchCount))
+	}
+	if d.Pod != nil {
+		e.String("container", d.Pod.Container)
+	}
+	e.String("dest_hostname", d.DestHostname)
+	e.String("dest_ip", d.DestIP)
+	e.Uint("dest_port", uint64(d.DestPort))
+	e.String("direction", d.Direction)
+	e.String("method", d.Method)
+	if d.Pod != nil {
+		e.String("namespace", d.Pod.Namespace)
+	}
+	e.Uint("pid", d.PID)
+	if d.Pod != nil {
+		e.String("pod", d.Pod.Pod)
+	}
+	e.String("process", d.Process)
+	if d.Weight > 1 {
+		e.Uint("sample_weight", uint64(d.Weight))
+	}
+	e.Uint("size_bytes", uint64(d.SizeBytes))
+	e.Uint("timestamp_ns", d.TimestampNs)
+	e.end()
+}
+
+func (d *eventDetails) release() {
+	*d = eventDetails{}
+	eventDetailsPool.Put(d)
+}
+
+// rpcDetails describes a completed request/response pair (CAPTURE_MODE=flows).
+// The same details are shared by the size and latency features of one
+// completion, so they are reference counted.
+type rpcDetails struct {
+	PID           uint64
+	Process       string
+	Method        string
+	RequestBytes  uint32
+	ResponseBytes uint32
+	LatencyMs     float64
+	TimestampNs   uint64
+	DestIP        string
+	DestPort      uint16
+	DestHostname  string
+	Weight        uint32     // Sample weight, only encoded when above 1
+	Pod           *podLabels // Only encoded when the sender was attributed to a pod
+
+	refs atomic.Int32
+}
+
+var rpcDetailsPool = sync.Pool{New: func() any { return new(rpcDetails) }}
+
+// newRPCDetails returns details that must be released refs times.
+func newRPCDetails(refs int32) *rpcDetails {
+	d := rpcDetailsPool.Get().(*rpcDetails)
+	d.refs.Store(refs)
+	return d
+}
+
+func (d *rpcDetails) encode(e *fieldEncoder) {
+	n := 11
+	if d.Weight > 1 {
+		n++
+	}
+	if d.Pod != nil {
+		n += 3
+	}
+	e.begin(n)
+	if d.Pod != nil {
+		e.String("container", d.Pod.Container)
+	}
+	e.String("dest_hostname", d.DestHostname)
+	e.String("dest_ip", d.DestIP)
+	e.Uint("dest_port", uint64(d.DestPort))
+	e.String("direction", "rpc")
+	e.Float("latency_ms", d.LatencyMs)
+	e.String("method", d.Method)
+	if d.Pod != nil {
+		e.String("namespace", d.Pod.Namespace)
+	}
+	e.Uint("pid", d.PID)
+	if d.Pod != nil {
+		e.String("pod", d.Pod.Pod)
+	}
+	e.String("process", d.Process)
+	e.Uint("request_bytes", uint64(d.RequestBytes))
+	e.Uint("response_bytes", uint64(d.ResponseBytes))
+	if d.Weight > 1 {
+		e.Uint("sample_weight", uint64(d.Weight))
+	}
+	e.Uint("timestamp_ns", d.TimestampNs)
+	e.end()
+}
+
+func (d *rpcDetails) release() {
+	if d.refs.Add(-1) != 0 {
+		return
+	}
+	d.PID, d.Process, d.Method = 0, "", ""
+	d.RequestBytes, d.ResponseBytes, d.LatencyMs, d.TimestampNs = 0, 0, 0, 0
+	d.DestIP, d.DestPort, d.DestHostname, d.Weight = "", 0, "", 0
+	d.Pod = nil
+	rpcDetailsPool.Put(d)
+}
+
+// histDetails summarises one in-kernel histogram (CAPTURE_MODE=histogram).
+// Published once per key per interval, so it is not pooled.
+type histDetails struct {
+	Method       string
+	Direction    string
+	Count        uint64
+	IntervalS    float64
+	SumBytes     uint64
+	MeanBytes    float64
+	P50Bytes     float64
+	P99Bytes     float64
+	SizeBuckets  map[string]uint64
+	DestIP       string
+	DestPort     uint16
+	DestHostname string
+
+	// Receive side only
+	HasLatency       bool
+	MeanLatencyMs    float64
+	P50LatencyMs     float64
+	P99LatencyMs     float64
+	LatencyBucketsUs map[string]uint64
+}
+
+func (d *histDetails) encode(e *fieldEncoder) {
+	n := 12
+	if d.HasLatency {
+		n += 4
+	}
+	e.begin(n)
+	e.Uint("count", d.Count)
+	e.String("dest_hostname", d.DestHostname)
+	e.String("dest_ip", d.DestIP)
+	e.Uint("dest_port", uint64(d.DestPort))
+	e.String("direction", d.Direction)
+	e.Float("interval_s", d.IntervalS)
+	if d.HasLatency {
+		e.Buckets("latency_buckets_us", d.LatencyBucketsUs)
+	}
+	e.Float("mean_bytes", d.MeanBytes)
+	if d.HasLatency {
+		e.Float("mean_latency_ms", d.MeanLatencyMs)
+	}
+	e.String("method", d.Method)
+	e.Float("p50_bytes", d.P50Bytes)
+	if d.HasLatency {
+		e.Float("p50_latency_ms", d.P50LatencyMs)
+	}
+	e.Float("p99_bytes", d.P99Bytes)
+	if d.HasLatency {
+		e.Float("p99_latency_ms", d.P99LatencyMs)
+	}
+	e.Buckets("size_buckets", d.SizeBuckets)
+	e.Uint("sum_bytes", d.SumBytes)
+	e.end()
+}
+
+func (d *histDetails) release() {}
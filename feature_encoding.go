@@ -0,0 +1,208 @@
+package main
+
+import (
+	"math"
+	"sort"
+	"strconv"
+	"time"
+	"unicode/utf8"
+)
+
+// fieldEncoder writes MonitoringFeature objects as JSON or MessagePack
+// straight into a reused byte slice. The JSON output matches what
+// encoding/json produces for the same fields (including HTML escaping),
+// without reflection or intermediate allocations.
+type fieldEncoder struct {
+	b       []byte
+	msgpack bool
+	first   bool // No field written yet in the current JSON object
+}
+
+// begin opens an object with n fields (n is only used by msgpack).
+func (e *fieldEncoder) begin(n int) {
+	if e.msgpack {
+		e.b = appendMsgpackMapHeader(e.b, n)
+		return
+	}
+	e.b = append(e.b, '{')
+	e.first = true
+}
+
+func (e *fieldEncoder) end() {
+	if !e.msgpack {
+		e.b = append(e.b, '}')
+		e.first = false
+	}
+}
+
+func (e *fieldEncoder) key(k string) {
+	if e.msgpack {
+		e.b = appendMsgpackString(e.b, k)
+		return
+	}
+	if !e.first {
+		e.b = append(e.b, ',')
+	}
+	e.first = false
+	e.b = appendJSONString(e.b, k)
+	e.b = append(e.b, ':')
+}
+
+func (e *fieldEncoder) String(k, v string) {
+	e.key(k)
+	if e.msgpack {
+		e.b = appendMsgpackString(e.b, v)
+	} else {
+		e.b = appendJSONString(e.b, v)
+	}
+}
+
+func (e *fieldEncoder) Uint(k string, v uint64) {
+	e.key(k)
+	if e.msgpack {
+		e.b = appendMsgpackUint(e.b, v)
+	} else {
+		e.b = strconv.AppendUint(e.b, v, 10)
+	}
+}
+
+func (e *fieldEncoder) Float(k string, v float64) {
+	e.key(k)
+	if e.msgpack {
+		e.b = appendMsgpackFloat64(e.b, v)
+	} else {
+		e.b = appendJSONFloat(e.b, v)
+	}
+}
+
+func (e *fieldEncoder) Time(k string, t time.Time) {
+	e.key(k)
+	if e.msgpack {
+		e.b = appendMsgpackTime(e.b, t)
+		return
+	}
+	e.b = append(e.b, '"')
+	e.b = t.AppendFormat(e.b, time.RFC3339Nano)
+	e.b = append(e.b, '"')
+}
+
+// Buckets writes a histogram bucket map with sorted keys, as encoding/json does.
+func (e *fieldEncoder) Buckets(k string, m map[string]uint64) {
+	e.key(k)
+	keys := make([]string, 0, len(m))
+	for bound := range m {
+		keys = append(keys, bound)
+	}
+	sort.Strings(keys)
+
+	e.begin(len(keys))
+	for _, bound := range keys {
+		e.Uint(bound, m[bound])
+	}
+	e.end()
+}
+
+func (e *fieldEncoder) null() {
+	if e.msgpack {
+		e.b = append(e.b, 0xc0)
+	} else {
+		e.b = append(e.b, "null"...)
+	}
+}
+
+// Feature encodes f using the encoder's format.
+func (e *fieldEncoder) Feature(f *MonitoringFeature) {
+	e.begin(7)
+	e.String("app_id", f.AppID)
+	e.String("protocol", f.Protocol)
+	e.String("feature_type", f.FeatureType)
+	e.Time("timestamp", f.Timestamp)
+	e.Float("value", f.Value)
+	e.String("context_hash", f.ContextHash)
+	e.key("details")
+	if f.Details != nil {
+		f.Details.encode(e)
+	} else {
+		e.null()
+	}
+	e.end()
+}
+
+// MarshalJSON keeps json.Marshal consistent with the publisher's encoder.
+func (f MonitoringFeature) MarshalJSON() ([]byte, error) {
+	var e fieldEncoder
+	e.Feature(&f)
+	return e.b, nil
+}
+
+// appendJSONFloat formats like encoding/json. NaN and Inf, which JSON
+// cannot represent, are written as null.
+func appendJSONFloat(b []byte, f float64) []byte {
+	if math.IsNaN(f) || math.IsInf(f, 0) {
+		return append(b, "null"...)
+	}
+	format := byte('f')
+	if abs := math.Abs(f); abs != 0 && (abs < 1e-6 || abs >= 1e21) {
+		format = 'e'
+	}
+	b = strconv.AppendFloat(b, f, format, -1, 64)
+	if format == 'e' {
+		// Clean up e-09 to e-9
+		n := len(b)
+		if n >= 4 && b[n-4] == 'e' && b[n-3] == '-' && b[n-2] == '0' {
+			b[n-2] = b[n-1]
+			b = b[:n-1]
+		}
+	}
+	return b
+}
+
+const hexDigits = "0123456789abcdef"
+
+// appendJSONString quotes s the way encoding/json does by default.
+func appendJSONString(b []byte, s string) []byte {
+	b = append(b, '"')
+	start := 0
+	for i := 0; i < len(s); {
+		if c := s[i]; c < utf8.RuneSelf {
+			if c >= 0x20 && c != '"' && c != '\\' && c != '<' && c != '>' && c != '&' {
+				i++
+				continue
+			}
+			b = append(b, s[start:i]...)
+			switch c {
+			case '"', '\\':
+				b = append(b, '\\', c)
+			case '\n':
+				b = append(b, '\\', 'n')
+			case '\r':
+				b = append(b, '\\', 'r')
+			case '\t':
+				b = append(b, '\\', 't')
+			default:
+				b = append(b, '\\', 'u', '0', '0', hexDigits[c>>4], hexDigits[c&0xf])
+			}
+			i++
+			start = i
+			continue
+		}
+		r, size := utf8.DecodeRuneInString(s[i:])
+		if r == utf8.RuneError && size == 1 {
+			b = append(b, s[start:i]...)
+			b = append(b, `\ufffd`...)
+			i += size
+			start = i
+			continue
+		}
+		if r == '\u2028' || r == '\u2029' {
+			b = append(b, s[start:i]...)
+			b = append(b, '\\', 'u', '2', '0', '2', hexDigits[r&0xf])
+			i += size
+			start = i
+			continue
+		}
+		i += size
+	}
+	b = append(b, s[start:]...)
+	return append(b, '"')
+}
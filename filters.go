@@ -0,0 +1,364 @@
+package main
+
+import (
+	"bufio"
+	"context"
+	"errors"
+	"fmt"
+	"log"
+	"net"
+	"os"
+	"os/signal"
+	"path/filepath"
+	"strconv"
+	"strings"
+	"syscall"
+	"time"
+
+	"github.com/cilium/ebpf"
+)
+
+// Live filter configuration - can be overridden by environment variables.
+// FILTER_FILE overrides the FILTER_* variables and is re-read every
+// FILTER_RELOAD_INTERVAL and on SIGHUP. It holds KEY=value lines, or is a
+// directory with one file per key, as a mounted ConfigMap is.
+var (
+	FilterFile           = getEnv("FILTER_FILE", "")
+	FilterReloadInterval = getEnvDuration("FILTER_RELOAD_INTERVAL", 30*time.Second)
+)
+
+// filter_flags bits in rpc_tracer.c
+const (
+	filterTGID   uint32 = 1 << 0
+	filterCgroup uint32 = 1 << 1
+	filterComm   uint32 = 1 << 2
+	filterPort   uint32 = 1 << 3
+	filterCIDR   uint32 = 1 << 4
+)
+
+// taskCommLen is TASK_COMM_LEN in rpc_tracer.c
+const taskCommLen = 16
+
+// FilterConfig is the in-kernel filter set. An empty list disables that
+// filter; a non-empty list passes only matching sends.
+type FilterConfig struct {
+	TGIDs   []uint32
+	Cgroups []uint64
+	Comms   []string
+	Ports   []uint16
+	CIDRs   []*net.IPNet
+}
+
+// cidrKey mirrors struct cidr_key in rpc_tracer.c
+type cidrKey struct {
+	PrefixLen uint32
+	Addr      [4]byte // Network byte order
+}
+
+// cidr6Key mirrors struct cidr6_key in rpc_tracer.c
+type cidr6Key struct {
+	PrefixLen uint32
+	Addr      [16]byte // Network byte order
+}
+
+// getEnvList splits a comma-separated environment variable. Unlike getEnv,
+// an explicitly empty value is honoured so a default filter can be disabled.
+func getEnvList(key, defaultVal string) []string {
+	return lookupList(os.LookupEnv, key, defaultVal)
+}
+
+func lookupList(lookup func(string) (string, bool), key, defaultVal string) []string {
+	value, ok := lookup(key)
+	if !ok {
+		value = defaultVal
+	}
+	var items []string
+	for _, item := range strings.Split(value, ",") {
+		if item = strings.TrimSpace(item); item != "" {
+			items = append(items, item)
+		}
+	}
+	return items
+}
+
+// readFilterFile reads the overrides in path, a KEY=value file or a
+// directory of files named after their key.
+func readFilterFile(path string) (map[string]string, error) {
+	values := make(map[string]string)
+	st, err := os.Stat(path)
+	if err != nil {
+		return nil, err
+	}
+	if st.IsDir() {
+		entries, err := os.ReadDir(path)
+		if err != nil {
+			return nil, err
+		}
+		for _, e := range entries {
+			if strings.HasPrefix(e.Name(), ".") || e.IsDir() {
+				continue // ConfigMap volumes keep their data in ..data
+			}
+			data, err := os.ReadFile(filepath.Join(path, e.Name()))
+			if err != nil {
+				return nil, err
+			}
+			values[e.Name()] = strings.TrimSpace(string(data))
+		}
+		return values, nil
+	}
+
+	f, err := os.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+	scanner := bufio.NewScanner(f)
+	for scanner.Scan() {
+		line := strings.TrimSpace(scanner.Text())
+		if line == "" || strings.HasPrefix(line, "#") {
+			continue
+		}
+		key, value, ok := strings.Cut(line, "=")
+		if !ok {
+			return nil, fmt.Errorf("invalid line %q in %s, want KEY=value", line, path)
+		}
+		values[strings.TrimSpace(key)] = strings.TrimSpace(value)
+	}
+	return values, scanner.Err()
+}
+
+// loadFilterConfig builds the filter set from the environment and
+// FILTER_FILE. TARGET_PID is folded into the TGID filter.
+func loadFilterConfig() (*FilterConfig, error) {
+	lookup := os.LookupEnv
+	if FilterFile != "" {
+		overrides, err := readFilterFile(FilterFile)
+		if err != nil {
+			return nil, fmt.Errorf("failed to read FILTER_FILE: %w", err)
+		}
+		lookup = func(key string) (string, bool) {
+			if value, ok := overrides[key]; ok {
+				return value, true
+			}
+			return os.LookupEnv(key)
+		}
+	}
+	return parseFilterConfig(lookup)
+}
+
+func parseFilterConfig(lookup func(string) (string, bool)) (*FilterConfig, error) {
+	cfg := &FilterConfig{}
+
+	if TargetPID > 0 {
+		cfg.TGIDs = append(cfg.TGIDs, uint32(TargetPID))
+	}
+	for _, item := range lookupList(lookup, "FILTER_PIDS", "") {
+		pid, err := strconv.ParseUint(item, 10, 32)
+		if err != nil {
+			return nil, fmt.Errorf("invalid FILTER_PIDS entry %q: %w", item, err)
+		}
+		cfg.TGIDs = append(cfg.TGIDs, uint32(pid))
+	}
+
+	for _, item := range lookupList(lookup, "FILTER_CGROUPS", "") {
+		id, err := parseCgroupID(item)
+		if err != nil {
+			return nil, fmt.Errorf("invalid FILTER_CGROUPS entry %q: %w", item, err)
+		}
+		cfg.Cgroups = append(cfg.Cgroups, id)
+	}
+
+	for _, item := range lookupList(lookup, "FILTER_COMMS", "node") {
+		if len(item) >= taskCommLen {
+			return nil, fmt.Errorf("FILTER_COMMS entry %q is longer than %d characters", item, taskCommLen-1)
+		}
+		cfg.Comms = append(cfg.Comms, item)
+	}
+
+	for _, item := range lookupList(lookup, "FILTER_PORTS", "443,8545,8547") {
+		port, err := strconv.ParseUint(item, 10, 16)
+		if err != nil {
+			return nil, fmt.Errorf("invalid FILTER_PORTS entry %q: %w", item, err)
+		}
+		cfg.Ports = append(cfg.Ports, uint16(port))
+	}
+
+	// IPv4 and IPv6 prefixes; a bare address is a single host
+	for _, item := range lookupList(lookup, "FILTER_CIDRS", "") {
+		if !strings.Contains(item, "/") {
+			if strings.Contains(item, ":") {
+				item += "/128"
+			} else {
+				item += "/32"
+			}
+		}
+		_, ipNet, err := net.ParseCIDR(item)
+		if err != nil {
+			return nil, fmt.Errorf("invalid FILTER_CIDRS entry: %w", err)
+		}
+		cfg.CIDRs = append(cfg.CIDRs, ipNet)
+	}
+
+	return cfg, nil
+}
+
+// parseCgroupID accepts a numeric cgroup v2 ID or a cgroupfs directory path,
+// whose inode number is the cgroup ID.
+func parseCgroupID(item string) (uint64, error) {
+	if id, err := strconv.ParseUint(item, 10, 64); err == nil {
+		return id, nil
+	}
+	var st syscall.Stat_t
+	if err := syscall.Stat(item, &st); err != nil {
+		return 0, err
+	}
+	return st.Ino, nil
+}
+
+// Flags returns the filter_flags value for this configuration.
+func (c *FilterConfig) Flags() uint32 {
+	var flags uint32
+	if len(c.TGIDs) > 0 {
+		flags |= filterTGID
+	}
+	if len(c.Cgroups) > 0 {
+		flags |= filterCgroup
+	}
+	if len(c.Comms) > 0 {
+		flags |= filterComm
+	}
+	if len(c.Ports) > 0 {
+		flags |= filterPort
+	}
+	if len(c.CIDRs) > 0 {
+		flags |= filterCIDR
+	}
+	return flags
+}
+
+// String summarises the filter set for logging.
+func (c *FilterConfig) String() string {
+	return fmt.Sprintf("tgids=%v cgroups=%v comms=%v ports=%v cidrs=%v",
+		c.TGIDs, c.Cgroups, c.Comms, c.Ports, c.CIDRs)
+}
+
+// syncFilters makes the filter maps and flags match cfg, on a loaded or a
+// running tracer. New keys go in before a filter is enabled and a filter is
+// disabled before its keys go, so during the change traffic passing either
+// the old or the new set is kept.
+func syncFilters(objs *rpcMaps, cfg *FilterConfig) error {
+	comms := make([][taskCommLen]byte, len(cfg.Comms))
+	for i, comm := range cfg.Comms {
+		copy(comms[i][:], comm)
+	}
+	var cidrs []cidrKey
+	var cidrs6 []cidr6Key
+	for _, ipNet := range cfg.CIDRs {
+		ones, bits := ipNet.Mask.Size()
+		if ip4 := ipNet.IP.To4(); ip4 != nil {
+			// ::ffff:a.b.c.d/n matches the same peers as a.b.c.d/(n-96)
+			key := cidrKey{PrefixLen: uint32(ones - (bits - 32))}
+			copy(key.Addr[:], ip4)
+			cidrs = append(cidrs, key)
+		} else {
+			key := cidr6Key{PrefixLen: uint32(ones)}
+			copy(key.Addr[:], ipNet.IP.To16())
+			cidrs6 = append(cidrs6, key)
+		}
+	}
+
+	if err := errors.Join(
+		putKeys("TGID", objs.FilterTgids, cfg.TGIDs),
+		putKeys("cgroup", objs.FilterCgroups, cfg.Cgroups),
+		putKeys("comm", objs.FilterComms, comms),
+		putKeys("port", objs.FilterPorts, cfg.Ports),
+		putKeys("CIDR", objs.FilterCidrs, cidrs),
+		putKeys("CIDR", objs.FilterCidrs6, cidrs6),
+	); err != nil {
+		return err
+	}
+	if err := updateConfig(objs.TracerConfig, func(c *tracerConfig) { c.FilterFlags = cfg.Flags() }); err != nil {
+		return err
+	}
+	return errors.Join(
+		pruneKeys("TGID", objs.FilterTgids, cfg.TGIDs),
+		pruneKeys("cgroup", objs.FilterCgroups, cfg.Cgroups),
+		pruneKeys("comm", objs.FilterComms, comms),
+		pruneKeys("port", objs.FilterPorts, cfg.Ports),
+		pruneKeys("CIDR", objs.FilterCidrs, cidrs),
+		pruneKeys("CIDR", objs.FilterCidrs6, cidrs6),
+	)
+}
+
+// putKeys adds keys to the filter map m.
+func putKeys[K comparable](name string, m *ebpf.Map, keys []K) error {
+	const present = uint8(1)
+
+	for _, key := range keys {
+		if err := m.Put(key, present); err != nil {
+			return fmt.Errorf("failed to add %s filter %v: %w", name, key, err)
+		}
+	}
+	return nil
+}
+
+// pruneKeys removes every key of the filter map m that is not in keys.
+func pruneKeys[K comparable](name string, m *ebpf.Map, keys []K) error {
+	want := make(map[K]bool, len(keys))
+	for _, key := range keys {
+		want[key] = true
+	}
+	var (
+		key   K
+		value uint8
+		stale []K
+	)
+	iter := m.Iterate()
+	for iter.Next(&key, &value) {
+		if !want[key] {
+			stale = append(stale, key)
+		}
+	}
+	if err := iter.Err(); err != nil {
+		return fmt.Errorf("failed to list %s filters: %w", name, err)
+	}
+	for _, key := range stale {
+		if err := m.Delete(key); err != nil && !errors.Is(err, ebpf.ErrKeyNotExist) {
+			return fmt.Errorf("failed to remove %s filter %v: %w", name, key, err)
+		}
+	}
+	return nil
+}
+
+// watchFilters re-reads the filter configuration every interval and on
+// SIGHUP, applying changes to the running tracer, until ctx is done.
+func (a *Agent) watchFilters(ctx context.Context, current *FilterConfig, interval time.Duration) {
+	hup := make(chan os.Signal, 1)
+	signal.Notify(hup, syscall.SIGHUP)
+	defer signal.Stop(hup)
+	ticker := time.NewTicker(interval)
+	defer ticker.Stop()
+
+	for {
+		select {
+		case <-ctx.Done():
+			return
+		case <-ticker.C:
+		case <-hup:
+		}
+		cfg, err := loadFilterConfig()
+		if err != nil {
+			log.Printf("Keeping in-kernel filters: %v", err)
+			continue
+		}
+		if cfg.String() == current.String() {
+			continue
+		}
+		if err := syncFilters(&a.EBPFObjs.rpcMaps, cfg); err != nil {
+			log.Printf("Failed to update in-kernel filters: %v", err)
+			continue
+		}
+		current = cfg
+		log.Printf("In-kernel filters updated: %s", cfg)
+	}
+}
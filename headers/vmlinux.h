@@ -0,0 +1,209 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Minimal vmlinux.h for the tracers: only the kernel types they touch.
+ *
+ * Kernel structs are declared with preserve_access_index, so every field
+ * access compiles to a CO-RE relocation that the loader resolves against the
+ * running kernel's BTF. Field order and sizes here therefore do not need to
+ * match any particular kernel; only field names and types do. A full header
+ * can be generated instead with
+ *
+ *     bpftool btf dump file /sys/kernel/btf/vmlinux format c > vmlinux.h
+ */
+#ifndef __VMLINUX_H__
+#define __VMLINUX_H__
+
+typedef unsigned char __u8;
+typedef short int __s16;
+typedef short unsigned int __u16;
+typedef int __s32;
+typedef unsigned int __u32;
+typedef long long int __s64;
+typedef long long unsigned int __u64;
+
+typedef __u8 u8;
+typedef __s16 s16;
+typedef __u16 u16;
+typedef __s32 s32;
+typedef __u32 u32;
+typedef __s64 s64;
+typedef __u64 u64;
+
+typedef __u16 __le16;
+typedef __u16 __be16;
+typedef __u32 __be32;
+typedef __u64 __be64;
+typedef __u32 __wsum;
+
+typedef long unsigned int size_t;
+typedef long int ssize_t;
+
+typedef _Bool bool;
+enum {
+    false = 0,
+    true = 1,
+};
+
+/* UAPI values used by map definitions and helpers */
+
+enum bpf_map_type {
+    BPF_MAP_TYPE_UNSPEC = 0,
+    BPF_MAP_TYPE_HASH = 1,
+    BPF_MAP_TYPE_ARRAY = 2,
+    BPF_MAP_TYPE_PROG_ARRAY = 3,
+    BPF_MAP_TYPE_PERF_EVENT_ARRAY = 4,
+    BPF_MAP_TYPE_PERCPU_HASH = 5,
+    BPF_MAP_TYPE_PERCPU_ARRAY = 6,
+    BPF_MAP_TYPE_STACK_TRACE = 7,
+    BPF_MAP_TYPE_CGROUP_ARRAY = 8,
+    BPF_MAP_TYPE_LRU_HASH = 9,
+    BPF_MAP_TYPE_LRU_PERCPU_HASH = 10,
+    BPF_MAP_TYPE_LPM_TRIE = 11,
+    BPF_MAP_TYPE_ARRAY_OF_MAPS = 12,
+    BPF_MAP_TYPE_HASH_OF_MAPS = 13,
+    BPF_MAP_TYPE_RINGBUF = 27,
+};
+
+enum {
+    BPF_ANY = 0,
+    BPF_NOEXIST = 1,
+    BPF_EXIST = 2,
+    BPF_F_LOCK = 4,
+};
+
+enum {
+    BPF_F_NO_PREALLOC = 1,
+};
+
+enum {
+    BPF_F_INDEX_MASK = 0xffffffffULL,
+    BPF_F_CURRENT_CPU = 0xffffffffULL,
+};
+
+/* Registers as seen by kprobes and uprobes (bpf_tracing.h PT_REGS_*) */
+
+#if defined(__TARGET_ARCH_x86)
+struct pt_regs {
+    long unsigned int r15;
+    long unsigned int r14;
+    long unsigned int r13;
+    long unsigned int r12;
+    long unsigned int bp;
+    long unsigned int bx;
+    long unsigned int r11;
+    long unsigned int r10;
+    long unsigned int r9;
+    long unsigned int r8;
+    long unsigned int ax;
+    long unsigned int cx;
+    long unsigned int dx;
+    long unsigned int si;
+    long unsigned int di;
+    long unsigned int orig_ax;
+    long unsigned int ip;
+    long unsigned int cs;
+    long unsigned int flags;
+    long unsigned int sp;
+    long unsigned int ss;
+};
+#elif defined(__TARGET_ARCH_arm64)
+struct user_pt_regs {
+    __u64 regs[31];
+    __u64 sp;
+    __u64 pc;
+    __u64 pstate;
+};
+
+struct pt_regs {
+    union {
+        struct user_pt_regs user_regs;
+        struct {
+            u64 regs[31];
+            u64 sp;
+            u64 pc;
+            u64 pstate;
+        };
+    };
+    u64 orig_x0;
+};
+#else
+#error "vmlinux.h: define __TARGET_ARCH_x86 or __TARGET_ARCH_arm64"
+#endif
+
+#pragma clang attribute push(__attribute__((preserve_access_index)), apply_to = record)
+
+struct in6_addr {
+    union {
+        __u8 u6_addr8[16];
+        __be16 u6_addr16[8];
+        __be32 u6_addr32[4];
+    } in6_u;
+};
+
+struct sock_common {
+    __be32 skc_daddr;
+    __be32 skc_rcv_saddr;
+    __be16 skc_dport;
+    __u16 skc_num;
+    unsigned short skc_family;
+    struct in6_addr skc_v6_daddr;
+    struct in6_addr skc_v6_rcv_saddr;
+};
+
+struct sock {
+    struct sock_common __sk_common;
+};
+
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+
+struct kvec {
+    void *iov_base;
+    size_t iov_len;
+};
+
+/* Values are relocated against the running kernel (bpf_core_enum_value);
+ * ITER_UBUF only exists from 6.0, and before 5.14 these were bit flags. */
+enum iter_type {
+    ITER_UBUF,
+    ITER_IOVEC,
+    ITER_BVEC,
+    ITER_KVEC,
+    ITER_XARRAY,
+    ITER_DISCARD,
+};
+
+/* 6.4+ layout. Older layouts are matched through the flavors below. */
+struct iov_iter {
+    u8 iter_type;
+    size_t iov_offset;
+    size_t count;
+    union {
+        const struct iovec *__iov;
+        const struct kvec *kvec;
+        void *ubuf;
+    };
+    long unsigned int nr_segs;
+};
+
+/* Before 6.4 the iovec array was named iov */
+struct iov_iter___pre_6_4 {
+    const struct iovec *iov;
+};
+
+/* Before 5.14 the iterator kind was a bit set in type, along with the direction */
+struct iov_iter___pre_5_14 {
+    unsigned int type;
+};
+
+struct msghdr {
+    void *msg_name;
+    int msg_namelen;
+    struct iov_iter msg_iter;
+};
+
+#pragma clang attribute pop
+
+#endif /* __VMLINUX_H__ */
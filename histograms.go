@@ -0,0 +1,209 @@
+package main
+
+import (
+	"fmt"
+	"log"
+	"net/netip"
+	"time"
+
+	"github.com/cilium/ebpf"
+)
+
+// histSlots is HIST_SLOTS in rpc_tracer.c
+const histSlots = 32
+
+// Histogram directions (DIR_* in rpc_tracer.c)
+const (
+	histDirSend   uint8 = 0
+	histDirRecv   uint8 = 1
+	histDirServer uint8 = 2
+)
+
+// histKey mirrors struct hist_key in rpc_tracer.c
+type histKey struct {
+	DestIP    uint32 // Fold of DestIP6 when V6 is set
+	DestPort  uint16
+	V6        uint16
+	DestIP6   [16]byte
+	MethodID  uint16
+	Direction uint8
+	_         uint8
+}
+
+// addr returns the destination address of the key.
+func (k *histKey) addr() netip.Addr {
+	if k.V6 != 0 {
+		return netip.AddrFrom16(k.DestIP6)
+	}
+	return netip.AddrFrom4([4]byte{byte(k.DestIP), byte(k.DestIP >> 8), byte(k.DestIP >> 16), byte(k.DestIP >> 24)})
+}
+
+// histValue mirrors struct hist_t in rpc_tracer.c
+type histValue struct {
+	Count        uint64
+	SumBytes     uint64
+	SumLatencyNs uint64
+	SizeSlots    [histSlots]uint64 // log2(bytes)
+	LatencySlots [histSlots]uint64 // log2(microseconds)
+}
+
+// add accumulates another CPU's value into h.
+func (h *histValue) add(o *histValue) {
+	h.Count += o.Count
+	h.SumBytes += o.SumBytes
+	h.SumLatencyNs += o.SumLatencyNs
+	for i := range h.SizeSlots {
+		h.SizeSlots[i] += o.SizeSlots[i]
+		h.LatencySlots[i] += o.LatencySlots[i]
+	}
+}
+
+// log2Quantile estimates quantile q from log2 slots, reporting the upper
+// bound of the bucket the quantile falls in.
+func log2Quantile(slots *[histSlots]uint64, total uint64, q float64) float64 {
+	if total == 0 {
+		return 0
+	}
+	rank := uint64(q * float64(total))
+	var seen uint64
+	for i, n := range slots {
+		seen += n
+		if seen > rank {
+			return float64(uint64(1) << uint(i+1))
+		}
+	}
+	return float64(uint64(1) << histSlots)
+}
+
+// nonZeroSlots returns the populated buckets keyed by their lower bound.
+func nonZeroSlots(slots *[histSlots]uint64) map[string]uint64 {
+	buckets := make(map[string]uint64)
+	for i, n := range slots {
+		if n == 0 {
+			continue
+		}
+		lower := uint64(0)
+		if i > 0 {
+			lower = uint64(1) << uint(i)
+		}
+		buckets[fmt.Sprintf("%d", lower)] = n
+	}
+	return buckets
+}
+
+// runHistogramSweeper publishes and resets the in-kernel histograms every interval.
+func (a *Agent) runHistogramSweeper(hists *ebpf.Map, interval time.Duration) {
+	ticker := time.NewTicker(interval)
+	defer ticker.Stop()
+
+	for {
+		select {
+		case <-a.Ctx.Done():
+			return
+		case <-ticker.C:
+			if err := a.sweepHistograms(hists, interval); err != nil {
+				log.Printf("Failed to sweep histograms: %v", err)
+			}
+		}
+	}
+}
+
+// sweepHistograms sums each key across CPUs, publishes one summary feature
+// per key and deletes it. Observations landing between the read and the
+// delete of a key are lost; the window is a single syscall.
+func (a *Agent) sweepHistograms(hists *ebpf.Map, interval time.Duration) error {
+	var (
+		key    histKey
+		perCPU []histValue
+		keys   []histKey
+		totals []histValue
+	)
+
+	iter := hists.Iterate()
+	for iter.Next(&key, &perCPU) {
+		var total histValue
+		for i := range perCPU {
+			total.add(&perCPU[i])
+		}
+		keys = append(keys, key)
+		totals = append(totals, total)
+	}
+	if err := iter.Err(); err != nil {
+		return fmt.Errorf("failed to iterate histograms: %w", err)
+	}
+
+	for i := range keys {
+		if err := hists.Delete(keys[i]); err != nil && err != ebpf.ErrKeyNotExist {
+			return fmt.Errorf("failed to reset histogram: %w", err)
+		}
+		if totals[i].Count == 0 {
+			continue
+		}
+		a.publishHistogram(keys[i], &totals[i], interval)
+	}
+	return nil
+}
+
+// publishHistogram publishes one summary MonitoringFeature for a histogram key.
+func (a *Agent) publishHistogram(key histKey, h *histValue, interval time.Duration) {
+	var destIPStr, destHostname string
+	var addr netip.Addr
+	if key.Direction == histDirServer {
+		destHostname = serverHostname
+	} else {
+		addr = key.addr()
+		destIPStr, destHostname = a.DNS.Lookup(addr)
+	}
+
+	ethMethod := methodName(key.MethodID)
+	if ethMethod == "" {
+		ethMethod = "unknown"
+	}
+
+	metric := metricRequestSummary
+	direction := "send"
+	switch key.Direction {
+	case histDirRecv:
+		metric = metricResponseSummary
+		direction = "recv"
+	case histDirServer:
+		metric = metricServerSummary
+		direction = "server"
+	}
+	subject := a.Subjects.Subject(addr, key.DestPort, key.MethodID, metric, destHostname)
+
+	details := &histDetails{
+		Method:       ethMethod,
+		Direction:    direction,
+		Count:        h.Count,
+		IntervalS:    interval.Seconds(),
+		SumBytes:     h.SumBytes,
+		MeanBytes:    float64(h.SumBytes) / float64(h.Count),
+		P50Bytes:     log2Quantile(&h.SizeSlots, h.Count, 0.50),
+		P99Bytes:     log2Quantile(&h.SizeSlots, h.Count, 0.99),
+		SizeBuckets:  nonZeroSlots(&h.SizeSlots),
+		DestIP:       destIPStr,
+		DestPort:     key.DestPort,
+		DestHostname: destHostname,
+	}
+	if key.Direction != histDirSend {
+		details.HasLatency = true
+		details.MeanLatencyMs = float64(h.SumLatencyNs) / float64(h.Count) / float64(time.Millisecond)
+		details.P50LatencyMs = log2Quantile(&h.LatencySlots, h.Count, 0.50) / 1000
+		details.P99LatencyMs = log2Quantile(&h.LatencySlots, h.Count, 0.99) / 1000
+		details.LatencyBucketsUs = nonZeroSlots(&h.LatencySlots)
+	}
+
+	feature := MonitoringFeature{
+		AppID:       AppID,
+		Protocol:    "jsonrpc",
+		FeatureType: metric.String(),
+		Timestamp:   time.Now(),
+		Value:       float64(h.Count),
+		ContextHash: subject,
+		Details:     details,
+	}
+	if err := a.PublishFeature(feature); err != nil {
+		log.Printf("Failed to publish histogram feature: %v", err)
+	}
+}
@@ -0,0 +1,110 @@
+package main
+
+import (
+	"context"
+	"fmt"
+	"log"
+	"strconv"
+	"strings"
+	"time"
+
+	"github.com/cilium/ebpf"
+)
+
+// Indexes of drop_counters that are not drops (enum counter in rpc_tracer.c)
+const (
+	counterCalls   = 0
+	counterEmitted = 1
+)
+
+// kernelCounters names the drop_counters entries, in the order of enum
+// counter in rpc_tracer.c. The names after the first two are drop reasons.
+var kernelCounters = [...]string{
+	"calls",
+	"emitted",
+	"tgid",
+	"cgroup",
+	"comm",
+	"size",
+	"family",
+	"tls",
+	"port",
+	"cidr",
+	"sampled",
+	"no_scratch",
+	"output",
+}
+
+// counterOutput is DROP_OUTPUT: records the transport had no room for
+const counterOutput = len(kernelCounters) - 1
+
+// readKernelCounters returns drop_counters as [counter][cpu].
+func readKernelCounters(m *ebpf.Map) ([][]uint64, error) {
+	out := make([][]uint64, len(kernelCounters))
+	for i, name := range kernelCounters {
+		if err := m.Lookup(uint32(i), &out[i]); err != nil {
+			return nil, fmt.Errorf("failed to read drop_counters[%s]: %w", name, err)
+		}
+	}
+	return out, nil
+}
+
+// kernelCounterFamilies turns drop_counters into per-CPU metrics.
+func kernelCounterFamilies(counters [][]uint64) []metricFamily {
+	calls := metricFamily{name: "rpc_agent_kernel_calls_total", help: "tcp_sendmsg probe runs, per CPU.", typ: "counter"}
+	emitted := metricFamily{name: "rpc_agent_kernel_emitted_total", help: "Records handed to the event transport, per CPU.", typ: "counter"}
+	drops := metricFamily{name: "rpc_agent_kernel_drops_total", help: "Sends and records discarded in kernel, per reason and CPU.", typ: "counter"}
+	for i, perCPU := range counters {
+		for cpu, n := range perCPU {
+			label := `cpu="` + strconv.Itoa(cpu) + `"`
+			switch i {
+			case counterCalls:
+				calls.samples = append(calls.samples, metricSample{labels: label, value: float64(n)})
+			case counterEmitted:
+				emitted.samples = append(emitted.samples, metricSample{labels: label, value: float64(n)})
+			default:
+				drops.samples = append(drops.samples, metricSample{labels: `reason="` + kernelCounters[i] + `",` + label, value: float64(n)})
+			}
+		}
+	}
+	return []metricFamily{calls, emitted, drops}
+}
+
+// reportKernelCounters logs what the kernel discarded every interval until
+// ctx is done: transport overflows always, the full breakdown in debug mode.
+func (a *Agent) reportKernelCounters(ctx context.Context, interval time.Duration) {
+	ticker := time.NewTicker(interval)
+	defer ticker.Stop()
+	last := make([]uint64, len(kernelCounters))
+
+	for {
+		select {
+		case <-ctx.Done():
+			return
+		case <-ticker.C:
+		}
+		counters, err := readKernelCounters(a.EBPFObjs.DropCounters)
+		if err != nil {
+			log.Printf("Failed to read kernel counters: %v", err)
+			continue
+		}
+		var parts []string
+		for i, perCPU := range counters {
+			var total uint64
+			for _, n := range perCPU {
+				total += n
+			}
+			delta := total - last[i]
+			last[i] = total
+			if delta > 0 {
+				parts = append(parts, fmt.Sprintf("%s=%d", kernelCounters[i], delta))
+			}
+			if i == counterOutput && delta > 0 {
+				log.Printf("Warning: event transport full, kernel dropped %d records", delta)
+			}
+		}
+		if DebugMode && len(parts) > 0 {
+			log.Printf("DEBUG: Kernel counters over %s: %s", interval, strings.Join(parts, " "))
+		}
+	}
+}
@@ -0,0 +1,252 @@
+package main
+
+import (
+	"bytes"
+	"fmt"
+	"sync"
+
+	"github.com/cilium/ebpf"
+)
+
+// methodNameLen is METHOD_NAME_LEN in rpc_tracer.c
+const methodNameLen = 32
+
+// methodUnknown is METHOD_UNKNOWN in rpc_tracer.c
+const methodUnknown uint16 = 0
+
+// knownMethods is the method table loaded into the method_ids map.
+// A method's ID is its index + 1; append new names at the end so IDs stay
+// stable across agent versions.
+var knownMethods = []string{
+	"eth_call",
+	"eth_sendTransaction",
+	"eth_getBalance",
+	"eth_blockNumber",
+	"eth_sendRawTransaction",
+	"eth_getBlockByNumber",
+	"eth_getBlockByHash",
+	"eth_getTransactionByHash",
+	"eth_getTransactionReceipt",
+	"eth_getTransactionCount",
+	"eth_estimateGas",
+	"eth_gasPrice",
+	"eth_maxPriorityFeePerGas",
+	"eth_feeHistory",
+	"eth_chainId",
+	"eth_getCode",
+	"eth_getStorageAt",
+	"eth_getLogs",
+	"eth_newFilter",
+	"eth_newBlockFilter",
+	"eth_getFilterChanges",
+	"eth_getFilterLogs",
+	"eth_uninstallFilter",
+	"eth_subscribe",
+	"eth_unsubscribe",
+	"eth_syncing",
+	"eth_accounts",
+	"eth_sign",
+	"eth_signTransaction",
+	"eth_getProof",
+	"eth_createAccessList",
+	"eth_getBlockReceipts",
+	"eth_getBlockTransactionCountByNumber",
+	"eth_getBlockTransactionCountByHash",
+	"eth_getTransactionByBlockNumberAndIndex",
+	"eth_getTransactionByBlockHashAndIndex",
+	"net_version",
+	"net_listening",
+	"net_peerCount",
+	"web3_clientVersion",
+	"debug_traceTransaction",
+	"debug_traceCall",
+}
+
+// maxInternedMethods bounds the names learned from payloads at runtime, so a
+// misbehaving client cannot grow the table (and the NATS subject space) forever.
+const maxInternedMethods = 1024
+
+// methodTable interns method names seen in payloads that are not in
+// knownMethods. Learned names get IDs after the known ones, so a method ID
+// is a stable handle for the life of the agent.
+var methodTable = struct {
+	sync.RWMutex
+	ids   map[string]uint16
+	names []string // ID - len(knownMethods) - 1
+}{ids: make(map[string]uint16)}
+
+func init() {
+	for i, name := range knownMethods {
+		methodTable.ids[name] = uint16(i + 1)
+	}
+}
+
+// methodName returns the name for a method ID, or "" if unknown.
+func methodName(id uint16) string {
+	if id == methodUnknown {
+		return ""
+	}
+	if int(id) <= len(knownMethods) {
+		return knownMethods[id-1]
+	}
+	methodTable.RLock()
+	defer methodTable.RUnlock()
+	if i := int(id) - len(knownMethods) - 1; i < len(methodTable.names) {
+		return methodTable.names[i]
+	}
+	return ""
+}
+
+// internMethod returns the ID for name, learning it if there is room.
+// Lookups of already-known names do not allocate.
+func internMethod(name []byte) uint16 {
+	if !validMethodName(name) {
+		return methodUnknown
+	}
+
+	methodTable.RLock()
+	id, ok := methodTable.ids[string(name)]
+	methodTable.RUnlock()
+	if ok {
+		return id
+	}
+
+	methodTable.Lock()
+	defer methodTable.Unlock()
+	if id, ok := methodTable.ids[string(name)]; ok {
+		return id
+	}
+	if len(methodTable.names) >= maxInternedMethods {
+		return methodUnknown
+	}
+	s := string(name)
+	methodTable.names = append(methodTable.names, s)
+	id = uint16(len(knownMethods) + len(methodTable.names))
+	methodTable.ids[s] = id
+	return id
+}
+
+// validMethodName accepts names that are safe as a NATS subject token.
+func validMethodName(name []byte) bool {
+	if len(name) == 0 || len(name) > 64 {
+		return false
+	}
+	for _, c := range name {
+		if !(c >= 'a' && c <= 'z' || c >= 'A' && c <= 'Z' || c >= '0' && c <= '9' || c == '_') {
+			return false
+		}
+	}
+	return true
+}
+
+var methodToken = []byte(`"method"`)
+
+// isJSONSpace reports JSON insignificant whitespace
+func isJSONSpace(c byte) bool {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n'
+}
+
+// scanMethod finds the next "method" : "<name>" member in p, tolerating
+// whitespace around the colon. It returns the raw name and the bytes after
+// it, so batched requests can be walked by scanning rest again.
+func scanMethod(p []byte) (name, rest []byte, ok bool) {
+	for {
+		i := bytes.Index(p, methodToken)
+		if i < 0 {
+			return nil, nil, false
+		}
+		p = p[i+len(methodToken):]
+
+		j := 0
+		for j < len(p) && isJSONSpace(p[j]) {
+			j++
+		}
+		if j >= len(p) || p[j] != ':' {
+			continue // "method" used as a value, not a key
+		}
+		j++
+		for j < len(p) && isJSONSpace(p[j]) {
+			j++
+		}
+		if j >= len(p) || p[j] != '"' {
+			continue
+		}
+		j++
+
+		k := bytes.IndexByte(p[j:], '"')
+		if k < 0 {
+			return nil, nil, false // Name runs past the captured prefix
+		}
+		return p[j : j+k], p[j+k+1:], true
+	}
+}
+
+// maxBatchMethods bounds the distinct methods counted in one batch; further
+// names are counted as methodUnknown.
+const maxBatchMethods = 16
+
+// methodCount is one method of a batch: how many of its requests used it
+// and the bytes of the send credited to them.
+type methodCount struct {
+	ID    uint16
+	Count uint32
+	Bytes uint32
+}
+
+// extractMethods enumerates the JSON-RPC methods in payload in a single
+// pass and appends one methodCount per distinct method to dst, which needs
+// room for maxBatchMethods+1 entries to avoid allocating. total is the size
+// of the whole send: each request is credited the bytes from its method to
+// the next one's, the first also those before it and the last those after,
+// including any the capture truncated.
+func extractMethods(dst []methodCount, payload []byte, total uint32) []methodCount {
+	first, cur, prev := len(dst), -1, uint32(0)
+	for p := payload; ; {
+		name, rest, ok := scanMethod(p)
+		if !ok {
+			break
+		}
+		p = rest
+		off := uint32(len(payload) - len(rest))
+		if cur >= 0 {
+			dst[cur].Bytes += off - prev
+			prev = off
+		}
+
+		id := internMethod(name)
+		cur = first
+		for cur < len(dst) && dst[cur].ID != id {
+			cur++
+		}
+		if cur == len(dst) && cur-first >= maxBatchMethods && id != methodUnknown {
+			id = methodUnknown
+			for cur = first; cur < len(dst) && dst[cur].ID != id; cur++ {
+			}
+		}
+		if cur == len(dst) {
+			dst = append(dst, methodCount{ID: id})
+		}
+		dst[cur].Count++
+	}
+	if cur >= 0 && total > prev {
+		dst[cur].Bytes += total - prev
+	}
+	return dst
+}
+
+// loadMethodTable populates the method_ids map used for in-kernel classification.
+// Names that do not fit METHOD_NAME_LEN (including the NUL) cannot be matched
+// in kernel and are left to the userspace extractor.
+func loadMethodTable(m *ebpf.Map) error {
+	for i, name := range knownMethods {
+		if len(name) >= methodNameLen {
+			continue
+		}
+		var key [methodNameLen]byte
+		copy(key[:], name)
+		if err := m.Put(key, uint16(i+1)); err != nil {
+			return fmt.Errorf("failed to load method %s: %w", name, err)
+		}
+	}
+	return nil
+}
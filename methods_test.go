@@ -0,0 +1,168 @@
+package main
+
+import (
+	"fmt"
+	"regexp"
+	"strings"
+	"testing"
+)
+
+// httpBatch is a keep-alive HTTP request carrying a JSON-RPC batch.
+var httpBatch = []byte("POST / HTTP/1.1\r\nHost: rpc.example\r\nContent-Type: application/json\r\n\r\n" +
+	`[{"jsonrpc":"2.0","id":1,"method":"eth_call","params":[{"to":"0x0"},"latest"]},` +
+	`{"jsonrpc":"2.0","id":2,"method":"eth_blockNumber","params":[]}]`)
+
+func TestScanMethod(t *testing.T) {
+	tests := []struct {
+		name    string
+		payload string
+		want    string
+		ok      bool
+	}{
+		{"compact", `{"method":"eth_call"}`, "eth_call", true},
+		{"space around colon", `{"method" : "eth_call"}`, "eth_call", true},
+		{"tabs and newlines", "{\"method\"\t:\r\n \"eth_call\"}", "eth_call", true},
+		{"method as value", `{"params":["method"],"method":"eth_getLogs"}`, "eth_getLogs", true},
+		{"method as value only", `{"id":"method","params":[]}`, "", false},
+		{"method as object value", `{"x":"method", "y":1}`, "", false},
+		{"non-string value", `{"method":42}`, "", false},
+		{"truncated name", `{"jsonrpc":"2.0","method":"eth_ca`, "", false},
+		{"truncated after colon", `{"method":`, "", false},
+		{"truncated after key", `{"method"`, "", false},
+		{"empty", ``, "", false},
+	}
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			name, _, ok := scanMethod([]byte(tt.payload))
+			if ok != tt.ok || string(name) != tt.want {
+				t.Errorf("scanMethod(%q) = %q, %v; want %q, %v", tt.payload, name, ok, tt.want, tt.ok)
+			}
+		})
+	}
+}
+
+func TestExtractMethods(t *testing.T) {
+	call, balance := internMethod([]byte("eth_call")), internMethod([]byte("eth_getBalance"))
+	tests := []struct {
+		name    string
+		payload string
+		total   uint32 // 0 = len(payload)
+		want    []methodCount
+	}{
+		{
+			name:    "single",
+			payload: `{"jsonrpc":"2.0","method":"eth_call","id":1}`,
+			want:    []methodCount{{ID: call, Count: 1, Bytes: 44}},
+		},
+		{
+			name:    "batch",
+			payload: `[{"method":"eth_call"},{"method":"eth_getBalance"},{"method":"eth_call"}]`,
+			// Each boundary is the end of a method name
+			want: []methodCount{{ID: call, Count: 2, Bytes: 51}, {ID: balance, Count: 1, Bytes: 22}},
+		},
+		{
+			name:    "batch with whitespace",
+			payload: "[ {\"method\" : \"eth_call\"} ,\n {\"method\":\t\"eth_getBalance\"} ]",
+			want:    []methodCount{{ID: call, Count: 1, Bytes: 56}, {ID: balance, Count: 1, Bytes: 3}},
+		},
+		{
+			name:    "truncated capture",
+			payload: `[{"method":"eth_call"},{"method":"eth_getBal`,
+			total:   4096,
+			want:    []methodCount{{ID: call, Count: 1, Bytes: 4096}},
+		},
+		{
+			name:    "no method",
+			payload: `{"jsonrpc":"2.0","result":"0x1","id":1}`,
+			want:    nil,
+		},
+	}
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			total := tt.total
+			if total == 0 {
+				total = uint32(len(tt.payload))
+			}
+			got := extractMethods(nil, []byte(tt.payload), total)
+			if fmt.Sprint(got) != fmt.Sprint(tt.want) {
+				t.Errorf("extractMethods(%q) = %v, want %v", tt.payload, got, tt.want)
+			}
+			var sum uint32
+			for _, m := range got {
+				sum += m.Bytes
+			}
+			if len(got) > 0 && sum != total {
+				t.Errorf("credited %d bytes, want the %d of the send", sum, total)
+			}
+		})
+	}
+}
+
+func TestExtractMethodsBatchCap(t *testing.T) {
+	var b strings.Builder
+	b.WriteByte('[')
+	for i := 0; i < maxBatchMethods+4; i++ {
+		if i > 0 {
+			b.WriteByte(',')
+		}
+		fmt.Fprintf(&b, `{"method":"cap_test_%d"}`, i)
+	}
+	b.WriteByte(']')
+	payload := []byte(b.String())
+
+	got := extractMethods(nil, payload, uint32(len(payload)))
+	if len(got) != maxBatchMethods+1 {
+		t.Fatalf("got %d entries, want %d distinct methods plus unknown", len(got), maxBatchMethods+1)
+	}
+	last := got[len(got)-1]
+	if last.ID != methodUnknown || last.Count != 4 {
+		t.Errorf("overflow entry = %+v, want 4 requests counted as unknown", last)
+	}
+}
+
+func TestExtractMethodsAllocs(t *testing.T) {
+	dst := make([]methodCount, 0, maxBatchMethods+1)
+	extractMethods(dst, httpBatch, uint32(len(httpBatch))) // Intern the names
+	if n := testing.AllocsPerRun(100, func() {
+		extractMethods(dst[:0], httpBatch, uint32(len(httpBatch)))
+	}); n != 0 {
+		t.Errorf("extractMethods allocates %.0f times per call, want 0", n)
+	}
+}
+
+func BenchmarkScanMethod(b *testing.B) {
+	if n := testing.AllocsPerRun(100, func() { scanMethod(httpBatch) }); n != 0 {
+		b.Fatalf("scanMethod allocates %.0f times per call, want 0", n)
+	}
+	b.ReportAllocs()
+	b.SetBytes(int64(len(httpBatch)))
+	for i := 0; i < b.N; i++ {
+		scanMethod(httpBatch)
+	}
+}
+
+func BenchmarkExtractMethods(b *testing.B) {
+	dst := make([]methodCount, 0, maxBatchMethods+1)
+	extractMethods(dst, httpBatch, uint32(len(httpBatch)))
+	if n := testing.AllocsPerRun(100, func() {
+		extractMethods(dst[:0], httpBatch, uint32(len(httpBatch)))
+	}); n != 0 {
+		b.Fatalf("extractMethods allocates %.0f times per call, want 0", n)
+	}
+	b.ReportAllocs()
+	b.SetBytes(int64(len(httpBatch)))
+	for i := 0; i < b.N; i++ {
+		extractMethods(dst[:0], httpBatch, uint32(len(httpBatch)))
+	}
+}
+
+// BenchmarkRegexMethod is the extraction the scanner replaced: a regex
+// compiled per event over the payload converted to a string.
+func BenchmarkRegexMethod(b *testing.B) {
+	b.ReportAllocs()
+	b.SetBytes(int64(len(httpBatch)))
+	for i := 0; i < b.N; i++ {
+		re := regexp.MustCompile(`"method"\s*:\s*"(eth_[a-zA-Z0-9_]+)"`)
+		re.FindStringSubmatch(string(httpBatch))
+	}
+}
@@ -0,0 +1,306 @@
+package main
+
+import (
+	"context"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"io"
+	"log"
+	"math/bits"
+	"net/http"
+	"reflect"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/cilium/ebpf"
+)
+
+// Self-metrics configuration - can be overridden by environment variables
+var (
+	MetricsAddr        = getEnv("METRICS_ADDR", ":9102")                   // Prometheus /metrics listener; "off" disables
+	HealthInterval     = getEnvDuration("HEALTH_INTERVAL", 10*time.Second) // How often agent.<node>.health is published
+	NodeName           = sanitizeHostname(getEnv("NODE_NAME", serverHostname))
+	BPFStats           = getEnv("BPF_STATS", "true") == "true" // BPF_ENABLE_STATS run time and count per program
+	MetricsTimingEvery = getEnvInt("METRICS_TIMING_EVERY", 16) // Time 1 in N events per worker (0 = never)
+)
+
+// bpfStatsRunTime is BPF_STATS_RUN_TIME, the only kind of BPF_ENABLE_STATS
+const bpfStatsRunTime = 0
+
+// numDurationBuckets is the number of finite durationHistogram buckets,
+// with upper bounds 256ns << i (256ns to about 8.4ms)
+const numDurationBuckets = 16
+
+// durationHistogram is a lock-free histogram of durations with
+// power-of-two buckets.
+type durationHistogram struct {
+	counts [numDurationBuckets + 1]atomic.Uint64 // Last is +Inf
+	sumNs  atomic.Uint64
+}
+
+func (h *durationHistogram) observe(d time.Duration) {
+	ns := uint64(0)
+	if d > 0 {
+		ns = uint64(d)
+	}
+	i := 0
+	if ns > 256 {
+		i = bits.Len64((ns - 1) >> 8)
+	}
+	if i > numDurationBuckets {
+		i = numDurationBuckets
+	}
+	h.counts[i].Add(1)
+	h.sumNs.Add(ns)
+}
+
+// metrics are the histograms and counters updated on the hot path.
+// Gauges (queue depths, NATS buffer, BPF stats) are read when collected.
+var metrics struct {
+	decode  durationHistogram // decodeRPCEvent, sampled
+	extract durationHistogram // Feature extraction up to the publish queue, sampled
+	publish durationHistogram // Encoding and handing one message to NATS
+
+	lostMu     sync.Mutex
+	lostPerCPU map[int]uint64 // Perf records lost, per CPU
+}
+
+// recordLost counts perf records lost on cpu.
+func recordLost(cpu int, n uint64) {
+	metrics.lostMu.Lock()
+	if metrics.lostPerCPU == nil {
+		metrics.lostPerCPU = make(map[int]uint64)
+	}
+	metrics.lostPerCPU[cpu] += n
+	metrics.lostMu.Unlock()
+}
+
+// metricFamily is one metric with its samples, ready for either exposition.
+type metricFamily struct {
+	name, help, typ string
+	samples         []metricSample
+}
+
+type metricSample struct {
+	suffix string // _bucket, _sum, _count for histograms
+	labels string // Prometheus label set without braces, e.g. cpu="0"
+	value  float64
+}
+
+func counter(name, help string, v uint64) metricFamily {
+	return metricFamily{name: name, help: help, typ: "counter", samples: []metricSample{{value: float64(v)}}}
+}
+
+func gauge(name, help string, v float64) metricFamily {
+	return metricFamily{name: name, help: help, typ: "gauge", samples: []metricSample{{value: v}}}
+}
+
+func histogram(name, help string, h *durationHistogram) metricFamily {
+	f := metricFamily{name: name, help: help, typ: "histogram"}
+	var cum uint64
+	for i := range h.counts {
+		cum += h.counts[i].Load()
+		le := "+Inf"
+		if i < numDurationBuckets {
+			le = strconv.FormatFloat(float64(uint64(256)<<i)/1e9, 'g', -1, 64)
+		}
+		f.samples = append(f.samples, metricSample{suffix: "_bucket", labels: `le="` + le + `"`, value: float64(cum)})
+	}
+	f.samples = append(f.samples,
+		metricSample{suffix: "_sum", value: float64(h.sumNs.Load()) / 1e9},
+		metricSample{suffix: "_count", value: float64(cum)})
+	return f
+}
+
+// bpfProgram is a loaded program reported in the BPF stats
+type bpfProgram struct {
+	name string
+	prog *ebpf.Program
+}
+
+// addPrograms registers the *ebpf.Program fields of progs (a pointer to a
+// struct tagged like the bpf2go objects) for the BPF stats.
+func (a *Agent) addPrograms(progs any) {
+	v := reflect.ValueOf(progs).Elem()
+	a.bpfMu.Lock()
+	defer a.bpfMu.Unlock()
+	for i := 0; i < v.NumField(); i++ {
+		name := v.Type().Field(i).Tag.Get("ebpf")
+		if p, ok := v.Field(i).Interface().(*ebpf.Program); ok && p != nil && name != "" {
+			a.bpfPrograms = append(a.bpfPrograms, bpfProgram{name, p})
+		}
+	}
+}
+
+// collectMetrics snapshots every self-metric.
+func (a *Agent) collectMetrics() []metricFamily {
+	fams := []metricFamily{
+		counter("rpc_agent_events_read_total", "Records read from the event transport.", a.recordsRead.Load()),
+		histogram("rpc_agent_decode_seconds", "Time to decode one record (sampled).", &metrics.decode),
+		histogram("rpc_agent_extract_seconds", "Time from decoded record to queued features (sampled).", &metrics.extract),
+		histogram("rpc_agent_publish_seconds", "Time to encode and hand one message to NATS.", &metrics.publish),
+	}
+
+	lost := metricFamily{name: "rpc_agent_events_lost_total", help: "Records the perf transport reported lost, per CPU.", typ: "counter"}
+	metrics.lostMu.Lock()
+	for cpu, n := range metrics.lostPerCPU {
+		lost.samples = append(lost.samples, metricSample{labels: `cpu="` + strconv.Itoa(cpu) + `"`, value: float64(n)})
+	}
+	metrics.lostMu.Unlock()
+	sort.Slice(lost.samples, func(i, j int) bool { return lost.samples[i].labels < lost.samples[j].labels })
+	fams = append(fams, lost)
+
+	if p := a.pipeline; p != nil {
+		depth := 0
+		for _, ch := range p.shards {
+			depth += len(ch)
+		}
+		fams = append(fams,
+			gauge("rpc_agent_worker_queue_depth", "Records queued for the workers.", float64(depth)),
+			counter("rpc_agent_worker_dropped_total", "Records dropped by the backpressure policy.", p.dropped.Load()))
+	}
+	if pub := a.Publisher; pub != nil {
+		fams = append(fams,
+			gauge("rpc_agent_publish_queue_depth", "Features queued for publishing.", float64(len(pub.queue))),
+			counter("rpc_agent_publish_dropped_total", "Features dropped because the publish queue was full.", pub.dropped.Load()),
+			counter("rpc_agent_published_total", "Messages published to NATS.", pub.published.Load()))
+		if sp := pub.spool; sp != nil {
+			fams = append(fams,
+				gauge("rpc_agent_spool_backlog_bytes", "Bytes spooled and not yet replayed to NATS.", float64(sp.backlog())),
+				counter("rpc_agent_spool_written_total", "Messages written to the spool.", sp.spooled.Load()),
+				counter("rpc_agent_spool_replayed_total", "Spooled messages replayed to NATS.", sp.replayed.Load()),
+				counter("rpc_agent_spool_dropped_total", "Messages lost because the spool was full.", sp.dropped.Load()))
+		}
+	}
+	if dns := a.DNS; dns != nil {
+		fams = append(fams,
+			counter("rpc_agent_dns_cache_hits_total", "Destination lookups answered from the cache.", dns.hits.Load()),
+			counter("rpc_agent_dns_cache_misses_total", "Destination lookups that created a cache entry.", dns.misses.Load()))
+	}
+	if pods := a.Pods; pods != nil {
+		fams = append(fams,
+			gauge("rpc_agent_pod_containers", "Containers of this node's pods in the pod index.", float64(pods.Len())),
+			counter("rpc_agent_pod_lookups_total", "Events attributed to a pod.", pods.hits.Load()),
+			counter("rpc_agent_pod_lookup_misses_total", "Events whose cgroup matched no pod.", pods.misses.Load()))
+	}
+	if a.NatsConn != nil {
+		if n, err := a.NatsConn.Buffered(); err == nil {
+			fams = append(fams, gauge("rpc_agent_nats_pending_bytes", "Bytes buffered in the NATS client, not yet sent.", float64(n)))
+		}
+	}
+
+	if a.EBPFObjs != nil && a.EBPFObjs.DropCounters != nil {
+		if counters, err := readKernelCounters(a.EBPFObjs.DropCounters); err == nil {
+			fams = append(fams, kernelCounterFamilies(counters)...)
+		}
+	}
+
+	runs := metricFamily{name: "rpc_agent_bpf_run_total", help: "Runs of each BPF program (BPF_ENABLE_STATS).", typ: "counter"}
+	runTime := metricFamily{name: "rpc_agent_bpf_run_seconds_total", help: "Time spent in each BPF program (BPF_ENABLE_STATS).", typ: "counter"}
+	a.bpfMu.Lock()
+	for _, p := range a.bpfPrograms {
+		info, err := p.prog.Info()
+		if err != nil {
+			continue
+		}
+		label := `program="` + p.name + `"`
+		if n, ok := info.RunCount(); ok {
+			runs.samples = append(runs.samples, metricSample{labels: label, value: float64(n)})
+		}
+		if d, ok := info.Runtime(); ok {
+			runTime.samples = append(runTime.samples, metricSample{labels: label, value: d.Seconds()})
+		}
+	}
+	a.bpfMu.Unlock()
+	return append(fams, runs, runTime)
+}
+
+// writePrometheus writes fams in the Prometheus text exposition format.
+func writePrometheus(w io.Writer, fams []metricFamily) {
+	for _, f := range fams {
+		fmt.Fprintf(w, "# HELP %s %s\n# TYPE %s %s\n", f.name, f.help, f.name, f.typ)
+		for _, s := range f.samples {
+			labels := ""
+			if s.labels != "" {
+				labels = "{" + s.labels + "}"
+			}
+			fmt.Fprintf(w, "%s%s%s %s\n", f.name, s.suffix, labels, strconv.FormatFloat(s.value, 'g', -1, 64))
+		}
+	}
+}
+
+// healthSnapshot flattens fams into name{labels} -> value for the health
+// subject. Histogram buckets are left out; their sum and count remain.
+func healthSnapshot(fams []metricFamily) map[string]float64 {
+	out := make(map[string]float64)
+	for _, f := range fams {
+		for _, s := range f.samples {
+			if s.suffix == "_bucket" {
+				continue
+			}
+			key := f.name + s.suffix
+			if s.labels != "" {
+				key += "{" + strings.ReplaceAll(s.labels, `"`, "") + "}"
+			}
+			out[key] = s.value
+		}
+	}
+	return out
+}
+
+// healthSubject is the NATS subject of this node's self-metrics
+func healthSubject() string {
+	return "agent." + NodeName + ".health"
+}
+
+// serveMetrics exposes /metrics on MetricsAddr and publishes the health
+// snapshot every HealthInterval until ctx is done.
+func (a *Agent) serveMetrics(ctx context.Context) {
+	if MetricsAddr != "off" {
+		mux := http.NewServeMux()
+		mux.HandleFunc("/metrics", func(w http.ResponseWriter, r *http.Request) {
+			w.Header().Set("Content-Type", "text/plain; version=0.0.4")
+			writePrometheus(w, a.collectMetrics())
+		})
+		srv := &http.Server{Addr: MetricsAddr, Handler: mux, ReadHeaderTimeout: 5 * time.Second}
+		go func() {
+			if err := srv.ListenAndServe(); err != nil && !errors.Is(err, http.ErrServerClosed) {
+				log.Printf("Metrics endpoint failed: %v", err)
+			}
+		}()
+		defer srv.Close()
+		log.Printf("Serving metrics on %s/metrics", MetricsAddr)
+	}
+
+	if a.NatsConn == nil {
+		<-ctx.Done()
+		return
+	}
+	ticker := time.NewTicker(HealthInterval)
+	defer ticker.Stop()
+	subject := healthSubject()
+	for {
+		select {
+		case <-ctx.Done():
+			return
+		case now := <-ticker.C:
+			data, err := json.Marshal(struct {
+				Node      string             `json:"node"`
+				Timestamp time.Time          `json:"timestamp"`
+				Metrics   map[string]float64 `json:"metrics"`
+			}{NodeName, now, healthSnapshot(a.collectMetrics())})
+			if err != nil {
+				log.Printf("Failed to encode health: %v", err)
+				continue
+			}
+			if err := a.NatsConn.Publish(subject, data); err != nil {
+				log.Printf("Failed to publish health to %s: %v", subject, err)
+			}
+		}
+	}
+}
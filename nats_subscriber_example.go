@@ -1,3 +1,5 @@
+//go:build ignore
+
 // Simple NATS subscriber for testing the eBPF agent output
 // Run this to see the messages being published by the agent
 //
@@ -29,6 +31,25 @@ type MonitoringFeature struct {
 	Details     map[string]interface{} `json:"details"`
 }
 
+// subjectTotals counts the events seen on a subject, weighted by
+// sample_weight so sampled and rate limited messages count in full
+type subjectTotals struct {
+	events float64
+	value  float64 // Sum of value, which the agent already weights
+}
+
+// eventCount is the number of traced events a feature stands for: its
+// batch_count (already weighted) for a batch, else its sample_weight.
+func eventCount(feature MonitoringFeature) float64 {
+	if n, ok := feature.Details["batch_count"].(float64); ok && n > 0 {
+		return n
+	}
+	if w, ok := feature.Details["sample_weight"].(float64); ok && w > 0 {
+		return w
+	}
+	return 1
+}
+
 func main() {
 	natsURL := os.Getenv("NATS_URL")
 	if natsURL == "" {
@@ -48,31 +69,40 @@ func main() {
 	subject := ">"
 	log.Printf("Subscribing to subject: %s", subject)
 
+	// Message handlers run one at a time, so totals needs no lock
+	totals := make(map[string]*subjectTotals)
 	_, err = nc.Subscribe(subject, func(msg *nats.Msg) {
-		// Parse the JSON payload
-		var feature MonitoringFeature
-		if err := json.Unmarshal(msg.Data, &feature); err != nil {
+		// The agent can publish msgpack (PUBLISH_ENCODING=msgpack); this example only decodes JSON
+		if msg.Header.Get("Content-Type") == "application/msgpack" {
+			log.Printf("Skipping msgpack message on %s (%d bytes)", msg.Subject, len(msg.Data))
+			return
+		}
+
+		// Parse the JSON payload: a single feature, or an array when the agent batches
+		var features []MonitoringFeature
+		var err error
+		if len(msg.Data) > 0 && msg.Data[0] == '[' {
+			err = json.Unmarshal(msg.Data, &features)
+		} else {
+			features = make([]MonitoringFeature, 1)
+			err = json.Unmarshal(msg.Data, &features[0])
+		}
+		if err != nil {
 			log.Printf("Failed to parse message: %v", err)
 			log.Printf("Raw message: %s", string(msg.Data))
 			return
 		}
 
-		// Pretty print the feature
-		fmt.Println("\n" + strings.Repeat("=", 80))
-		fmt.Printf("📊 New Event Received\n")
-		fmt.Println(strings.Repeat("-", 80))
-		fmt.Printf("Subject:      %s\n", msg.Subject)
-		fmt.Printf("App ID:       %s\n", feature.AppID)
-		fmt.Printf("Protocol:     %s\n", feature.Protocol)
-		fmt.Printf("Feature Type: %s\n", feature.FeatureType)
-		fmt.Printf("Timestamp:    %s\n", feature.Timestamp.Format(time.RFC3339))
-		fmt.Printf("Value:        %.2f\n", feature.Value)
-		fmt.Printf("Context Hash: %s\n", feature.ContextHash)
-		fmt.Println("Details:")
-		for key, value := range feature.Details {
-			fmt.Printf("  - %s: %v\n", key, value)
+		t := totals[msg.Subject]
+		if t == nil {
+			t = &subjectTotals{}
+			totals[msg.Subject] = t
+		}
+		for _, feature := range features {
+			t.events += eventCount(feature)
+			t.value += feature.Value
+			printFeature(msg.Subject, feature, t)
 		}
-		fmt.Println(strings.Repeat("=", 80))
 	})
 
 	if err != nil {
@@ -88,3 +118,23 @@ func main() {
 
 	log.Println("\nShutting down subscriber...")
 }
+
+// printFeature pretty prints a single feature and its subject's totals
+func printFeature(subject string, feature MonitoringFeature, t *subjectTotals) {
+	fmt.Println("\n" + strings.Repeat("=", 80))
+	fmt.Printf("📊 New Event Received\n")
+	fmt.Println(strings.Repeat("-", 80))
+	fmt.Printf("Subject:      %s\n", subject)
+	fmt.Printf("App ID:       %s\n", feature.AppID)
+	fmt.Printf("Protocol:     %s\n", feature.Protocol)
+	fmt.Printf("Feature Type: %s\n", feature.FeatureType)
+	fmt.Printf("Timestamp:    %s\n", feature.Timestamp.Format(time.RFC3339))
+	fmt.Printf("Value:        %.2f\n", feature.Value)
+	fmt.Printf("Events:       %.0f (%.0f on this subject, value total %.2f)\n", eventCount(feature), t.events, t.value)
+	fmt.Printf("Context Hash: %s\n", feature.ContextHash)
+	fmt.Println("Details:")
+	for key, value := range feature.Details {
+		fmt.Printf("  - %s: %v\n", key, value)
+	}
+	fmt.Println(strings.Repeat("=", 80))
+}
@@ -0,0 +1,241 @@
+package main
+
+import (
+	"context"
+	"errors"
+	"fmt"
+	"log"
+	"os"
+	"path/filepath"
+	"strings"
+	"time"
+
+	"github.com/cilium/ebpf"
+	"github.com/cilium/ebpf/link"
+)
+
+// Pinning configuration - can be overridden by environment variables
+var (
+	BPFPinPath     = getEnv("BPF_PIN_PATH", "/sys/fs/bpf/rpc-agent")  // Pinned maps and links; "off" disables handover
+	HandoffTimeout = getEnvDuration("HANDOFF_TIMEOUT", 5*time.Second) // Wait for the previous agent to release the ringbuf
+)
+
+// tracerConfig mirrors struct tracer_config in rpc_tracer.c
+type tracerConfig struct {
+	FilterFlags uint32
+	ActiveGen   uint32
+	ReaderGen   uint32
+}
+
+func pinningEnabled() bool {
+	return BPFPinPath != "" && BPFPinPath != "off"
+}
+
+func linkPinDir() string {
+	return filepath.Join(BPFPinPath, "links")
+}
+
+// configurePinning marks the maps of spec to be pinned under BPF_PIN_PATH,
+// so a restarted or upgraded agent keeps the flows, histograms and counters
+// of the previous one. A perf events array only reaches its own readers and
+// stays private to each agent.
+func configurePinning(spec *ebpf.CollectionSpec, transport string) error {
+	if !pinningEnabled() {
+		return nil
+	}
+	if err := os.MkdirAll(linkPinDir(), 0o700); err != nil {
+		return fmt.Errorf("failed to create %s: %w", BPFPinPath, err)
+	}
+	for name, m := range spec.Maps {
+		if strings.HasPrefix(name, ".") || (name == "events" && transport != TransportRingBuf) {
+			continue
+		}
+		m.Pinning = ebpf.PinByName
+	}
+	return nil
+}
+
+// collectionOptions are the load options for programs sharing the tracer's
+// maps, pinning any map the tracer did not create.
+func collectionOptions(replacements map[string]*ebpf.Map) *ebpf.CollectionOptions {
+	opts := &ebpf.CollectionOptions{MapReplacements: replacements}
+	if pinningEnabled() {
+		opts.Maps.PinPath = BPFPinPath
+	}
+	return opts
+}
+
+// removePinnedMaps unpins every map under BPF_PIN_PATH. Programs still
+// attached keep their maps until they are detached.
+func removePinnedMaps() error {
+	entries, err := os.ReadDir(BPFPinPath)
+	if err != nil {
+		return err
+	}
+	for _, e := range entries {
+		if e.IsDir() {
+			continue
+		}
+		if err := os.Remove(filepath.Join(BPFPinPath, e.Name())); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// readPinnedConfig returns the pinned tracer_config, which is zero when no
+// agent has pinned one since boot.
+func readPinnedConfig() (tracerConfig, error) {
+	var cfg tracerConfig
+	if !pinningEnabled() {
+		return cfg, nil
+	}
+	m, err := ebpf.LoadPinnedMap(filepath.Join(BPFPinPath, "tracer_config"), nil)
+	if errors.Is(err, os.ErrNotExist) {
+		return cfg, nil
+	}
+	if err != nil {
+		return cfg, fmt.Errorf("failed to open pinned tracer_config: %w", err)
+	}
+	defer m.Close()
+	if err := m.Lookup(uint32(0), &cfg); err != nil {
+		return cfg, fmt.Errorf("failed to read pinned tracer_config: %w", err)
+	}
+	return cfg, nil
+}
+
+// updateConfig applies fn to the live tracer_config.
+func updateConfig(m *ebpf.Map, fn func(*tracerConfig)) error {
+	var cfg tracerConfig
+	if err := m.Lookup(uint32(0), &cfg); err != nil {
+		return fmt.Errorf("failed to read tracer_config: %w", err)
+	}
+	fn(&cfg)
+	if err := m.Put(uint32(0), cfg); err != nil {
+		return fmt.Errorf("failed to write tracer_config: %w", err)
+	}
+	return nil
+}
+
+// takeOver makes this agent's programs the active ones. They were attached
+// next to the previous generation's but stayed idle; one tracer_config
+// write switches every hook over, then the old links are detached and the
+// new ones pinned in their place so they outlive this process.
+func (a *Agent) takeOver(started []*startedTracer) error {
+	prev, gen := uint32(0), a.generation
+	if err := updateConfig(a.EBPFObjs.TracerConfig, func(c *tracerConfig) {
+		prev, c.ActiveGen = c.ActiveGen, gen
+	}); err != nil {
+		return err
+	}
+	if prev != 0 {
+		log.Printf("Generation %d active, took over from generation %d", gen, prev)
+	}
+	if !pinningEnabled() {
+		return nil
+	}
+
+	dir := linkPinDir()
+	entries, err := os.ReadDir(dir)
+	if err != nil {
+		return fmt.Errorf("failed to list pinned links: %w", err)
+	}
+	for _, e := range entries {
+		path := filepath.Join(dir, e.Name())
+		old, err := link.LoadPinnedLink(path, nil)
+		if err != nil {
+			log.Printf("Removing stale link pin %s: %v", path, err)
+			os.Remove(path)
+			continue
+		}
+		old.Unpin()
+		old.Close()
+	}
+	for _, t := range started {
+		if t.pin != nil {
+			t.pin(dir)
+			continue
+		}
+		for i, l := range t.links {
+			if err := l.Pin(filepath.Join(dir, fmt.Sprintf("%s-%d", t.name, i))); err != nil {
+				log.Printf("%s links not pinned (%v); they detach when the agent exits", t.name, err)
+				for _, pinned := range t.links[:i] {
+					pinned.Unpin()
+				}
+				break
+			}
+		}
+	}
+
+	// Only one reader may consume the pinned ringbuf. The previous agent
+	// stops reading once it sees the new generation and clears ReaderGen.
+	if a.Transport != TransportRingBuf {
+		return nil
+	}
+	deadline := time.Now().Add(HandoffTimeout)
+	for {
+		var cfg tracerConfig
+		if err := a.EBPFObjs.TracerConfig.Lookup(uint32(0), &cfg); err != nil {
+			return fmt.Errorf("failed to read tracer_config: %w", err)
+		}
+		if cfg.ReaderGen == 0 || cfg.ReaderGen == gen || time.Now().After(deadline) {
+			if cfg.ReaderGen != 0 && cfg.ReaderGen != gen {
+				log.Printf("Generation %d did not release the ring buffer within %s, reading anyway", cfg.ReaderGen, HandoffTimeout)
+			}
+			break
+		}
+		time.Sleep(20 * time.Millisecond)
+	}
+	return updateConfig(a.EBPFObjs.TracerConfig, func(c *tracerConfig) { c.ReaderGen = gen })
+}
+
+// releaseReader hands the pinned ringbuf to the next agent once this one
+// has stopped reading.
+func (a *Agent) releaseReader() {
+	if !pinningEnabled() || a.Transport != TransportRingBuf {
+		return
+	}
+	err := updateConfig(a.EBPFObjs.TracerConfig, func(c *tracerConfig) {
+		if c.ReaderGen == a.generation {
+			c.ReaderGen = 0
+		}
+	})
+	if err != nil {
+		log.Printf("Failed to release the ring buffer: %v", err)
+	}
+}
+
+// watchGeneration shuts the agent down once a newer agent has taken over,
+// checking every interval until ctx is done.
+func (a *Agent) watchGeneration(ctx context.Context, interval time.Duration) {
+	ticker := time.NewTicker(interval)
+	defer ticker.Stop()
+	for {
+		select {
+		case <-ctx.Done():
+			return
+		case <-ticker.C:
+		}
+		cfg, err := readPinnedConfig()
+		if err != nil || cfg.ActiveGen <= a.generation {
+			continue
+		}
+		log.Printf("Superseded by generation %d, handing over and shutting down", cfg.ActiveGen)
+		a.Cancel()
+		return
+	}
+}
+
+// runUnpin detaches a pinned tracer by removing BPF_PIN_PATH.
+func runUnpin() int {
+	if !pinningEnabled() {
+		fmt.Fprintln(os.Stderr, "BPF_PIN_PATH is off, nothing to unpin")
+		return 1
+	}
+	if err := os.RemoveAll(BPFPinPath); err != nil {
+		fmt.Fprintf(os.Stderr, "failed to remove %s: %v\n", BPFPinPath, err)
+		return 1
+	}
+	log.Printf("Removed %s; pinned programs are detached", BPFPinPath)
+	return 0
+}
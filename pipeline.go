@@ -0,0 +1,239 @@
+package main
+
+import (
+	"context"
+	"encoding/binary"
+	"fmt"
+	"log"
+	"runtime"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+// Backpressure policies applied when a worker queue is full
+const (
+	BackpressureDropNewest = "drop-newest" // Discard the incoming record
+	BackpressureDropOldest = "drop-oldest" // Discard the oldest queued record
+	BackpressureBlock      = "block"       // Stall the reader; the kernel buffer absorbs (and may drop)
+)
+
+// Shard keys
+const (
+	ShardByFlow = "flow" // PID + destination, keeps per-connection order
+	ShardByPID  = "pid"  // PID only, keeps per-process order
+)
+
+// Pipeline configuration - can be overridden by environment variables
+var (
+	EventWorkers      = getEnvInt("EVENT_WORKERS", runtime.NumCPU())
+	EventQueueSize    = getEnvInt("EVENT_QUEUE_SIZE", 1024) // Per worker
+	EventBackpressure = getEnv("EVENT_BACKPRESSURE", BackpressureDropNewest)
+	EventShardBy      = getEnv("EVENT_SHARD_BY", ShardByFlow)
+)
+
+// eventPipeline fans records from the single reader out to N workers.
+// Records with the same shard key always land on the same worker, so the
+// order of events for a flow (or process) is preserved.
+type eventPipeline struct {
+	agent   *Agent
+	shards  []chan *[]byte
+	policy  string
+	shardBy string
+	reasm   bool // Per-worker HTTP reassembly of sends (see reassembler)
+	wg      sync.WaitGroup
+
+	dropped  atomic.Uint64 // Records dropped by the backpressure policy
+	received atomic.Uint64 // Records handed to workers
+}
+
+// newEventPipeline validates the pipeline configuration.
+func newEventPipeline(a *Agent) (*eventPipeline, error) {
+	switch EventBackpressure {
+	case BackpressureDropNewest, BackpressureDropOldest, BackpressureBlock:
+	default:
+		return nil, fmt.Errorf("unknown EVENT_BACKPRESSURE %q (want drop-newest, drop-oldest or block)", EventBackpressure)
+	}
+	if EventShardBy != ShardByFlow && EventShardBy != ShardByPID {
+		return nil, fmt.Errorf("unknown EVENT_SHARD_BY %q (want flow or pid)", EventShardBy)
+	}
+	if EventWorkers < 1 || EventQueueSize < 1 {
+		return nil, fmt.Errorf("EVENT_WORKERS and EVENT_QUEUE_SIZE must be positive")
+	}
+
+	p := &eventPipeline{
+		agent:   a,
+		shards:  make([]chan *[]byte, EventWorkers),
+		policy:  EventBackpressure,
+		shardBy: EventShardBy,
+		reasm:   reassemblyEnabled(),
+	}
+	for i := range p.shards {
+		p.shards[i] = make(chan *[]byte, EventQueueSize)
+	}
+	return p, nil
+}
+
+// start launches one goroutine per shard.
+func (p *eventPipeline) start() {
+	for i := range p.shards {
+		p.wg.Add(1)
+		go p.worker(p.shards[i])
+	}
+}
+
+// stop closes the shard queues and waits for workers to drain them.
+// Must only be called after the reader has stopped dispatching.
+func (p *eventPipeline) stop() {
+	for _, ch := range p.shards {
+		close(ch)
+	}
+	p.wg.Wait()
+}
+
+// shardKey hashes the raw header fields that identify a flow. Records too
+// short to carry a header go to shard 0, where decoding reports them.
+func (p *eventPipeline) shardKey(raw []byte) uint64 {
+	if len(raw) < rpcEventHeaderSize {
+		return 0
+	}
+	key := binary.LittleEndian.Uint64(raw[offPID:]) >> 32 // TGID
+	if p.shardBy == ShardByFlow {
+		key ^= uint64(binary.LittleEndian.Uint32(raw[offDestIP:]))<<16 |
+			uint64(binary.LittleEndian.Uint16(raw[offDestPort:]))
+	}
+	// Fibonacci hashing spreads sequential PIDs across shards
+	return key * 0x9e3779b97f4a7c15
+}
+
+// dispatch copies raw (which the transport reuses) into a pooled buffer
+// and queues it on its shard.
+func (p *eventPipeline) dispatch(raw []byte) {
+	ch := p.shards[(p.shardKey(raw)>>32)%uint64(len(p.shards))]
+	rec := recordPool.Get().(*[]byte)
+	*rec = append((*rec)[:0], raw...)
+
+	switch p.policy {
+	case BackpressureBlock:
+		ch <- rec
+	case BackpressureDropOldest:
+		for {
+			select {
+			case ch <- rec:
+				p.received.Add(1)
+				return
+			default:
+			}
+			// Still full: evict the head and retry
+			select {
+			case old := <-ch:
+				recordPool.Put(old)
+				p.dropped.Add(1)
+			default:
+			}
+		}
+	default:
+		select {
+		case ch <- rec:
+		default:
+			recordPool.Put(rec)
+			p.dropped.Add(1)
+			return
+		}
+	}
+	p.received.Add(1)
+}
+
+// worker decodes and processes records from one shard. Each worker owns
+// the reassembly state of the connections sharded to it.
+func (p *eventPipeline) worker(ch <-chan *[]byte) {
+	defer p.wg.Done()
+	var event RPCEvent
+	var n int
+
+	var reasm *reassembler
+	var sweep <-chan time.Time
+	if p.reasm {
+		reasm = newReassembler(ReassemblyConns/len(p.shards), ReassemblyBufferBytes, ReassemblyIdle,
+			p.agent.processAndPublishRPCEvent)
+		ticker := time.NewTicker(reassemblyHoldTimeout)
+		defer ticker.Stop()
+		sweep = ticker.C
+	}
+
+	for {
+		select {
+		case rec, ok := <-ch:
+			if !ok {
+				if reasm != nil {
+					reasm.flush()
+				}
+				return
+			}
+			n++
+			p.process(*rec, &event, reasm, MetricsTimingEvery > 0 && n%MetricsTimingEvery == 0)
+			// event.Data aliases the record; features never keep it
+			event.Data = nil
+			recordPool.Put(rec)
+		case now := <-sweep:
+			reasm.sweep(now)
+		}
+	}
+}
+
+// process handles one record; timed records feed the decode and extract
+// histograms.
+func (p *eventPipeline) process(raw []byte, event *RPCEvent, reasm *reassembler, timed bool) {
+	var start time.Time
+	if timed {
+		start = time.Now()
+	}
+
+	// Parse the header and slice out the captured payload
+	if err := decodeRPCEvent(raw, event); err != nil {
+		log.Printf("Failed to parse event: %v", err)
+		return
+	}
+	if timed {
+		now := time.Now()
+		metrics.decode.observe(now.Sub(start))
+		start = now
+	}
+
+	if DebugMode {
+		log.Printf("DEBUG: Received event: PID=%d, Sock=%08x, DataLen=%d, CapLen=%d, Kind=%d, Comm=%s",
+			event.PID, event.SockID, event.DataLen, event.CapLen, event.Kind, commName(event.Comm))
+	}
+
+	// Feature Engineering and Publishing
+	switch {
+	case event.Kind == recordRPC:
+		p.agent.processAndPublishRPCCompletion(event)
+	case reasm != nil:
+		reasm.feed(event, time.Now())
+	default:
+		p.agent.processAndPublishRPCEvent(event)
+	}
+	if timed {
+		metrics.extract.observe(time.Since(start))
+	}
+}
+
+// reportDrops logs records dropped by the backpressure policy until ctx is done.
+func (p *eventPipeline) reportDrops(ctx context.Context, interval time.Duration) {
+	ticker := time.NewTicker(interval)
+	defer ticker.Stop()
+	var last uint64
+
+	for {
+		select {
+		case <-ctx.Done():
+			return
+		case <-ticker.C:
+			if dropped := p.dropped.Load(); dropped != last {
+				log.Printf("Warning: worker queues full (%s), dropped %d events", p.policy, dropped-last)
+				last = dropped
+			}
+		}
+	}
+}
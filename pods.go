@@ -0,0 +1,507 @@
+package main
+
+import (
+	"context"
+	"crypto/tls"
+	"crypto/x509"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"io"
+	"io/fs"
+	"log"
+	"maps"
+	"net"
+	"net/http"
+	"net/url"
+	"os"
+	"path/filepath"
+	"strings"
+	"sync/atomic"
+	"syscall"
+	"time"
+)
+
+// Pod attribution configuration - can be overridden by environment variables
+var (
+	PodAttribution = getEnv("POD_ATTRIBUTION", "auto")       // true, false, or auto (when running in Kubernetes)
+	CgroupRoot     = getEnv("CGROUP_ROOT", "/sys/fs/cgroup") // Host cgroup v2 mount, searched for container cgroups
+)
+
+// serviceAccountDir holds the in-cluster API credentials
+const serviceAccountDir = "/var/run/secrets/kubernetes.io/serviceaccount"
+
+// podPendingTimeout is how long a running container whose cgroup has not
+// appeared is looked for again, once per rescan
+const podPendingTimeout = 30 * time.Second
+
+// maxCgroupDepth bounds the cgroupfs walk; container cgroups sit at most
+// five levels down (kubepods.slice/<qos>.slice/<pod>.slice/<container>.scope)
+const maxCgroupDepth = 6
+
+// podLabels are the Kubernetes identity of one container. One instance is
+// shared by every feature from the container.
+type podLabels struct {
+	Pod       string
+	Namespace string
+	Container string
+}
+
+// podIndex maps the cgroup IDs in event headers to the containers of the
+// pods on this node. It is fed by a watch on the API server; the watch
+// goroutine publishes a new map after every change, so lookups never lock.
+type podIndex struct {
+	byCgroup atomic.Pointer[map[uint64]*podLabels]
+	hits     atomic.Uint64
+	misses   atomic.Uint64
+
+	client *kubeClient
+	node   string
+
+	// Owned by the watch goroutine
+	labels  map[uint64]*podLabels
+	pods    map[string][]uint64    // Pod UID -> cgroup IDs of its containers
+	pending map[string]*pendingPod // Pod UID -> pod with running containers not found in cgroupfs yet
+	cgroups map[string]uint64      // Container ID -> cgroup ID, from the last cgroupfs scan
+	scanned time.Time
+}
+
+// pendingPod is a pod indexed again on each rescan until all its running
+// containers are resolved, or podPendingTimeout passes.
+type pendingPod struct {
+	pod   *kubePod
+	since time.Time
+}
+
+// newPodIndex returns the pod index configured by POD_ATTRIBUTION, or nil
+// when attribution is off.
+func newPodIndex() (*podIndex, error) {
+	switch PodAttribution {
+	case "false":
+		return nil, nil
+	case "auto":
+		if os.Getenv("KUBERNETES_SERVICE_HOST") == "" {
+			return nil, nil
+		}
+	case "true":
+	default:
+		return nil, fmt.Errorf("unknown POD_ATTRIBUTION %q (want true, false or auto)", PodAttribution)
+	}
+	node := os.Getenv("NODE_NAME")
+	if node == "" {
+		return nil, fmt.Errorf("pod attribution needs NODE_NAME (spec.nodeName)")
+	}
+	client, err := newInClusterClient()
+	if err != nil {
+		return nil, err
+	}
+	x := &podIndex{
+		client:  client,
+		node:    node,
+		labels:  make(map[uint64]*podLabels),
+		pods:    make(map[string][]uint64),
+		pending: make(map[string]*pendingPod),
+		cgroups: make(map[string]uint64),
+	}
+	x.byCgroup.Store(&map[uint64]*podLabels{})
+	return x, nil
+}
+
+// Lookup returns the labels of the container with cgroup ID id, or nil.
+func (x *podIndex) Lookup(id uint64) *podLabels {
+	if x == nil || id == 0 {
+		return nil
+	}
+	if l := (*x.byCgroup.Load())[id]; l != nil {
+		x.hits.Add(1)
+		return l
+	}
+	x.misses.Add(1)
+	return nil
+}
+
+// Len returns the number of containers indexed.
+func (x *podIndex) Len() int {
+	return len(*x.byCgroup.Load())
+}
+
+// run lists the pods on the node and follows them with a watch until ctx
+// is done, listing again whenever the watch cannot resume.
+func (x *podIndex) run(ctx context.Context) {
+	backoff := time.Second
+	for ctx.Err() == nil {
+		rv, err := x.list(ctx)
+		if err == nil {
+			log.Printf("Pod index: %d containers of pods on %s", x.Len(), x.node)
+			backoff = time.Second
+			err = x.watch(ctx, rv)
+		}
+		if ctx.Err() != nil {
+			return
+		}
+		log.Printf("Pod index: %v, listing again in %s", err, backoff)
+		select {
+		case <-ctx.Done():
+			return
+		case <-time.After(backoff):
+		}
+		backoff = min(2*backoff, 30*time.Second)
+	}
+}
+
+// kubePod is the part of a Pod that attribution needs
+type kubePod struct {
+	Metadata struct {
+		Name            string `json:"name"`
+		Namespace       string `json:"namespace"`
+		UID             string `json:"uid"`
+		ResourceVersion string `json:"resourceVersion"`
+	} `json:"metadata"`
+	Status struct {
+		InitContainerStatuses      []kubeContainerStatus `json:"initContainerStatuses"`
+		ContainerStatuses          []kubeContainerStatus `json:"containerStatuses"`
+		EphemeralContainerStatuses []kubeContainerStatus `json:"ephemeralContainerStatuses"`
+	} `json:"status"`
+}
+
+type kubeContainerStatus struct {
+	Name        string `json:"name"`
+	ContainerID string `json:"containerID"` // <runtime>://<id>, empty until started
+	State       struct {
+		Running *struct{} `json:"running"`
+	} `json:"state"`
+}
+
+// kubeWatchEvent is one line of a watch stream
+type kubeWatchEvent struct {
+	Type   string          `json:"type"` // ADDED, MODIFIED, DELETED, BOOKMARK or ERROR
+	Object json.RawMessage `json:"object"`
+}
+
+// nodeQuery selects the pods scheduled on this node
+func (x *podIndex) nodeQuery() url.Values {
+	return url.Values{"fieldSelector": {"spec.nodeName=" + x.node}}
+}
+
+// list replaces the index with the pods on the node and returns the
+// resourceVersion to watch from.
+func (x *podIndex) list(ctx context.Context) (string, error) {
+	resp, err := x.client.get(ctx, "/api/v1/pods", x.nodeQuery())
+	if err != nil {
+		return "", fmt.Errorf("failed to list pods: %w", err)
+	}
+	defer resp.Body.Close()
+	var podList struct {
+		Metadata struct {
+			ResourceVersion string `json:"resourceVersion"`
+		} `json:"metadata"`
+		Items []kubePod `json:"items"`
+	}
+	if err := json.NewDecoder(resp.Body).Decode(&podList); err != nil {
+		return "", fmt.Errorf("failed to decode pod list: %w", err)
+	}
+
+	x.labels = make(map[uint64]*podLabels)
+	x.pods = make(map[string][]uint64)
+	x.pending = make(map[string]*pendingPod)
+	x.rescan()
+	for i := range podList.Items {
+		x.update(&podList.Items[i])
+	}
+	x.publish()
+	return podList.Metadata.ResourceVersion, nil
+}
+
+// watch applies pod changes from resourceVersion rv on, resuming after
+// each server-side timeout, until the watch expires or fails.
+func (x *podIndex) watch(ctx context.Context, rv string) error {
+	for {
+		q := x.nodeQuery()
+		q.Set("watch", "true")
+		q.Set("allowWatchBookmarks", "true")
+		q.Set("resourceVersion", rv)
+		resp, err := x.client.get(ctx, "/api/v1/pods", q)
+		if err != nil {
+			return fmt.Errorf("failed to watch pods: %w", err)
+		}
+		rv, err = x.follow(resp.Body, rv)
+		resp.Body.Close()
+		if err != nil {
+			return err
+		}
+	}
+}
+
+// follow applies the events of one watch stream and returns the last
+// resourceVersion seen. Between events it retries the pending pods once a
+// second.
+func (x *podIndex) follow(body io.Reader, rv string) (string, error) {
+	events := make(chan kubeWatchEvent)
+	errc := make(chan error, 1)
+	done := make(chan struct{})
+	defer close(done)
+	go func() {
+		dec := json.NewDecoder(body)
+		for {
+			var ev kubeWatchEvent
+			if err := dec.Decode(&ev); err != nil {
+				errc <- err
+				return
+			}
+			select {
+			case events <- ev:
+			case <-done:
+				return
+			}
+		}
+	}()
+
+	ticker := time.NewTicker(time.Second)
+	defer ticker.Stop()
+	for {
+		var ev kubeWatchEvent
+		select {
+		case err := <-errc:
+			if errors.Is(err, io.EOF) {
+				return rv, nil
+			}
+			return rv, fmt.Errorf("pod watch stream: %w", err)
+		case now := <-ticker.C:
+			x.resolvePending(now)
+			continue
+		case ev = <-events:
+		}
+		if ev.Type == "ERROR" {
+			// Usually 410 Gone: rv is too old to resume from
+			return rv, fmt.Errorf("pod watch failed: %s", ev.Object)
+		}
+		var pod kubePod
+		if err := json.Unmarshal(ev.Object, &pod); err != nil {
+			return rv, fmt.Errorf("failed to decode pod: %w", err)
+		}
+		rv = pod.Metadata.ResourceVersion
+		switch ev.Type {
+		case "ADDED", "MODIFIED":
+			x.update(&pod)
+		case "DELETED":
+			x.remove(pod.Metadata.UID)
+		default:
+			continue
+		}
+		x.publish()
+	}
+}
+
+// update indexes the started containers of pod. A pod with running
+// containers whose cgroup was not found is kept pending for resolvePending.
+func (x *podIndex) update(pod *kubePod) {
+	var ids []uint64
+	unresolved := false
+	for _, statuses := range [][]kubeContainerStatus{
+		pod.Status.InitContainerStatuses, pod.Status.ContainerStatuses, pod.Status.EphemeralContainerStatuses,
+	} {
+		for _, st := range statuses {
+			id, ok := x.cgroupOf(st.ContainerID)
+			if !ok {
+				unresolved = unresolved || (st.ContainerID != "" && st.State.Running != nil)
+				continue
+			}
+			ids = append(ids, id)
+			l := x.labels[id]
+			if l == nil || l.Pod != pod.Metadata.Name || l.Namespace != pod.Metadata.Namespace || l.Container != st.Name {
+				x.labels[id] = &podLabels{Pod: pod.Metadata.Name, Namespace: pod.Metadata.Namespace, Container: st.Name}
+			}
+		}
+	}
+	for _, old := range x.pods[pod.Metadata.UID] {
+		if !contains(ids, old) {
+			delete(x.labels, old)
+		}
+	}
+	x.setPending(pod, unresolved)
+	if len(ids) == 0 {
+		delete(x.pods, pod.Metadata.UID)
+		return
+	}
+	x.pods[pod.Metadata.UID] = ids
+}
+
+func (x *podIndex) remove(uid string) {
+	for _, id := range x.pods[uid] {
+		delete(x.labels, id)
+	}
+	delete(x.pods, uid)
+	delete(x.pending, uid)
+}
+
+// setPending keeps pod pending while it has unresolved running containers,
+// giving up after podPendingTimeout.
+func (x *podIndex) setPending(pod *kubePod, unresolved bool) {
+	uid := pod.Metadata.UID
+	p := x.pending[uid]
+	switch {
+	case !unresolved:
+		delete(x.pending, uid)
+	case p == nil:
+		x.pending[uid] = &pendingPod{pod: pod, since: time.Now()}
+	case time.Since(p.since) >= podPendingTimeout:
+		log.Printf("Pod index: containers of %s/%s not found under %s after %s",
+			pod.Metadata.Namespace, pod.Metadata.Name, CgroupRoot, podPendingTimeout)
+		delete(x.pending, uid)
+	default:
+		p.pod = pod
+	}
+}
+
+// resolvePending rescans cgroupfs, at most once a second, and indexes the
+// pending pods again, publishing the result.
+func (x *podIndex) resolvePending(now time.Time) {
+	if len(x.pending) == 0 || now.Sub(x.scanned) < time.Second {
+		return
+	}
+	x.rescan()
+	for _, p := range x.pending {
+		x.update(p.pod)
+	}
+	x.publish()
+}
+
+func contains(ids []uint64, id uint64) bool {
+	for _, v := range ids {
+		if v == id {
+			return true
+		}
+	}
+	return false
+}
+
+// publish makes the current labels visible to Lookup.
+func (x *podIndex) publish() {
+	m := maps.Clone(x.labels)
+	x.byCgroup.Store(&m)
+}
+
+// cgroupOf returns the cgroup ID of a container, scanning cgroupfs again
+// (at most once a second) for containers started since the last scan.
+func (x *podIndex) cgroupOf(containerID string) (uint64, bool) {
+	_, id, ok := strings.Cut(containerID, "://")
+	if !ok || id == "" {
+		return 0, false
+	}
+	if cg, ok := x.cgroups[id]; ok {
+		return cg, true
+	}
+	if time.Since(x.scanned) < time.Second {
+		return 0, false
+	}
+	x.rescan()
+	cg, ok := x.cgroups[id]
+	return cg, ok
+}
+
+// rescan maps container IDs to cgroup IDs by walking CgroupRoot. Container
+// cgroups are named after the 64-hex-digit container ID, e.g.
+// cri-containerd-<id>.scope (systemd driver) or <id> (cgroupfs driver); the
+// inode number of a cgroup v2 directory is its cgroup ID.
+func (x *podIndex) rescan() {
+	x.scanned = time.Now()
+	cgroups := make(map[string]uint64, len(x.cgroups))
+	root := filepath.Clean(CgroupRoot)
+	err := filepath.WalkDir(root, func(path string, d fs.DirEntry, err error) error {
+		if err != nil || !d.IsDir() {
+			return nil
+		}
+		if strings.Count(path[len(root):], string(filepath.Separator)) > maxCgroupDepth {
+			return filepath.SkipDir
+		}
+		id := containerIDIn(d.Name())
+		if id == "" {
+			return nil
+		}
+		info, err := d.Info()
+		if err != nil {
+			return nil
+		}
+		if st, ok := info.Sys().(*syscall.Stat_t); ok {
+			cgroups[id] = st.Ino
+		}
+		return filepath.SkipDir // Nothing to attribute below a container
+	})
+	if err != nil {
+		log.Printf("Pod index: failed to scan %s: %v", root, err)
+		return
+	}
+	x.cgroups = cgroups
+}
+
+// containerIDIn returns the 64-hex-digit run in a cgroup directory name.
+func containerIDIn(name string) string {
+	run := 0
+	for i := 0; i < len(name); i++ {
+		if !isHexDigit(name[i]) {
+			run = 0
+			continue
+		}
+		run++
+		if run == 64 && (i+1 == len(name) || !isHexDigit(name[i+1])) {
+			return name[i-63 : i+1]
+		}
+	}
+	return ""
+}
+
+func isHexDigit(c byte) bool {
+	return c >= '0' && c <= '9' || c >= 'a' && c <= 'f'
+}
+
+// kubeClient is a minimal in-cluster API client, enough for list and watch.
+type kubeClient struct {
+	base string
+	http *http.Client
+}
+
+func newInClusterClient() (*kubeClient, error) {
+	host, port := os.Getenv("KUBERNETES_SERVICE_HOST"), os.Getenv("KUBERNETES_SERVICE_PORT")
+	if host == "" || port == "" {
+		return nil, fmt.Errorf("not running in Kubernetes (KUBERNETES_SERVICE_HOST is unset)")
+	}
+	ca, err := os.ReadFile(filepath.Join(serviceAccountDir, "ca.crt"))
+	if err != nil {
+		return nil, fmt.Errorf("failed to read service account CA: %w", err)
+	}
+	pool := x509.NewCertPool()
+	if !pool.AppendCertsFromPEM(ca) {
+		return nil, fmt.Errorf("no certificates in service account CA")
+	}
+	return &kubeClient{
+		base: "https://" + net.JoinHostPort(host, port),
+		http: &http.Client{Transport: &http.Transport{
+			TLSClientConfig: &tls.Config{RootCAs: pool},
+		}},
+	}, nil
+}
+
+// get issues an authenticated GET. The token is read for every request,
+// since projected service account tokens are rotated.
+func (c *kubeClient) get(ctx context.Context, path string, query url.Values) (*http.Response, error) {
+	token, err := os.ReadFile(filepath.Join(serviceAccountDir, "token"))
+	if err != nil {
+		return nil, fmt.Errorf("failed to read service account token: %w", err)
+	}
+	req, err := http.NewRequestWithContext(ctx, http.MethodGet, c.base+path+"?"+query.Encode(), nil)
+	if err != nil {
+		return nil, err
+	}
+	req.Header.Set("Authorization", "Bearer "+strings.TrimSpace(string(token)))
+	req.Header.Set("Accept", "application/json")
+	resp, err := c.http.Do(req)
+	if err != nil {
+		return nil, err
+	}
+	if resp.StatusCode != http.StatusOK {
+		msg, _ := io.ReadAll(io.LimitReader(resp.Body, 512))
+		resp.Body.Close()
+		return nil, fmt.Errorf("%s: %s", resp.Status, strings.TrimSpace(string(msg)))
+	}
+	return resp, nil
+}
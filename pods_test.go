@@ -0,0 +1,108 @@
+package main
+
+import (
+	"os"
+	"path/filepath"
+	"strings"
+	"syscall"
+	"testing"
+	"time"
+)
+
+// testPod is a pod on the node with one container per ID, all running.
+func testPod(uid string, containerIDs ...string) *kubePod {
+	pod := &kubePod{}
+	pod.Metadata.Name, pod.Metadata.Namespace, pod.Metadata.UID = "rpc-"+uid, "default", uid
+	for i, id := range containerIDs {
+		st := kubeContainerStatus{Name: "c" + string(rune('0'+i)), ContainerID: "containerd://" + id}
+		st.State.Running = &struct{}{}
+		pod.Status.ContainerStatuses = append(pod.Status.ContainerStatuses, st)
+	}
+	return pod
+}
+
+// startContainer creates the cgroup of a container and returns its cgroup ID.
+func startContainer(t *testing.T, id string) uint64 {
+	t.Helper()
+	dir := filepath.Join(CgroupRoot, "kubepods.slice", "cri-containerd-"+id+".scope")
+	if err := os.MkdirAll(dir, 0o755); err != nil {
+		t.Fatal(err)
+	}
+	info, err := os.Stat(dir)
+	if err != nil {
+		t.Fatal(err)
+	}
+	return info.Sys().(*syscall.Stat_t).Ino
+}
+
+func testPodIndex(t *testing.T) *podIndex {
+	t.Helper()
+	old := CgroupRoot
+	CgroupRoot = t.TempDir()
+	t.Cleanup(func() { CgroupRoot = old })
+	x := &podIndex{
+		labels:  make(map[uint64]*podLabels),
+		pods:    make(map[string][]uint64),
+		pending: make(map[string]*pendingPod),
+		cgroups: make(map[string]uint64),
+	}
+	x.byCgroup.Store(&map[uint64]*podLabels{})
+	return x
+}
+
+// TestPodIndexPending checks that a container started right after a scan,
+// as sidecars are, is attributed on the next rescan without another event.
+func TestPodIndexPending(t *testing.T) {
+	x := testPodIndex(t)
+	app, sidecar := strings.Repeat("a", 64), strings.Repeat("b", 64)
+	appCg := startContainer(t, app)
+
+	x.update(testPod("p1", app)) // Scans: only app exists
+	sidecarCg := startContainer(t, sidecar)
+	x.update(testPod("p1", app, sidecar)) // Within a second: no rescan
+	x.publish()
+	if x.Lookup(appCg) == nil || x.Lookup(sidecarCg) != nil {
+		t.Fatalf("before the rescan: app %v, sidecar %v; want only app", x.Lookup(appCg), x.Lookup(sidecarCg))
+	}
+	if x.pending["p1"] == nil {
+		t.Fatal("pod with an unresolved running container is not pending")
+	}
+
+	x.resolvePending(x.scanned.Add(500 * time.Millisecond)) // Too soon
+	if x.Lookup(sidecarCg) != nil {
+		t.Fatal("rescanned within a second of the last scan")
+	}
+	x.resolvePending(x.scanned.Add(time.Second))
+	if l := x.Lookup(sidecarCg); l == nil || l.Pod != "rpc-p1" || l.Container != "c1" {
+		t.Errorf("sidecar = %+v after the rescan, want rpc-p1/c1", l)
+	}
+	if len(x.pending) != 0 {
+		t.Errorf("%d pods still pending after all containers resolved", len(x.pending))
+	}
+}
+
+func TestPodIndexPendingSkipsStopped(t *testing.T) {
+	x := testPodIndex(t)
+	pod := testPod("p1", strings.Repeat("c", 64))
+	pod.Status.ContainerStatuses[0].State.Running = nil // Terminated, cgroup gone
+	x.update(pod)
+	if len(x.pending) != 0 {
+		t.Error("pod whose only container is not running is pending")
+	}
+}
+
+func TestPodIndexPendingTimeout(t *testing.T) {
+	x := testPodIndex(t)
+	x.update(testPod("p1", strings.Repeat("d", 64)))
+	x.pending["p1"].since = time.Now().Add(-podPendingTimeout)
+	x.resolvePending(x.scanned.Add(time.Second))
+	if len(x.pending) != 0 {
+		t.Error("pod still pending after podPendingTimeout")
+	}
+
+	x.update(testPod("p2", strings.Repeat("e", 64)))
+	x.remove("p2")
+	if len(x.pending) != 0 {
+		t.Error("deleted pod still pending")
+	}
+}
@@ -0,0 +1,269 @@
+package main
+
+import (
+	"errors"
+	"fmt"
+	"log"
+	"sync/atomic"
+	"time"
+
+	"github.com/nats-io/nats.go"
+)
+
+// Publishing configuration - can be overridden by environment variables
+var (
+	PublishEncoding    = getEnv("PUBLISH_ENCODING", EncodingJSON)
+	PublishQueueSize   = getEnvInt("PUBLISH_QUEUE_SIZE", 8192)
+	PublishBatchSize   = getEnvInt("PUBLISH_BATCH_SIZE", 1) // 1 = one feature per message
+	PublishBatchWindow = getEnvDuration("PUBLISH_BATCH_WINDOW", 100*time.Millisecond)
+)
+
+// Feature encodings
+const (
+	EncodingJSON    = "json"
+	EncodingMsgpack = "msgpack"
+)
+
+// errPublisherClosed is returned by Publish after the publisher has stopped.
+var errPublisherClosed = errors.New("publisher closed")
+
+// publisher decouples NATS publishing from event processing. Features are
+// queued on a bounded channel and a single goroutine encodes and publishes
+// them, optionally batching per subject. With a batch size above 1 each
+// message carries an array of features (JSON array or msgpack array);
+// msgpack messages carry a Content-Type header. With a spool, messages
+// that cannot reach NATS are written to disk and replayed later.
+type publisher struct {
+	nc        *nats.Conn
+	spool     *spool // nil without SPOOL_DIR
+	queue     chan MonitoringFeature
+	encoding  string
+	batchSize int
+	window    time.Duration
+
+	batches map[string][]MonitoringFeature // Pending features per subject
+	enc     fieldEncoder                   // Encoder scratch, reused per message
+
+	stop      chan struct{}
+	closed    atomic.Bool
+	dropped   atomic.Uint64 // Features dropped because the queue was full
+	published atomic.Uint64 // Messages published
+	done      chan struct{}
+}
+
+// newPublisher validates the publishing configuration. nc is nil when
+// capturing to the spool.
+func newPublisher(nc *nats.Conn, sp *spool) (*publisher, error) {
+	if PublishEncoding != EncodingJSON && PublishEncoding != EncodingMsgpack {
+		return nil, fmt.Errorf("unknown PUBLISH_ENCODING %q (want json or msgpack)", PublishEncoding)
+	}
+	if PublishQueueSize < 1 || PublishBatchSize < 1 {
+		return nil, fmt.Errorf("PUBLISH_QUEUE_SIZE and PUBLISH_BATCH_SIZE must be positive")
+	}
+	return &publisher{
+		nc:        nc,
+		spool:     sp,
+		queue:     make(chan MonitoringFeature, PublishQueueSize),
+		encoding:  PublishEncoding,
+		batchSize: PublishBatchSize,
+		window:    PublishBatchWindow,
+		batches:   make(map[string][]MonitoringFeature),
+		enc:       fieldEncoder{msgpack: PublishEncoding == EncodingMsgpack},
+		stop:      make(chan struct{}),
+		done:      make(chan struct{}),
+	}, nil
+}
+
+// Publish queues a feature without blocking. When the queue is full the
+// feature is dropped and counted.
+func (p *publisher) Publish(feature MonitoringFeature) error {
+	if p.closed.Load() {
+		releaseFeature(&feature)
+		return errPublisherClosed
+	}
+	select {
+	case p.queue <- feature:
+	default:
+		releaseFeature(&feature)
+		p.dropped.Add(1)
+	}
+	return nil
+}
+
+// run drains the queue until Close, then flushes what is left.
+func (p *publisher) run() {
+	defer close(p.done)
+	if p.spool != nil && p.nc != nil {
+		replayed := make(chan struct{})
+		go func() {
+			defer close(replayed)
+			p.replaySpool()
+		}()
+		defer func() { <-replayed }()
+	}
+
+	var flushC <-chan time.Time
+	if p.batchSize > 1 {
+		ticker := time.NewTicker(p.window)
+		defer ticker.Stop()
+		flushC = ticker.C
+	}
+	report := time.NewTicker(10 * time.Second)
+	defer report.Stop()
+	var lastDropped uint64
+
+	for {
+		select {
+		case feature := <-p.queue:
+			p.add(feature)
+		case <-flushC:
+			p.flushAll()
+		case <-report.C:
+			if dropped := p.dropped.Load(); dropped != lastDropped {
+				log.Printf("Warning: publish queue full, dropped %d features", dropped-lastDropped)
+				lastDropped = dropped
+			}
+		case <-p.stop:
+			for {
+				select {
+				case feature := <-p.queue:
+					p.add(feature)
+					continue
+				default:
+				}
+				break
+			}
+			p.flushAll()
+			if p.nc == nil {
+				return
+			}
+			if err := p.nc.Flush(); err != nil {
+				log.Printf("Failed to flush NATS connection: %v", err)
+			}
+			return
+		}
+	}
+}
+
+// Close stops accepting features and waits for run to flush and exit.
+// Producers must have stopped publishing before Close is called.
+func (p *publisher) Close() {
+	if p.closed.Swap(true) {
+		return
+	}
+	close(p.stop)
+	<-p.done
+	if p.spool != nil {
+		p.spool.Close()
+	}
+}
+
+// add appends a feature to its subject's batch, sending full batches.
+func (p *publisher) add(feature MonitoringFeature) {
+	subject := feature.ContextHash // Full subject path
+	if p.batchSize == 1 {
+		p.send(subject, []MonitoringFeature{feature}, false)
+		return
+	}
+
+	batch := append(p.batches[subject], feature)
+	if len(batch) >= p.batchSize {
+		p.send(subject, batch, true)
+		batch = batch[:0]
+	}
+	p.batches[subject] = batch
+}
+
+// flushAll sends every non-empty batch.
+func (p *publisher) flushAll() {
+	for subject, batch := range p.batches {
+		if len(batch) == 0 {
+			continue
+		}
+		p.send(subject, batch, true)
+		p.batches[subject] = batch[:0]
+	}
+}
+
+// releaseFeature returns a feature's pooled details.
+func releaseFeature(f *MonitoringFeature) {
+	if f.Details != nil {
+		f.Details.release()
+		f.Details = nil
+	}
+}
+
+// send encodes features into one message, releases them and publishes it.
+func (p *publisher) send(subject string, features []MonitoringFeature, asArray bool) {
+	start := time.Now()
+	defer func() { metrics.publish.observe(time.Since(start)) }()
+
+	data := p.encode(features, asArray)
+	for i := range features {
+		releaseFeature(&features[i])
+	}
+
+	kind := spoolJSON
+	if p.encoding == EncodingMsgpack {
+		kind = spoolMsgpack
+	}
+	if err := p.deliver(subject, kind, data); err != nil {
+		log.Printf("Failed to publish to subject %s: %v", subject, err)
+		return
+	}
+
+	if DebugMode {
+		log.Printf("DEBUG: Published to NATS [%s]: %d features, %d bytes", subject, len(features), len(data))
+	}
+}
+
+// deliver publishes a message, or spools it when NATS is unreachable or
+// rejects it.
+func (p *publisher) deliver(subject string, kind byte, data []byte) error {
+	if p.spool != nil && (p.nc == nil || !p.nc.IsConnected()) {
+		return p.spool.append(subject, kind, data)
+	}
+	err := p.publishNATS(subject, kind, data)
+	if err != nil && p.spool != nil {
+		return p.spool.append(subject, kind, data)
+	}
+	if err == nil {
+		p.published.Add(1)
+	}
+	return err
+}
+
+// publishNATS publishes one message, with a Content-Type header for msgpack.
+func (p *publisher) publishNATS(subject string, kind byte, data []byte) error {
+	if kind == spoolMsgpack {
+		msg := &nats.Msg{Subject: subject, Data: data, Header: nats.Header{}}
+		msg.Header.Set("Content-Type", "application/msgpack")
+		return p.nc.PublishMsg(msg)
+	}
+	return p.nc.Publish(subject, data)
+}
+
+// encode serializes features into the encoder's buffer. The NATS client
+// copies the data into its own buffer on publish, so the buffer is reused
+// for the next message.
+func (p *publisher) encode(features []MonitoringFeature, asArray bool) []byte {
+	e := &p.enc
+	e.b = e.b[:0]
+	if asArray {
+		if e.msgpack {
+			e.b = appendMsgpackArrayHeader(e.b, len(features))
+		} else {
+			e.b = append(e.b, '[')
+		}
+	}
+	for i := range features {
+		if i > 0 && !e.msgpack {
+			e.b = append(e.b, ',')
+		}
+		e.Feature(&features[i])
+	}
+	if asArray && !e.msgpack {
+		e.b = append(e.b, ']')
+	}
+	return e.b
+}
@@ -0,0 +1,722 @@
+package main
+
+import (
+	"bytes"
+	"container/list"
+	"encoding/binary"
+	"time"
+)
+
+// Reassembly configuration - can be overridden by environment variables.
+// Reassembly applies to CAPTURE_MODE=events with payload capture enabled.
+var (
+	Reassembly            = getEnv("REASSEMBLY", "false") == "true"
+	ReassemblyBufferBytes = getEnvInt("REASSEMBLY_BUFFER_BYTES", 4096) // Per request, bytes searched for the method
+	ReassemblyConns       = getEnvInt("REASSEMBLY_CONNECTIONS", 16384) // Connections tracked, across all workers
+	ReassemblyIdle        = getEnvDuration("REASSEMBLY_IDLE_TIMEOUT", 30*time.Second)
+)
+
+const (
+	// maxHeldSends bounds the sends of one request delayed until its method is known
+	maxHeldSends = 16
+	// reassemblyHoldTimeout releases held sends of a connection gone quiet
+	reassemblyHoldTimeout = time.Second
+	// maxHTTP2Streams bounds the streams tracked per HTTP/2 connection
+	maxHTTP2Streams = 32
+	// maxFreeBuffers bounds the search buffers kept for reuse per worker
+	maxFreeBuffers = 64
+)
+
+// reassemblyEnabled reports whether sends are reassembled per connection,
+// which also makes the kernel ship the payload of sends with no method field
+// on sockets it has seen speaking HTTP (http_socks).
+func reassemblyEnabled() bool {
+	return Reassembly && CaptureMode == CaptureEvents && PayloadCapture > 0
+}
+
+// HTTP/2 frame types and flags used by the reassembler
+const (
+	h2Data      = 0x0
+	h2Headers   = 0x1
+	h2EndStream = 0x1
+	h2Padded    = 0x8
+)
+
+var (
+	http2Preface = []byte("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n")
+	headersEnd   = []byte("\r\n\r\n")
+
+	httpRequestMethods = [][]byte{
+		[]byte("POST "), []byte("GET "), []byte("PUT "), []byte("PATCH "),
+		[]byte("DELETE "), []byte("HEAD "), []byte("OPTIONS "),
+	}
+)
+
+// connKey identifies a connection: a socket within its process
+type connKey struct {
+	tgid uint32
+	sock uint32
+}
+
+// framing is where a connection's send stream is
+type framing uint8
+
+const (
+	frameStart   framing = iota // At a request boundary
+	frameHeaders                // In an HTTP/1.x header block
+	frameBody                   // In a Content-Length body
+	frameChunked                // In a chunked body
+	frameHTTP2                  // In HTTP/2 frames, after the preface
+	frameLost                   // Unknown until a send starts a new request
+)
+
+// chunked body parser states
+const (
+	chunkSize    = iota // In a chunk-size line
+	chunkData           // In chunk data
+	chunkDataEnd        // In the CRLF after chunk data
+	chunkTrailer        // After the last chunk, until the empty line
+)
+
+// rpcMessage is a request whose method is being looked for: an HTTP/1.x
+// request or an HTTP/2 stream.
+type rpcMessage struct {
+	buf       []byte // Header block, then the body up to the method
+	method    uint16
+	searching bool       // Method neither found nor given up on
+	held      []RPCEvent // Sends waiting for the method, without payload
+}
+
+// connState is the framing state of one connection's sends.
+type connState struct {
+	key      connKey
+	frame    framing
+	cur      *rpcMessage // HTTP/1.x request; after frameLost, the last one seen
+	bodyLeft int64       // frameBody: body bytes left; frameChunked: chunk size or data left
+	chunk    uint8       // frameChunked state
+	digits   int         // chunkSize: hex digits seen, -1 in an extension; chunkDataEnd/chunkTrailer: line bytes seen
+
+	streams  map[uint32]*rpcMessage // HTTP/2 streams by ID
+	h2hdr    [9]byte                // Frame header being read
+	h2hdrLen int                    // 9 once inside the frame payload
+	h2left   int                    // Payload bytes left in the frame
+	h2type   byte
+	h2flags  byte
+	h2sid    uint32
+	h2pad    int // Padding at the end of a DATA frame; -1 until the pad length is read
+
+	owner    *rpcMessage // First request touched by the send being parsed
+	lastSeen time.Time
+	elem     *list.Element
+}
+
+// reassembler follows the HTTP/1.x and HTTP/2 framing of each connection's
+// sends so a send that carries no method field (headers sent ahead of the
+// body, the tail of a large body) is attributed to the request it belongs
+// to. Only a request's header block and its body up to the method are
+// buffered, at most limit bytes; sends of a request are held until its
+// method is found or given up on. It is owned by one pipeline worker: the
+// shard key keeps every send of a connection on the same worker.
+type reassembler struct {
+	conns    map[connKey]*connState
+	lru      *list.List // Front = most recently used
+	capacity int
+	limit    int
+	idle     time.Duration
+	free     [][]byte
+	emit     func(*RPCEvent)
+}
+
+func newReassembler(capacity, limit int, idle time.Duration, emit func(*RPCEvent)) *reassembler {
+	if capacity < 1 {
+		capacity = 1
+	}
+	if limit < len(httpRequestMethods[0]) {
+		limit = len(httpRequestMethods[0])
+	}
+	return &reassembler{
+		conns:    make(map[connKey]*connState),
+		lru:      list.New(),
+		capacity: capacity,
+		limit:    limit,
+		idle:     idle,
+		emit:     emit,
+	}
+}
+
+// feed processes one send record. It is emitted, with the method of its
+// request, as soon as that method is known; until then it is held.
+func (r *reassembler) feed(ev *RPCEvent, now time.Time) {
+	c := r.conn(connKey{tgid: uint32(ev.PID), sock: ev.SockID}, now)
+	c.owner = nil
+
+	if len(ev.Data) == 0 {
+		// Classified in kernel, so its bytes were not shipped
+		r.opaque(c, ev)
+		r.emit(ev)
+		return
+	}
+
+	r.consume(c, ev.Data)
+	if skip := int64(ev.DataLen) - int64(len(ev.Data)); skip > 0 {
+		r.skip(c, skip)
+	}
+
+	switch m := c.owner; {
+	case m == nil:
+		r.emit(ev) // Not HTTP; left to the payload extractor
+	case m.searching:
+		r.hold(m, ev)
+	default:
+		ev.MethodID = m.method
+		r.emit(ev)
+	}
+}
+
+// conn returns the state for key, evicting the least recently used
+// connection when full.
+func (r *reassembler) conn(key connKey, now time.Time) *connState {
+	if c, ok := r.conns[key]; ok {
+		r.lru.MoveToFront(c.elem)
+		c.lastSeen = now
+		return c
+	}
+	if r.lru.Len() >= r.capacity {
+		r.evict(r.lru.Back().Value.(*connState))
+	}
+	c := &connState{key: key, lastSeen: now}
+	c.elem = r.lru.PushFront(c)
+	r.conns[key] = c
+	return c
+}
+
+// evict drops c, releasing its held sends.
+func (r *reassembler) evict(c *connState) {
+	r.lose(c)
+	r.lru.Remove(c.elem)
+	delete(r.conns, c.key)
+}
+
+// sweep evicts connections idle longer than the idle timeout and releases
+// the held sends of connections that went quiet mid-request.
+func (r *reassembler) sweep(now time.Time) {
+	for el := r.lru.Back(); el != nil; {
+		c := el.Value.(*connState)
+		el = el.Prev()
+
+		idle := now.Sub(c.lastSeen)
+		if idle < reassemblyHoldTimeout {
+			return // The rest are more recent
+		}
+		if idle >= r.idle {
+			r.evict(c)
+			continue
+		}
+		if c.cur != nil && len(c.cur.held) > 0 {
+			r.decide(c.cur, methodUnknown)
+		}
+		for _, m := range c.streams {
+			if len(m.held) > 0 {
+				r.decide(m, methodUnknown)
+			}
+		}
+	}
+}
+
+// flush releases everything held, on shutdown.
+func (r *reassembler) flush() {
+	for r.lru.Len() > 0 {
+		r.evict(r.lru.Back().Value.(*connState))
+	}
+}
+
+// opaque accounts for a send whose bytes were not shipped because the
+// kernel found its method.
+func (r *reassembler) opaque(c *connState, ev *RPCEvent) {
+	n := int64(ev.DataLen)
+	if c.frame == frameBody && n <= c.bodyLeft {
+		// The body of the request whose headers came first
+		c.bodyLeft -= n
+		if c.cur.searching {
+			r.decide(c.cur, ev.MethodID)
+		}
+		if c.bodyLeft == 0 {
+			r.finish(c)
+		}
+		return
+	}
+
+	// A whole request, or bytes the framing cannot place. Later sends
+	// without a request line are taken as its continuation.
+	if c.cur != nil && c.cur.searching {
+		r.decide(c.cur, ev.MethodID)
+	}
+	r.lose(c)
+	if ev.MethodID != methodUnknown {
+		c.cur = &rpcMessage{method: ev.MethodID}
+	}
+}
+
+// consume parses the captured bytes of a send.
+func (r *reassembler) consume(c *connState, data []byte) {
+	// A request line always starts a new request. This also resyncs after
+	// sends the agent never saw (sampled out, or lost in transport).
+	if c.frame != frameStart && c.frame != frameHeaders && c.frame != frameHTTP2 && isRequestStart(data) {
+		r.finish(c)
+	}
+
+	for len(data) > 0 {
+		switch c.frame {
+		case frameStart:
+			if bytes.HasPrefix(data, http2Preface) {
+				c.frame = frameHTTP2
+				c.streams = make(map[uint32]*rpcMessage)
+				data = data[len(http2Preface):]
+				continue
+			}
+			if !isRequestStart(data) {
+				r.lose(c)
+				return
+			}
+			c.cur = &rpcMessage{searching: true}
+			c.frame = frameHeaders
+		case frameHeaders:
+			data = r.headers(c, data)
+		case frameBody:
+			r.own(c, c.cur)
+			n := len(data)
+			if int64(n) > c.bodyLeft {
+				n = int(c.bodyLeft)
+			}
+			r.appendBody(c.cur, data[:n])
+			c.bodyLeft -= int64(n)
+			data = data[n:]
+			if c.bodyLeft == 0 {
+				r.finish(c)
+			}
+		case frameChunked:
+			r.own(c, c.cur)
+			data = r.chunked(c, data)
+		case frameHTTP2:
+			data = r.http2(c, data)
+		case frameLost:
+			r.own(c, c.cur)
+			return
+		}
+	}
+}
+
+// skip accounts for n bytes of a send that were not captured. Body bytes
+// can be counted past, which ends the method search of their request;
+// anywhere else the framing is lost.
+func (r *reassembler) skip(c *connState, n int64) {
+	switch {
+	case c.frame == frameBody && n <= c.bodyLeft:
+		r.gap(c.cur)
+		c.bodyLeft -= n
+		if c.bodyLeft == 0 {
+			r.finish(c)
+		}
+	case c.frame == frameChunked && c.chunk == chunkData && n <= c.bodyLeft:
+		r.gap(c.cur)
+		c.bodyLeft -= n
+		if c.bodyLeft == 0 {
+			c.chunk, c.digits = chunkDataEnd, 0
+		}
+	case c.frame == frameHTTP2 && c.h2hdrLen == len(c.h2hdr) && n <= int64(c.h2left):
+		if c.h2type == h2Data {
+			r.gap(c.streams[c.h2sid])
+		}
+		c.h2left -= int(n)
+		if c.h2left == 0 {
+			r.h2end(c)
+		}
+	case c.frame != frameLost:
+		r.lose(c)
+	}
+}
+
+// own makes m the request of the send being parsed, unless it has one.
+func (r *reassembler) own(c *connState, m *rpcMessage) {
+	if c.owner == nil {
+		c.owner = m
+	}
+}
+
+// headers appends to the header block until the blank line ending it, then
+// sets up the body framing. Returns the bytes after the header block.
+func (r *reassembler) headers(c *connState, data []byte) []byte {
+	m := c.cur
+	r.own(c, m)
+	if m.buf == nil {
+		m.buf = r.getBuf()
+	}
+	start := len(m.buf)
+	n := len(data)
+	if room := r.limit - start; n > room {
+		n = room
+	}
+	m.buf = append(m.buf, data[:n]...)
+
+	from := start - (len(headersEnd) - 1)
+	if from < 0 {
+		from = 0
+	}
+	i := bytes.Index(m.buf[from:], headersEnd)
+	if i < 0 {
+		if len(m.buf) >= r.limit {
+			r.lose(c) // Header block too large to follow
+		}
+		return nil
+	}
+	end := from + i + len(headersEnd)
+	length, chunked, ok := parseFraming(m.buf[:end])
+	rest := data[end-start:]
+	m.buf = m.buf[:0]
+
+	switch {
+	case !ok:
+		r.lose(c)
+		return nil
+	case chunked:
+		c.frame, c.chunk, c.bodyLeft, c.digits = frameChunked, chunkSize, 0, 0
+	case length > 0:
+		c.frame, c.bodyLeft = frameBody, length
+	default:
+		r.finish(c) // No body
+	}
+	return rest
+}
+
+// chunked parses a chunked body. Returns the bytes after it.
+func (r *reassembler) chunked(c *connState, data []byte) []byte {
+	for len(data) > 0 {
+		switch c.chunk {
+		case chunkSize:
+			// Hex size, optional ;extensions, CRLF
+			line := data
+			nl := bytes.IndexByte(data, '\n')
+			if nl >= 0 {
+				line = data[:nl]
+			}
+			for _, b := range line {
+				if c.digits < 0 {
+					continue
+				}
+				if d := unhex(b); d >= 0 && c.digits < 15 {
+					c.bodyLeft = c.bodyLeft<<4 | int64(d)
+					c.digits++
+				} else if c.digits > 0 && (b == ';' || b == ' ' || b == '\t' || b == '\r') {
+					c.digits = -1
+				} else {
+					r.lose(c)
+					return nil
+				}
+			}
+			if nl < 0 {
+				return nil
+			}
+			data = data[nl+1:]
+			if c.digits == 0 {
+				r.lose(c)
+				return nil
+			}
+			if c.bodyLeft == 0 {
+				c.chunk, c.digits = chunkTrailer, 0
+			} else {
+				c.chunk = chunkData
+			}
+		case chunkData:
+			n := len(data)
+			if int64(n) > c.bodyLeft {
+				n = int(c.bodyLeft)
+			}
+			r.appendBody(c.cur, data[:n])
+			c.bodyLeft -= int64(n)
+			data = data[n:]
+			if c.bodyLeft == 0 {
+				c.chunk, c.digits = chunkDataEnd, 0
+			}
+		case chunkDataEnd:
+			n := 2 - c.digits
+			if n > len(data) {
+				n = len(data)
+			}
+			c.digits += n
+			data = data[n:]
+			if c.digits == 2 {
+				c.chunk, c.bodyLeft, c.digits = chunkSize, 0, 0
+			}
+		case chunkTrailer:
+			// Trailer fields, then an empty line
+			nl := bytes.IndexByte(data, '\n')
+			if nl < 0 {
+				c.digits += len(data)
+				return nil
+			}
+			lineLen := c.digits + nl
+			data = data[nl+1:]
+			c.digits = 0
+			if lineLen <= 1 {
+				r.finish(c)
+				return data
+			}
+		}
+	}
+	return nil
+}
+
+// http2 parses HTTP/2 frames. HEADERS frames open a stream; the payload of
+// its DATA frames is searched for the method. Header blocks are HPACK
+// compressed and skipped.
+func (r *reassembler) http2(c *connState, data []byte) []byte {
+	for len(data) > 0 {
+		if c.h2hdrLen < len(c.h2hdr) {
+			n := copy(c.h2hdr[c.h2hdrLen:], data)
+			c.h2hdrLen += n
+			data = data[n:]
+			if c.h2hdrLen < len(c.h2hdr) {
+				return nil
+			}
+			r.h2frame(c)
+			if c.h2left == 0 {
+				r.h2end(c)
+			}
+			continue
+		}
+
+		n := len(data)
+		if n > c.h2left {
+			n = c.h2left
+		}
+		if c.h2type == h2Data || c.h2type == h2Headers {
+			// A send may start mid-frame, after the header that set the owner
+			r.own(c, c.streams[c.h2sid])
+		}
+		if c.h2type == h2Data {
+			r.h2data(c, data[:n])
+		}
+		c.h2left -= n
+		data = data[n:]
+		if c.h2left == 0 {
+			r.h2end(c)
+		}
+	}
+	return nil
+}
+
+// h2frame starts the frame whose header was just read.
+func (r *reassembler) h2frame(c *connState) {
+	h := c.h2hdr[:]
+	c.h2left = int(h[0])<<16 | int(h[1])<<8 | int(h[2])
+	c.h2type, c.h2flags = h[3], h[4]
+	c.h2sid = binary.BigEndian.Uint32(h[5:]) &^ (1 << 31)
+	c.h2pad = 0
+
+	switch c.h2type {
+	case h2Headers:
+		m := c.streams[c.h2sid]
+		if m == nil && c.h2sid != 0 && len(c.streams) < maxHTTP2Streams {
+			m = &rpcMessage{searching: true}
+			c.streams[c.h2sid] = m
+		}
+		r.own(c, m)
+	case h2Data:
+		r.own(c, c.streams[c.h2sid])
+		if c.h2flags&h2Padded != 0 {
+			c.h2pad = -1
+		}
+	}
+}
+
+// h2data searches the DATA payload bytes p, less any padding.
+func (r *reassembler) h2data(c *connState, p []byte) {
+	m := c.streams[c.h2sid]
+	if m == nil {
+		return
+	}
+	left := c.h2left // Including p
+	if c.h2pad < 0 {
+		c.h2pad = int(p[0])
+		p, left = p[1:], left-1
+	}
+	if n := left - c.h2pad; n < len(p) {
+		if n < 0 {
+			n = 0
+		}
+		p = p[:n]
+	}
+	r.appendBody(m, p)
+}
+
+// h2end completes the current frame, closing its stream on END_STREAM.
+func (r *reassembler) h2end(c *connState) {
+	c.h2hdrLen = 0
+	if c.h2flags&h2EndStream == 0 || (c.h2type != h2Data && c.h2type != h2Headers) {
+		return
+	}
+	if m := c.streams[c.h2sid]; m != nil {
+		r.endMessage(m)
+		delete(c.streams, c.h2sid)
+	}
+}
+
+// finish ends the HTTP/1.x request in progress.
+func (r *reassembler) finish(c *connState) {
+	if c.cur != nil {
+		r.endMessage(c.cur)
+	}
+	c.cur = nil
+	c.frame = frameStart
+}
+
+// lose abandons the framing of c until a send starts a new request.
+func (r *reassembler) lose(c *connState) {
+	r.gap(c.cur)
+	for sid, m := range c.streams {
+		r.endMessage(m)
+		delete(c.streams, sid)
+	}
+	c.streams = nil
+	c.frame = frameLost
+	c.h2hdrLen, c.h2left = 0, 0
+}
+
+// gap ends the method search of m: bytes of it were not captured.
+func (r *reassembler) gap(m *rpcMessage) {
+	if m != nil && m.searching {
+		r.decide(m, methodUnknown)
+	}
+}
+
+func (r *reassembler) endMessage(m *rpcMessage) {
+	if m.searching {
+		r.decide(m, methodUnknown)
+	}
+}
+
+// appendBody adds body bytes of m to its search buffer and looks for the
+// method, giving up once the buffer is full.
+func (r *reassembler) appendBody(m *rpcMessage, p []byte) {
+	if m == nil || !m.searching || len(p) == 0 {
+		return
+	}
+	if m.buf == nil {
+		m.buf = r.getBuf()
+	}
+	if room := r.limit - len(m.buf); len(p) > room {
+		p = p[:room]
+	}
+	m.buf = append(m.buf, p...)
+
+	if name, _, ok := scanMethod(m.buf); ok {
+		r.decide(m, internMethod(name))
+	} else if len(m.buf) >= r.limit {
+		r.decide(m, methodUnknown)
+	}
+}
+
+// decide settles the method of m and emits the sends held for it.
+func (r *reassembler) decide(m *rpcMessage, id uint16) {
+	m.method = id
+	m.searching = false
+	r.putBuf(m.buf)
+	m.buf = nil
+	for i := range m.held {
+		m.held[i].MethodID = id
+		r.emit(&m.held[i])
+	}
+	m.held = nil
+}
+
+// hold delays ev until the method of m is known.
+func (r *reassembler) hold(m *rpcMessage, ev *RPCEvent) {
+	if len(m.held) >= maxHeldSends {
+		r.decide(m, methodUnknown)
+		r.emit(ev)
+		return
+	}
+	held := *ev
+	held.Data = nil
+	m.held = append(m.held, held)
+}
+
+func (r *reassembler) getBuf() []byte {
+	if n := len(r.free); n > 0 {
+		b := r.free[n-1]
+		r.free = r.free[:n-1]
+		return b
+	}
+	return make([]byte, 0, r.limit)
+}
+
+func (r *reassembler) putBuf(b []byte) {
+	if b != nil && len(r.free) < maxFreeBuffers {
+		r.free = append(r.free, b[:0])
+	}
+}
+
+// isRequestStart reports whether p begins with an HTTP/1.x request line.
+func isRequestStart(p []byte) bool {
+	for _, m := range httpRequestMethods {
+		if bytes.HasPrefix(p, m) {
+			return true
+		}
+	}
+	return false
+}
+
+var (
+	contentLengthHeader    = []byte("Content-Length")
+	transferEncodingHeader = []byte("Transfer-Encoding")
+	chunkedCoding          = []byte("chunked")
+)
+
+// parseFraming reads the body framing from an HTTP/1.x header block:
+// Transfer-Encoding: chunked, else Content-Length (0 if absent).
+func parseFraming(block []byte) (length int64, chunked, ok bool) {
+	for len(block) > 0 {
+		line := block
+		if i := bytes.IndexByte(block, '\n'); i >= 0 {
+			line, block = block[:i], block[i+1:]
+		} else {
+			block = nil
+		}
+		colon := bytes.IndexByte(line, ':')
+		if colon < 0 {
+			continue // Request line or the final empty line
+		}
+		name, value := line[:colon], bytes.TrimSpace(line[colon+1:])
+
+		switch {
+		case bytes.EqualFold(name, contentLengthHeader):
+			if len(value) == 0 || len(value) > 18 {
+				return 0, false, false
+			}
+			length = 0
+			for _, b := range value {
+				if b < '0' || b > '9' {
+					return 0, false, false
+				}
+				length = length*10 + int64(b-'0')
+			}
+		case bytes.EqualFold(name, transferEncodingHeader):
+			// chunked is always the last coding applied
+			n := len(chunkedCoding)
+			chunked = len(value) >= n && bytes.EqualFold(value[len(value)-n:], chunkedCoding)
+		}
+	}
+	return length, chunked, true
+}
+
+func unhex(b byte) int {
+	switch {
+	case b >= '0' && b <= '9':
+		return int(b - '0')
+	case b >= 'a' && b <= 'f':
+		return int(b-'a') + 10
+	case b >= 'A' && b <= 'F':
+		return int(b-'A') + 10
+	}
+	return -1
+}
@@ -0,0 +1,218 @@
+package main
+
+import (
+	"encoding/binary"
+	"fmt"
+	"strings"
+	"testing"
+	"time"
+)
+
+// testSend is one send of a connection, as the kernel ships it.
+type testSend struct {
+	sock    uint32
+	data    string
+	dataLen uint32 // 0 = len(data); larger when only a prefix was captured
+}
+
+// emitted is a send released by the reassembler: its index and method.
+type emitted struct {
+	send   int
+	method uint16
+}
+
+// reassemble feeds sends through a reassembler and returns what it emitted,
+// including what flush releases at the end.
+func reassemble(capacity, limit int, sends []testSend) []emitted {
+	var out []emitted
+	r := newReassembler(capacity, limit, time.Minute, func(ev *RPCEvent) {
+		out = append(out, emitted{int(ev.TimestampNs), ev.MethodID})
+	})
+	now := time.Now()
+	for i, s := range sends {
+		ev := RPCEvent{Data: []byte(s.data)}
+		ev.PID, ev.SockID, ev.TimestampNs = 1, s.sock, uint64(i)
+		ev.DataLen = s.dataLen
+		if ev.DataLen == 0 {
+			ev.DataLen = uint32(len(s.data))
+		}
+		r.feed(&ev, now)
+	}
+	r.flush()
+	return out
+}
+
+func httpHeaders(framing string) string {
+	return "POST / HTTP/1.1\r\nHost: rpc\r\nContent-Type: application/json\r\n" + framing + "\r\n\r\n"
+}
+
+// h2Frame builds an HTTP/2 frame.
+func h2Frame(typ, flags byte, stream uint32, payload string) string {
+	var hdr [9]byte
+	n := len(payload)
+	hdr[0], hdr[1], hdr[2] = byte(n>>16), byte(n>>8), byte(n)
+	hdr[3], hdr[4] = typ, flags
+	binary.BigEndian.PutUint32(hdr[5:], stream)
+	return string(hdr[:]) + payload
+}
+
+// h2PadData is the payload of a padded DATA frame.
+func h2PadData(data, padding string) string {
+	return string([]byte{byte(len(padding))}) + data + padding
+}
+
+func TestReassembler(t *testing.T) {
+	call, balance := internMethod([]byte("eth_call")), internMethod([]byte("eth_getBalance"))
+	body := `{"jsonrpc":"2.0","id":1,"method":"eth_call","params":[]}`
+	split := strings.Index(body, `"method"`) + 4
+	first, rest := body[:split], body[split:] // Split inside "method"
+	large := `{"jsonrpc":"2.0","params":["` + strings.Repeat("x", 100) + `"],"method":"eth_call"}`
+
+	tests := []struct {
+		name  string
+		limit int // 0 = REASSEMBLY_BUFFER_BYTES default
+		sends []testSend
+		want  []emitted
+	}{
+		{
+			name: "headers and body in separate sends",
+			sends: []testSend{
+				{data: httpHeaders(fmt.Sprintf("Content-Length: %d", len(body)))},
+				{data: body},
+			},
+			want: []emitted{{0, call}, {1, call}},
+		},
+		{
+			name: "body split inside the method field",
+			sends: []testSend{
+				{data: httpHeaders(fmt.Sprintf("Content-Length: %d", len(body))) + first},
+				{data: rest},
+			},
+			want: []emitted{{0, call}, {1, call}},
+		},
+		{
+			name: "chunked across sends",
+			sends: []testSend{
+				{data: httpHeaders("Transfer-Encoding: chunked")},
+				{data: fmt.Sprintf("%x\r\n%s\r\n", len(first), first)},
+				{data: fmt.Sprintf("%x;ext=1\r\n%s", len(rest), rest[:5])},
+				{data: rest[5:] + "\r\n0\r\n\r\n"},
+			},
+			want: []emitted{{0, call}, {1, call}, {2, call}, {3, call}},
+		},
+		{
+			name: "keep-alive requests on one connection",
+			sends: []testSend{
+				{data: httpHeaders(fmt.Sprintf("Content-Length: %d", len(body))) + body},
+				{data: httpHeaders("Content-Length: 30")},
+				{data: `{"method":"eth_getBalance"}   `},
+			},
+			want: []emitted{{0, call}, {1, balance}, {2, balance}},
+		},
+		{
+			name: "HTTP/2 padded DATA split over frames and sends",
+			sends: []testSend{
+				{data: string(http2Preface) + h2Frame(h2Headers, 0x4, 1, "\x83\x86")},
+				// Padding that would break the method name if it were searched
+				{data: h2Frame(h2Data, h2Padded, 1, h2PadData(first, "PAD\x00\x00"))},
+				{data: h2Frame(h2Data, h2Padded|h2EndStream, 1, h2PadData(rest, "\x00\x00\x00"))[:15]},
+				{data: h2Frame(h2Data, h2Padded|h2EndStream, 1, h2PadData(rest, "\x00\x00\x00"))[15:]},
+			},
+			want: []emitted{{0, call}, {1, call}, {2, call}, {3, call}},
+		},
+		{
+			name:  "body larger than the buffer",
+			limit: 64,
+			sends: []testSend{
+				{data: httpHeaders(fmt.Sprintf("Content-Length: %d", len(large)))},
+				{data: large},
+			},
+			want: []emitted{{0, methodUnknown}, {1, methodUnknown}},
+		},
+		{
+			name: "uncaptured body bytes end the search",
+			sends: []testSend{
+				{data: httpHeaders(fmt.Sprintf("Content-Length: %d", len(body)))},
+				{data: first, dataLen: uint32(len(body))},
+				{data: httpHeaders(fmt.Sprintf("Content-Length: %d", len(body))) + body},
+			},
+			want: []emitted{{0, methodUnknown}, {1, methodUnknown}, {2, call}},
+		},
+		{
+			name: "request line resyncs a lost connection",
+			sends: []testSend{
+				{data: "\x17\x03\x03 ciphertext"},
+				{data: "more ciphertext"},
+				{data: httpHeaders(fmt.Sprintf("Content-Length: %d", len(body))) + body},
+			},
+			want: []emitted{{0, methodUnknown}, {1, methodUnknown}, {2, call}},
+		},
+	}
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			limit := tt.limit
+			if limit == 0 {
+				limit = ReassemblyBufferBytes
+			}
+			got := reassemble(16, limit, tt.sends)
+			if fmt.Sprint(got) != fmt.Sprint(tt.want) {
+				t.Errorf("emitted %v, want %v", got, tt.want)
+			}
+		})
+	}
+}
+
+// TestReassemblerEviction checks that sends held by an evicted connection
+// are released exactly once, by eviction and not again by flush.
+func TestReassemblerEviction(t *testing.T) {
+	head := httpHeaders("Content-Length: 100")
+	got := reassemble(1, ReassemblyBufferBytes, []testSend{
+		{sock: 1, data: head},
+		{sock: 1, data: `{"jsonrpc":"2.0",`},
+		{sock: 2, data: head}, // Evicts sock 1
+		{sock: 1, data: `"method":"eth_call"}`},
+	})
+
+	seen := make(map[int]int)
+	for _, e := range got {
+		seen[e.send]++
+	}
+	for i := 0; i < 4; i++ {
+		if seen[i] != 1 {
+			t.Errorf("send %d emitted %d times, want once (%v)", i, seen[i], got)
+		}
+	}
+	if len(got) < 2 || got[0] != (emitted{0, methodUnknown}) || got[1] != (emitted{1, methodUnknown}) {
+		t.Errorf("evicted sends = %v, want 0 and 1 released first as unknown", got)
+	}
+}
+
+// TestReassemblerSweep checks that a connection gone quiet mid-request has
+// its held sends released once, and that it is evicted after the idle timeout.
+func TestReassemblerSweep(t *testing.T) {
+	var out []emitted
+	r := newReassembler(16, ReassemblyBufferBytes, time.Minute, func(ev *RPCEvent) {
+		out = append(out, emitted{int(ev.TimestampNs), ev.MethodID})
+	})
+	now := time.Now()
+	ev := RPCEvent{Data: []byte(httpHeaders("Content-Length: 100"))}
+	ev.PID, ev.DataLen = 1, uint32(len(ev.Data))
+	r.feed(&ev, now)
+	if len(out) != 0 {
+		t.Fatalf("headers emitted before their method was known: %v", out)
+	}
+
+	r.sweep(now.Add(reassemblyHoldTimeout))
+	r.sweep(now.Add(2 * reassemblyHoldTimeout))
+	if len(out) != 1 || out[0] != (emitted{0, methodUnknown}) {
+		t.Errorf("after sweeps emitted %v, want the held send once as unknown", out)
+	}
+	r.sweep(now.Add(2 * time.Minute))
+	if len(r.conns) != 0 || r.lru.Len() != 0 {
+		t.Errorf("%d connections left after the idle timeout", len(r.conns))
+	}
+	r.flush()
+	if len(out) != 1 {
+		t.Errorf("flush emitted again: %v", out)
+	}
+}
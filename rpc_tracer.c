@@ -1,84 +1,1398 @@
 //go:build ignore
 
-#include <linux/bpf.h>
-#include <linux/ptrace.h>
+#include "vmlinux.h"
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_tracing.h>
-#include <linux/types.h>
-#include <linux/socket.h>
-#include <linux/in.h>
-#include <linux/tcp.h>
+#include <bpf/bpf_core_read.h>
 
-// Enhanced network tracer with destination IP and payload capture
+// Enhanced network tracer with destination IP and payload capture.
+// Kernel structs are read through CO-RE relocations, so one object built
+// against headers/vmlinux.h loads on any kernel with BTF.
 
+#define AF_INET 2
+#define AF_INET6 10
 #define TASK_COMM_LEN 16
 #define MAX_DATA_SIZE 512  // Increased to capture full JSON-RPC requests
+#define MAX_IOV_SEGS 4     // iovec segments walked per send
+#define METHOD_NAME_LEN 32 // Longest JSON-RPC method name classified in kernel
+#define BATCH_SCAN 64      // Bytes searched back from a "method" token for its object
+#define METHOD_UNKNOWN 0
 
-struct network_event_t {
+// filter_flags bits: which filter maps are consulted. A disabled filter
+// passes everything; an enabled filter passes only keys present in its map.
+#define FILTER_TGID   (1 << 0)
+#define FILTER_CGROUP (1 << 1)
+#define FILTER_COMM   (1 << 2)
+#define FILTER_PORT   (1 << 3)
+#define FILTER_CIDR   (1 << 4)
+
+// capture_mode values
+#define CAPTURE_EVENTS 0  // One record per tcp_sendmsg
+#define CAPTURE_FLOWS  1  // One record per completed request/response pair
+#define CAPTURE_HIST   2  // No records; size/latency histograms in hists
+
+#define HIST_SLOTS 32  // log2 buckets
+#define DIR_SEND 0     // Request sends: size per tcp_sendmsg
+#define DIR_RECV 1     // Completed responses: size and latency per request
+#define DIR_SERVER 2   // Server-side handling time per request (Go server probes)
+
+// drop_counters indexes: why tcp_sendmsg calls (and other records) did
+// not reach userspace, plus the calls and records emitted to relate them to.
+// Keep in sync with kernelCounters in kernel_counters.go.
+enum counter {
+    COUNT_CALLS,       // tcp_sendmsg probe runs
+    COUNT_EMITTED,     // Records handed to the transport
+    DROP_TGID,         // TGID filter
+    DROP_CGROUP,       // cgroup filter
+    DROP_COMM,         // comm filter
+    DROP_SIZE,         // Empty or larger than 64 KiB
+    DROP_FAMILY,       // Not an AF_INET/AF_INET6 socket
+    DROP_TLS,          // TLS ciphertext, reported by the SSL probes instead
+    DROP_PORT,         // Port filter
+    DROP_CIDR,         // CIDR filter
+    DROP_SAMPLED,      // Sampled out or rate limited
+    DROP_NO_SCRATCH,   // Per-CPU scratch lookup failed
+    DROP_OUTPUT,       // Ring buffer reserve/output or perf output failed
+    COUNTER_MAX,
+};
+
+// event_hdr.kind values
+#define RECORD_SEND 0  // struct event_hdr, optionally followed by payload
+#define RECORD_RPC  1  // struct rpc_record
+// event_hdr.kind flag: the destination is IPv6 and its 16-byte address
+// trails the record (after the payload or the rpc_record). IPv4 records
+// never carry it, so they stay the same size.
+#define RECORD_IPV6 0x8000
+
+// Destination of a socket. IPv4 peers, including IPv4-mapped addresses on
+// dual-stack IPv6 sockets, only set ip. IPv6 peers set v6 and ip6, and ip to
+// a 32-bit fold of ip6 that stands in for it where a compact key will do
+// (rate limiting, agent sharding). Fully initialised so it can be part of
+// map keys.
+struct dest {
+    __u32 ip;      // IPv4, network byte order
+    __u16 port;    // Host byte order
+    __u16 v6;
+    __u32 ip6[4];  // IPv6, network byte order; zero for IPv4
+};
+
+// Fixed-size record header. Every record starts with it; cap_len says how
+// many payload bytes follow, so metadata-only records are header-sized.
+struct event_hdr {
     __u64 pid;
     __u64 timestamp_ns;
-    __u32 data_len;
-    __u32 is_send;
-    __u32 dest_ip;    // Destination IPv4 address
+    __u32 data_len;   // Bytes passed to the syscall
+    __u32 sock_id;    // sock_id() of the socket, for per-connection state in the agent
+    __u32 dest_ip;    // Destination IPv4 address (struct dest.ip)
     __u16 dest_port;  // Destination port
+    __u16 cap_len;    // Payload bytes following the header (0 = metadata only)
     char comm[TASK_COMM_LEN];
+    __u16 method_id;  // Index into the agent's method table, METHOD_UNKNOWN if unclassified
+    __u16 kind;       // RECORD_*
+    __u32 weight;     // Events this record stands for after sampling/rate limiting (1 = unsampled)
+    __u64 cgroup_id;  // cgroup v2 ID of the sender, attributed to a pod by the agent
+};
+
+// Completed request/response pair. The header describes the request
+// (data_len = request bytes, timestamp_ns = request start).
+struct rpc_record {
+    struct event_hdr hdr;
+    __u64 latency_ns;  // First request send to first response receive
+    __u32 resp_len;    // Bytes returned by the first tcp_recvmsg
+    __u32 _pad;
+};
+
+// Scratch layout for records carrying payload. Only
+// sizeof(hdr) + hdr.cap_len bytes of it are sent to userspace.
+struct network_event_t {
+    struct event_hdr hdr;
     char data[MAX_DATA_SIZE];  // HTTP headers + JSON-RPC payload
+    // Slack so the verifier can prove multi-segment copies at a variable
+    // offset stay inside the value; never sent
+    char pad[MAX_DATA_SIZE];
+};
+
+// Event transport. Declared as a ring buffer; on kernels without
+// BPF_MAP_TYPE_RINGBUF (< 5.8) the agent rewrites it into a perf event array
+// before loading and clears use_ringbuf.
+struct {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, 8 * 1024 * 1024);
+} events SEC(".maps");
+
+// Set by the agent at load time: 1 = events is a ring buffer, 0 = perf array
+const volatile __u32 use_ringbuf = 1;
+
+// Set by the agent at load time: payload bytes copied per send
+// (0 = metadata only, at most MAX_DATA_SIZE)
+const volatile __u32 payload_cap = MAX_DATA_SIZE;
+
+// Set by the agent at load time: 1 = also ship the payload of sends with no
+// method field (HTTP headers, body continuations), which the agent
+// reassembles per connection
+const volatile __u32 reassembly = 0;
+
+// Per-CPU scratch used to build headers on the perf path and payload
+// records on both paths (network_event_t does not fit on the BPF stack)
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct network_event_t);
+} event_heap SEC(".maps");
+
+// Per-CPU counters indexed by enum counter, summed by the agent
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, COUNTER_MAX);
+    __type(key, __u32);
+    __type(value, __u64);
+} drop_counters SEC(".maps");
+
+static __always_inline void count_stat(__u32 counter) {
+    __u64 *n = bpf_map_lookup_elem(&drop_counters, &counter);
+    if (n) {
+        (*n)++;
+    }
+}
+
+// Count the outcome of handing a record to the transport
+static __always_inline void count_output(long err) {
+    count_stat(err ? DROP_OUTPUT : COUNT_EMITTED);
+}
+
+// Set by the agent at load time: CAPTURE_EVENTS, CAPTURE_FLOWS or CAPTURE_HIST
+const volatile __u32 capture_mode = CAPTURE_EVENTS;
+
+// Per-socket request state for CAPTURE_FLOWS, keyed by struct sock *.
+// LRU so sockets that close without tcp_close being seen age out.
+struct flow_t {
+    __u64 req_start_ns;  // 0 = no request in flight
+    __u64 cgroup_id;
+    __u32 req_bytes;
+    __u32 pid;
+    struct dest dest;
+    __u16 method_id;
+    __u16 _pad;
+    char comm[TASK_COMM_LEN];
+    __u32 tls;  // Request seen in plaintext by SSL_write; completed by SSL_read
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 16384);
+    __type(key, __u64);
+    __type(value, struct flow_t);
+} flows SEC(".maps");
+
+// Aggregates for CAPTURE_HIST, swept and reset by the agent
+struct hist_key {
+    struct dest dest;
+    __u16 method_id;
+    __u8 direction;  // DIR_*
+    __u8 _pad;
+};
+
+struct hist_t {
+    __u64 count;
+    __u64 sum_bytes;
+    __u64 sum_latency_ns;                // DIR_RECV and DIR_SERVER only
+    __u64 size_slots[HIST_SLOTS];        // log2(bytes)
+    __u64 latency_slots[HIST_SLOTS];     // log2(microseconds), DIR_RECV and DIR_SERVER only
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __uint(max_entries, 4096);
+    __type(key, struct hist_key);
+    __type(value, struct hist_t);
+} hists SEC(".maps");
+
+// All-zero source for inserting new hists entries (hist_t does not fit on the stack)
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct hist_t);
+} hist_zero SEC(".maps");
+
+// Socket passed to an in-progress tcp_recvmsg, keyed by pid_tgid
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 4096);
+    __type(key, __u64);
+    __type(value, __u64);
+} recv_socks SEC(".maps");
+
+// Adaptive capture depth. A socket's payload is copied and classified for
+// its first capture_depth sends; once those all named the same known method,
+// its later sends are reported as metadata plus that method. Sockets whose
+// method is unknown, that use several methods, or whose payload the agent
+// needs (batches, names not in method_ids) keep being copied. Keyed by
+// process, socket and destination as the agent sees them in records, so it
+// can set need_payload again to re-probe a socket, or clear it.
+struct capture_key {
+    __u32 tgid;
+    __u32 sock_id;
+    __u32 dest_ip;    // struct dest.ip
+    __u16 dest_port;
+    __u16 _pad;
+};
+
+struct capture_state {
+    __u32 probes_left;  // Payload sends left before need_payload may clear
+    __u16 method_id;    // Method of the probed sends, METHOD_UNKNOWN if none yet
+    __u8 need_payload;  // 1 = copy and classify each send
+    __u8 mixed;         // Probed sends disagreed, or only their payload names them
+    __u16 stamped;      // Sends labelled method_id since the last spot check
+    __u8 lead;          // First byte of the probed sends that named the method
+    __u8 _pad;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 16384);
+    __type(key, struct capture_key);
+    __type(value, struct capture_state);
+} capture_socks SEC(".maps");
+
+// Sockets seen sending an HTTP request line or the HTTP/2 preface. With
+// reassembly, only their sends without a method field ship payload, so TLS
+// ciphertext and other protocols never reach the agent's reassembler.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 16384);
+    __type(key, struct capture_key);
+    __type(value, __u8);
+} http_socks SEC(".maps");
+
+// Set by the agent at load time: sends probed per socket before falling
+// back to metadata plus method (0 = always copy payload_cap bytes)
+const volatile __u32 capture_depth = 0;
+
+// Set by the agent at load time: a metadata-only socket has one send in
+// this many copied and checked against its learned method (0 = never)
+const volatile __u32 capture_verify = 0;
+
+// Live configuration, written by the agent and pinned with the other maps
+// so filters can change without reloading. Programs only run while their
+// prog_gen is the active generation, so a new agent can attach its
+// programs next to the old ones and take over with a single map update.
+struct tracer_config {
+    __u32 filter_flags;  // FILTER_* bits of the filters in force
+    __u32 active_gen;    // Generation whose programs run
+    __u32 reader_gen;    // Generation draining the pinned ringbuf, for the agents only
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct tracer_config);
+} tracer_config SEC(".maps");
+
+// Generation of this load, set by the agent
+const volatile __u32 prog_gen = 0;
+
+// Filter maps, populated by the agent. Values are unused.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 1024);
+    __type(key, __u32);  // TGID
+    __type(value, __u8);
+} filter_tgids SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 1024);
+    __type(key, __u64);  // cgroup v2 ID
+    __type(value, __u8);
+} filter_cgroups SEC(".maps");
+
+struct comm_key {
+    char comm[TASK_COMM_LEN];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 64);
+    __type(key, struct comm_key);
+    __type(value, __u8);
+} filter_comms SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 64);
+    __type(key, __u16);  // Destination port, host byte order
+    __type(value, __u8);
+} filter_ports SEC(".maps");
+
+struct cidr_key {
+    __u32 prefixlen;
+    __u32 addr;  // IPv4, network byte order
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __uint(max_entries, 256);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __type(key, struct cidr_key);
+    __type(value, __u8);
+} filter_cidrs SEC(".maps");
+
+struct cidr6_key {
+    __u32 prefixlen;
+    __u32 addr[4];  // IPv6, network byte order
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __uint(max_entries, 256);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __type(key, struct cidr6_key);
+    __type(value, __u8);
+} filter_cidrs6 SEC(".maps");
+
+// Set by the agent at load time: keep 1 in sample_every records (0 or 1 = all)
+const volatile __u32 sample_every = 1;
+
+// Set by the agent at load time: per-key token bucket, records per second
+// and burst size (rate_limit 0 = unlimited)
+const volatile __u32 rate_limit = 0;
+const volatile __u32 rate_burst = 1;
+
+#define NSEC_PER_SEC 1000000000ULL
+#define RATE_MAX_REFILL_NS (60 * NSEC_PER_SEC)  // Bounds elapsed * rate_limit
+
+// Rate limiting key: one bucket per process, destination and method
+struct rate_key {
+    __u32 tgid;
+    __u32 dest_ip;
+    __u16 dest_port;
+    __u16 method_id;
+};
+
+// tokens is in token-nanoseconds (NSEC_PER_SEC = one record) so refills
+// need no division. Updates race across CPUs; the limit is approximate.
+struct rate_bucket {
+    __u64 tokens;
+    __u64 last_ns;
+    __u32 suppressed;  // Sampled-in records dropped since the last emit
+    __u32 _pad;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 16384);
+    __type(key, struct rate_key);
+    __type(value, struct rate_bucket);
+} rate_buckets SEC(".maps");
+
+// Known JSON-RPC method names, loaded by the agent at startup
+struct method_key {
+    char name[METHOD_NAME_LEN];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 256);
+    __type(key, struct method_key);
+    __type(value, __u16);
+} method_ids SEC(".maps");
+
+// Set by the agent at load time: 1 when the SSL_write/SSL_read uprobes are
+// attached, so the tcp_sendmsg hooks correlate TLS sessions with sockets
+const volatile __u32 ssl_enabled = 0;
+
+#define SSL_PENDING_TIMEOUT_NS (100 * 1000 * 1000ULL)
+
+// Arguments of an in-progress SSL_write or SSL_read, keyed by pid_tgid
+struct ssl_call {
+    __u64 ssl;  // SSL *
+    __u64 buf;  // Plaintext buffer (SSL_write only)
+    __u32 is_write;
+    __u32 _pad;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 4096);
+    __type(key, __u64);
+    __type(value, struct ssl_call);
+} ssl_calls SEC(".maps");
+
+// Socket a TLS session writes its ciphertext to, keyed by SSL *
+struct ssl_sock {
+    __u64 sk;  // struct sock *
+    struct dest dest;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 16384);
+    __type(key, __u64);
+    __type(value, struct ssl_sock);
+} ssl_socks SEC(".maps");
+
+// Sockets carrying a traced TLS session, keyed by struct sock *. Their
+// ciphertext sends and receives are not recorded.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 16384);
+    __type(key, __u64);
+    __type(value, __u8);
+} tls_socks SEC(".maps");
+
+// An SSL_write whose session had no known socket yet, keyed by pid_tgid.
+// With a memory BIO (Node.js) the ciphertext is written after SSL_write
+// returns, so the thread's next tcp_sendmsg binds the session and emits it.
+// Only the last such write per thread is kept.
+struct ssl_pending {
+    __u64 ssl;
+    __u64 timestamp_ns;
+    __u32 size;
+    __u16 method_id;
+    __u16 _pad;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 4096);
+    __type(key, __u64);
+    __type(value, struct ssl_pending);
+} ssl_pending SEC(".maps");
+
+// Set by the agent at load time for the Go server probes: which integer
+// argument of the probed function points to the request, and the offset of
+// its method string ({ptr, len}) in it. server_method_arg < 0 = no method.
+const volatile __s32 server_method_arg = 2;
+const volatile __u32 server_method_off = 40;
+
+// A Go server call in progress, keyed by process and goroutine. Goroutines
+// move between threads while blocked, so pid_tgid cannot be used. LRU so
+// calls that never return (panics) age out.
+struct go_call_key {
+    __u32 tgid;
+    __u32 _pad;
+    __u64 g;  // Address of the runtime.g
+};
+
+struct go_call {
+    __u64 start_ns;
+    __u16 method_id;
+    __u16 _pad[3];
 };
 
-// Perf buffer for events
-struct {
-    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
-    __uint(key_size, sizeof(__u32));
-    __uint(value_size, sizeof(__u32));
-} events SEC(".maps");
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 16384);
+    __type(key, struct go_call_key);
+    __type(value, struct go_call);
+} go_calls SEC(".maps");
+
+// Reserve a metadata-only record: in place in the ring buffer, or in the
+// per-CPU scratch slot when falling back to the perf event array
+static __always_inline struct event_hdr *reserve_hdr(void) {
+    __u32 zero = 0;
+    struct event_hdr *hdr;
+
+    if (use_ringbuf) {
+        hdr = bpf_ringbuf_reserve(&events, sizeof(struct event_hdr), 0);
+        if (!hdr) {
+            count_stat(DROP_OUTPUT);
+        }
+        return hdr;
+    }
+    hdr = bpf_map_lookup_elem(&event_heap, &zero);
+    if (!hdr) {
+        count_stat(DROP_NO_SCRATCH);
+    }
+    return hdr;
+}
+
+// Hand a reserved metadata-only record to userspace
+static __always_inline void submit_hdr(void *ctx, struct event_hdr *hdr) {
+    hdr->cap_len = 0;
+    if (use_ringbuf) {
+        bpf_ringbuf_submit(hdr, 0);
+        count_stat(COUNT_EMITTED);
+        return;
+    }
+    count_output(bpf_perf_event_output(ctx, &events, BPF_F_CURRENT_CPU, hdr, sizeof(*hdr)));
+}
+
+// Scratch record for events that carry payload
+static __always_inline struct network_event_t *scratch_event(void) {
+    __u32 zero = 0;
+    struct network_event_t *event = bpf_map_lookup_elem(&event_heap, &zero);
+
+    if (!event) {
+        count_stat(DROP_NO_SCRATCH);
+    }
+    return event;
+}
+
+// Append the IPv6 destination, if any, to the len bytes of record rec
+// (room for it is left after every scratch record). Returns the new length.
+static __always_inline __u32 put_dest6(void *rec, __u32 len, const struct dest *d) {
+    if (!d->v6) {
+        return len;
+    }
+    ((struct event_hdr *)rec)->kind |= RECORD_IPV6;
+    __builtin_memcpy((char *)rec + len, d->ip6, sizeof(d->ip6));
+    return len + sizeof(d->ip6);
+}
+
+// Send a scratch record, trimmed to its header plus cap_len payload bytes
+// (and the IPv6 destination). Ring buffer reservations must be
+// constant-sized, so this path copies.
+static __always_inline void output_event(void *ctx, struct network_event_t *event,
+                                         const struct dest *d) {
+    __u32 len = event->hdr.cap_len;
+
+    if (len > MAX_DATA_SIZE) {
+        len = MAX_DATA_SIZE;
+        event->hdr.cap_len = len;
+    }
+    len = put_dest6(event, len + sizeof(struct event_hdr), d);
+
+    if (use_ringbuf) {
+        count_output(bpf_ringbuf_output(&events, event, len, 0));
+        return;
+    }
+    count_output(bpf_perf_event_output(ctx, &events, BPF_F_CURRENT_CPU, event, len));
+}
+
+// Finish a destination whose ip6 has been read from an AF_INET6 socket.
+// A dual-stack socket talking to an IPv4 peer holds ::ffff:a.b.c.d, which
+// is reported as plain IPv4.
+static __always_inline void dest_from_ip6(struct dest *d) {
+    if (d->ip6[0] == 0 && d->ip6[1] == 0 && d->ip6[2] == __builtin_bswap32(0xffff)) {
+        d->ip = d->ip6[3];
+        d->v6 = 0;
+        d->ip6[2] = 0;
+        d->ip6[3] = 0;
+        return;
+    }
+    d->ip = d->ip6[0] ^ d->ip6[1] ^ d->ip6[2] ^ d->ip6[3];
+    d->v6 = 1;
+}
+
+// Helper to extract destination address from socket
+static __always_inline int get_sock_info(struct sock *sk, struct dest *d) {
+    __u16 family = BPF_CORE_READ(sk, __sk_common.skc_family);
+
+    // Convert from network byte order
+    d->port = __builtin_bswap16(BPF_CORE_READ(sk, __sk_common.skc_dport));
+    d->v6 = 0;
+    __builtin_memset(d->ip6, 0, sizeof(d->ip6));
+
+    if (family == AF_INET) {
+        d->ip = BPF_CORE_READ(sk, __sk_common.skc_daddr);
+        return 0;
+    }
+    if (family == AF_INET6) {
+        BPF_CORE_READ_INTO(&d->ip6, sk, __sk_common.skc_v6_daddr.in6_u.u6_addr32);
+        dest_from_ip6(d);
+        return 0;
+    }
+    return -1;
+}
+
+// Helper to read the destination straight from a BTF-typed socket
+// (fentry/fexit), without bpf_probe_read_kernel
+static __always_inline int get_sock_info_btf(struct sock *sk, struct dest *d) {
+    __u16 family = sk->__sk_common.skc_family;
+
+    d->port = __builtin_bswap16(sk->__sk_common.skc_dport);
+    d->v6 = 0;
+    __builtin_memset(d->ip6, 0, sizeof(d->ip6));
+
+    if (family == AF_INET) {
+        d->ip = sk->__sk_common.skc_daddr;
+        return 0;
+    }
+    if (family == AF_INET6) {
+        for (int i = 0; i < 4; i++) {
+            d->ip6[i] = sk->__sk_common.skc_v6_daddr.in6_u.u6_addr32[i];
+        }
+        dest_from_ip6(d);
+        return 0;
+    }
+    return -1;
+}
+
+// Copy one user or kernel buffer into dst + off, clamped so the copy never
+// runs past MAX_DATA_SIZE. Returns the bytes copied.
+static __always_inline __u32 copy_segment(char *dst, __u32 off, const void *src,
+                                          __u64 len, __u32 want, int user) {
+    __u32 n;
+
+    if (off >= want) {
+        return 0;
+    }
+    n = want - off;
+    if (len < n) {
+        n = len;
+    }
+    off &= MAX_DATA_SIZE - 1;
+    if (n > MAX_DATA_SIZE) {
+        n = MAX_DATA_SIZE;
+    }
+
+    if (user) {
+        if (bpf_probe_read_user(dst + off, n, src) != 0) {
+            return 0;
+        }
+    } else {
+        if (bpf_probe_read_kernel(dst + off, n, src) != 0) {
+            return 0;
+        }
+    }
+    return n;
+}
+
+// Copy the first bytes being sent out of msg->msg_iter into dst, at most
+// limit of them. ITER_UBUF is a single user buffer (6.0+ write/send); ITER_IOVEC and
+// ITER_KVEC arrays are walked for up to MAX_IOV_SEGS segments. Other iterator
+// types (bvec, pipe, xarray) carry no directly readable buffer and are skipped.
+//
+// The iterator layout changed across kernels: the kind moved from the type
+// bit set to iter_type in 5.14, and iov was renamed __iov in 6.4. Each field
+// is read with a CO-RE relocation and the missing variant is dead code the
+// verifier never sees.
+static __always_inline __u32 read_msg_payload(struct msghdr *msg, char *dst, __u32 size,
+                                              __u32 limit) {
+    struct iov_iter *iter = &msg->msg_iter;
+    const struct iovec *iovs;
+    __u64 iov_offset, nr_segs;
+    __u32 want = size < limit ? size : limit;
+    __u32 copied = 0;
+    int user;
+
+    if (want == 0) {
+        return 0;
+    }
+    if (want > MAX_DATA_SIZE) {
+        want = MAX_DATA_SIZE;
+    }
+
+    iov_offset = BPF_CORE_READ(iter, iov_offset);
+
+    if (bpf_core_field_exists(iter->iter_type)) {
+        __u8 type = BPF_CORE_READ(iter, iter_type);
+
+        if (bpf_core_enum_value_exists(enum iter_type, ITER_UBUF) &&
+            type == bpf_core_enum_value(enum iter_type, ITER_UBUF)) {
+            return copy_segment(dst, 0, BPF_CORE_READ(iter, ubuf) + iov_offset,
+                                BPF_CORE_READ(iter, count), want, 1);
+        }
+        if (type == bpf_core_enum_value(enum iter_type, ITER_IOVEC)) {
+            user = 1;
+        } else if (type == bpf_core_enum_value(enum iter_type, ITER_KVEC)) {
+            user = 0;
+        } else {
+            return 0;
+        }
+    } else {
+        // Before 5.14 the kind is a bit in type, next to the direction bit
+        struct iov_iter___pre_5_14 *old = (void *)iter;
+        unsigned int type = BPF_CORE_READ(old, type);
+
+        if (type & bpf_core_enum_value(enum iter_type, ITER_IOVEC)) {
+            user = 1;
+        } else if (type & bpf_core_enum_value(enum iter_type, ITER_KVEC)) {
+            user = 0;
+        } else {
+            return 0;
+        }
+    }
+
+    // struct kvec has the same layout as struct iovec
+    if (bpf_core_field_exists(iter->__iov)) {
+        iovs = BPF_CORE_READ(iter, __iov);
+    } else {
+        struct iov_iter___pre_6_4 *old = (void *)iter;
+        iovs = BPF_CORE_READ(old, iov);
+    }
+    nr_segs = BPF_CORE_READ(iter, nr_segs);
+
+    for (int seg = 0; seg < MAX_IOV_SEGS; seg++) {
+        struct iovec iov;
+
+        if (seg >= nr_segs || copied >= want) {
+            break;
+        }
+        if (bpf_probe_read_kernel(&iov, sizeof(iov), &iovs[seg]) != 0) {
+            break;
+        }
+
+        char *base = iov.iov_base;
+        __u64 len = iov.iov_len;
+        if (seg == 0) {
+            // iov_offset is how far into the first segment the send starts
+            if (iov_offset >= len) {
+                continue;
+            }
+            base += iov_offset;
+            len -= iov_offset;
+        }
+
+        copied += copy_segment(dst, copied, base, len, want, user);
+    }
+
+    return copied;
+}
+
+// Copy the first limit bytes of a send into dst: from plain, a user buffer,
+// when set (SSL_write), else from msg
+static __always_inline __u32 read_send_prefix(struct msghdr *msg, const void *plain, char *dst,
+                                              __u32 size, __u32 limit) {
+    if (plain) {
+        __u32 want = size < limit ? size : limit;
+        return copy_segment(dst, 0, plain, size, want, 1);
+    }
+    return read_msg_payload(msg, dst, size, limit);
+}
+
+static __always_inline __u32 read_send_payload(struct msghdr *msg, const void *plain, char *dst,
+                                               __u32 size) {
+    return read_send_prefix(msg, plain, dst, size, payload_cap);
+}
+
+static __always_inline int is_json_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Whether the object holding the "method" token at tok is an element of a
+// batch: its '{' comes right after the '[' or the ',' of an array (a member
+// object would follow a ':'). Bounded, so long ids or objects with method
+// far from their start are taken as single requests.
+static __always_inline int is_batch(const char *data, __u32 tok) {
+    __u32 pos = tok;
+    int i;
+
+    for (i = 0; i < BATCH_SCAN; i++) {
+        if (pos == 0 || pos > MAX_DATA_SIZE) {
+            return 0;
+        }
+        pos--;
+        if (data[pos] == '{') {
+            break;
+        }
+    }
+    if (i == BATCH_SCAN) {
+        return 0;
+    }
+    for (i = 0; i < 8; i++) {
+        if (pos == 0 || pos > MAX_DATA_SIZE) {
+            return 0;
+        }
+        pos--;
+        char c = data[pos];
+        if (c == '[' || c == ',') {
+            return 1;
+        }
+        if (!is_json_space(c)) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// Find "method" : "<name>" in the captured prefix and look the name up in
+// method_ids. Returns METHOD_UNKNOWN if there is no method field, and sets
+// *found when a method field exists but its name is not in the table.
+// Sets *batch when the request is part of a batch, whose methods the agent
+// enumerates from the payload.
+static __always_inline __u16 classify_method(const char *data, __u32 len, int *found, int *batch) {
+    struct method_key key = {};
+    __u32 pos = 0;
+    int i;
+
+    *found = 0;
+    *batch = 0;
+    if (len > MAX_DATA_SIZE) {
+        len = MAX_DATA_SIZE;
+    }
+
+    // Locate the 8-byte "method" token. Every mismatching branch rejoins at
+    // the loop head with only i changed, which keeps verification linear.
+    for (i = 0; i + 8 <= MAX_DATA_SIZE; i++) {
+        if (i + 8 > len) {
+            return METHOD_UNKNOWN;
+        }
+        if (data[i] == '"' && data[i + 1] == 'm' && data[i + 2] == 'e' && data[i + 3] == 't' &&
+            data[i + 4] == 'h' && data[i + 5] == 'o' && data[i + 6] == 'd' && data[i + 7] == '"') {
+            pos = i + 8;
+            break;
+        }
+    }
+    if (pos == 0) {
+        return METHOD_UNKNOWN;
+    }
+    *batch = is_batch(data, pos - 8);
+
+    // Expect optional whitespace, ':', optional whitespace, then '"'
+    int seen_colon = 0;
+    for (i = 0; i < 8; i++) {
+        if (pos >= len || pos >= MAX_DATA_SIZE) {
+            return METHOD_UNKNOWN;
+        }
+        char c = data[pos];
+        pos++;
+        if (is_json_space(c)) {
+            continue;
+        }
+        if (c == ':' && !seen_colon) {
+            seen_colon = 1;
+            continue;
+        }
+        if (c == '"' && seen_colon) {
+            break;
+        }
+        return METHOD_UNKNOWN;
+    }
+    if (i == 8) {
+        return METHOD_UNKNOWN;
+    }
+
+    // Copy the name up to the closing quote
+    for (i = 0; i < METHOD_NAME_LEN - 1; i++) {
+        if (pos + i >= len || pos + i >= MAX_DATA_SIZE) {
+            return METHOD_UNKNOWN;  // Name runs past the captured prefix
+        }
+        char c = data[pos + i];
+        if (c == '"') {
+            break;
+        }
+        key.name[i] = c;
+    }
+    if (i == METHOD_NAME_LEN - 1) {
+        return METHOD_UNKNOWN;  // Too long to be in the table
+    }
+
+    *found = 1;
+    __u16 *id = bpf_map_lookup_elem(&method_ids, &key);
+    return id ? *id : METHOD_UNKNOWN;
+}
+
+static __always_inline struct tracer_config *config(void) {
+    __u32 zero = 0;
+
+    return bpf_map_lookup_elem(&tracer_config, &zero);
+}
+
+// Whether this load's programs are the ones in charge
+static __always_inline int active(void) {
+    struct tracer_config *cfg = config();
+
+    return cfg && cfg->active_gen == prog_gen;
+}
+
+static __always_inline __u32 filter_flags(void) {
+    struct tracer_config *cfg = config();
+
+    return cfg ? cfg->filter_flags : 0;
+}
+
+// Task filters, cheapest first. Reads the current comm into comm (needed by
+// the header anyway) only once the TGID and cgroup filters have passed.
+static __always_inline int filter_task(__u64 pid_tgid, struct comm_key *comm) {
+    __u32 flags = filter_flags();
+
+    if (flags & FILTER_TGID) {
+        __u32 tgid = pid_tgid >> 32;
+        if (!bpf_map_lookup_elem(&filter_tgids, &tgid)) {
+            count_stat(DROP_TGID);
+            return 0;
+        }
+    }
+    if (flags & FILTER_CGROUP) {
+        __u64 cgroup_id = bpf_get_current_cgroup_id();
+        if (!bpf_map_lookup_elem(&filter_cgroups, &cgroup_id)) {
+            count_stat(DROP_CGROUP);
+            return 0;
+        }
+    }
+
+    bpf_get_current_comm(comm->comm, sizeof(comm->comm));
+    if (flags & FILTER_COMM) {
+        if (!bpf_map_lookup_elem(&filter_comms, comm)) {
+            count_stat(DROP_COMM);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Destination filters, applied once the socket has been read. IPv6
+// destinations are matched against filter_cidrs6 only.
+static __always_inline int filter_dest(const struct dest *d) {
+    __u32 flags = filter_flags();
+
+    if (flags & FILTER_PORT) {
+        if (!bpf_map_lookup_elem(&filter_ports, &d->port)) {
+            count_stat(DROP_PORT);
+            return 0;
+        }
+    }
+    if (flags & FILTER_CIDR) {
+        if (d->v6) {
+            struct cidr6_key key = {.prefixlen = 128};
+            __builtin_memcpy(key.addr, d->ip6, sizeof(key.addr));
+            if (!bpf_map_lookup_elem(&filter_cidrs6, &key)) {
+                count_stat(DROP_CIDR);
+                return 0;
+            }
+        } else {
+            struct cidr_key key = {.prefixlen = 32, .addr = d->ip};
+            if (!bpf_map_lookup_elem(&filter_cidrs, &key)) {
+                count_stat(DROP_CIDR);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Compact identity of a socket. Only needs to tell apart the concurrent
+// connections of one process, which differ in their low address bits.
+static __always_inline __u32 sock_id(__u64 sk) {
+    return (__u32)sk ^ (__u32)(sk >> 32);
+}
+
+// Fill the common header fields for a send
+static __always_inline void fill_send_hdr(struct event_hdr *hdr, __u64 pid_tgid, struct sock *sk,
+                                          __u32 size, const struct dest *d, const char *comm) {
+    hdr->pid = pid_tgid >> 32;
+    hdr->timestamp_ns = bpf_ktime_get_ns();
+    hdr->sock_id = sock_id((__u64)sk);
+    hdr->data_len = size;
+    hdr->dest_ip = d->ip;
+    hdr->dest_port = d->port;
+    hdr->method_id = METHOD_UNKNOWN;
+    hdr->kind = RECORD_SEND;
+    hdr->weight = 1;
+    hdr->cgroup_id = bpf_get_current_cgroup_id();
+    __builtin_memcpy(hdr->comm, comm, TASK_COMM_LEN);
+}
+
+// Decide whether to emit a record for key. Returns 0 to drop it, or the
+// weight it carries: sample_every for each sampled-in record, times one
+// plus the sampled-in records its bucket suppressed since the last emit, so
+// the weights of emitted records sum to an unbiased count of the total.
+static __always_inline __u32 admit(const struct rate_key *key, __u64 now) {
+    __u32 weight = 1;
+
+    if (sample_every > 1) {
+        if (bpf_get_prandom_u32() % sample_every != 0) {
+            return 0;
+        }
+        weight = sample_every;
+    }
+    if (rate_limit == 0) {
+        return weight;
+    }
+
+    struct rate_bucket *bucket = bpf_map_lookup_elem(&rate_buckets, key);
+    if (!bucket) {
+        // New key: start with a full bucket, minus this record
+        struct rate_bucket fresh = {
+            .tokens = (__u64)(rate_burst - 1) * NSEC_PER_SEC,
+            .last_ns = now,
+        };
+        bpf_map_update_elem(&rate_buckets, key, &fresh, BPF_ANY);
+        return weight;
+    }
 
-// Helper to extract destination address from socket
-static __always_inline int get_sock_info(struct sock *sk, __u32 *dest_ip, __u16 *dest_port) {
-    __u16 family;
-    
-    // Read socket family
-    bpf_probe_read_kernel(&family, sizeof(family), &sk->__sk_common.skc_family);
+    __u64 elapsed = now - bucket->last_ns;
+    if (elapsed > RATE_MAX_REFILL_NS) {
+        elapsed = RATE_MAX_REFILL_NS;
+    }
+    __u64 tokens = bucket->tokens + elapsed * rate_limit;
+    __u64 cap = (__u64)rate_burst * NSEC_PER_SEC;
+    if (tokens > cap) {
+        tokens = cap;
+    }
+    bucket->last_ns = now;
+
+    if (tokens < NSEC_PER_SEC) {
+        bucket->tokens = tokens;
+        bucket->suppressed++;
+        return 0;
+    }
+    bucket->tokens = tokens - NSEC_PER_SEC;
+    weight *= 1 + bucket->suppressed;
+    bucket->suppressed = 0;
+    return weight;
+}
+
+// Index of the highest set bit, clamped to the last histogram slot
+static __always_inline __u32 log2_slot(__u64 v) {
+    __u32 r = 0;
+
+    if (v >> 32) { v >>= 32; r += 32; }
+    if (v >> 16) { v >>= 16; r += 16; }
+    if (v >> 8)  { v >>= 8;  r += 8; }
+    if (v >> 4)  { v >>= 4;  r += 4; }
+    if (v >> 2)  { v >>= 2;  r += 2; }
+    if (v >> 1)  { r += 1; }
+
+    return r < HIST_SLOTS ? r : HIST_SLOTS - 1;
+}
+
+// Add one observation to this CPU's histogram for key
+static __always_inline void hist_observe(struct hist_key *key, __u32 bytes, __u64 latency_ns) {
+    struct hist_t *hist = bpf_map_lookup_elem(&hists, key);
+
+    if (!hist) {
+        __u32 zero = 0;
+        struct hist_t *init = bpf_map_lookup_elem(&hist_zero, &zero);
+        if (!init) {
+            return;
+        }
+        bpf_map_update_elem(&hists, key, init, BPF_NOEXIST);
+        hist = bpf_map_lookup_elem(&hists, key);
+        if (!hist) {
+            return;
+        }
+    }
+
+    // Per-CPU value: plain increments are safe
+    hist->count++;
+    hist->sum_bytes += bytes;
+    hist->size_slots[log2_slot(bytes)]++;
+    if (key->direction != DIR_SEND) {
+        hist->sum_latency_ns += latency_ns;
+        hist->latency_slots[log2_slot(latency_ns / 1000)]++;
+    }
+}
+
+// Record a send against its socket's flow. The first send after a response
+// starts a new request; later sends (e.g. the body after the headers) add
+// to it and fill in the method if it was not yet known.
+static __always_inline void track_send(struct sock *sk, const struct dest *d,
+                                       const struct event_hdr *hdr, __u32 tls) {
+    __u64 key = (__u64)sk;
+    struct flow_t *flow = bpf_map_lookup_elem(&flows, &key);
+
+    if (flow && flow->req_start_ns != 0) {
+        flow->req_bytes += hdr->data_len;
+        if (flow->method_id == METHOD_UNKNOWN) {
+            flow->method_id = hdr->method_id;
+        }
+        return;
+    }
+
+    struct flow_t new_flow = {
+        .req_start_ns = hdr->timestamp_ns,
+        .cgroup_id = hdr->cgroup_id,
+        .req_bytes = hdr->data_len,
+        .pid = hdr->pid,
+        .dest = *d,
+        .method_id = hdr->method_id,
+        .tls = tls,
+    };
+    __builtin_memcpy(new_flow.comm, hdr->comm, TASK_COMM_LEN);
+    bpf_map_update_elem(&flows, &key, &new_flow, BPF_ANY);
+}
+
+// Deliver a classified send: track it in flow and histogram modes, else
+// sample, rate limit and emit it
+static __always_inline int finish_send(void *ctx, __u64 pid_tgid, struct sock *sk,
+                                       const struct dest *d, struct network_event_t *event,
+                                       __u32 tls) {
+    // Flow mode reports the request once, when its response arrives;
+    // histogram mode also aggregates the send in place of emitting it
+    if (capture_mode != CAPTURE_EVENTS) {
+        track_send(sk, d, &event->hdr, tls);
+        if (capture_mode == CAPTURE_HIST) {
+            struct hist_key key = {
+                .dest = *d,
+                .method_id = event->hdr.method_id,
+                .direction = DIR_SEND,
+            };
+            hist_observe(&key, event->hdr.data_len, 0);
+        }
+        return 0;
+    }
     
-    if (family == AF_INET) {
-        // IPv4
-        bpf_probe_read_kernel(dest_ip, sizeof(*dest_ip), &sk->__sk_common.skc_daddr);
-        bpf_probe_read_kernel(dest_port, sizeof(*dest_port), &sk->__sk_common.skc_dport);
-        // Convert from network byte order
-        *dest_port = __builtin_bswap16(*dest_port);
+    // Sample and rate limit per method, now that the method is known
+    struct rate_key rkey = {
+        .tgid = pid_tgid >> 32,
+        .dest_ip = event->hdr.dest_ip,
+        .dest_port = event->hdr.dest_port,
+        .method_id = event->hdr.method_id,
+    };
+    event->hdr.weight = admit(&rkey, event->hdr.timestamp_ns);
+    if (!event->hdr.weight) {
+        count_stat(DROP_SAMPLED);
         return 0;
     }
     
-    return -1;
+    output_event(ctx, event, d);
+    
+    return 0;
 }
 
-// Kprobe on tcp_sendmsg
-SEC("kprobe/tcp_sendmsg")
-int trace_tcp_sendmsg(struct pt_regs *ctx) {
-    struct network_event_t event = {};
+// Capture state of the socket a send goes to, created on its first send.
+// NULL when every send is copied, or none is.
+static __always_inline struct capture_state *capture_state(__u64 pid_tgid, struct sock *sk,
+                                                           const struct dest *d) {
+    if (capture_depth == 0 || payload_cap == 0) {
+        return 0;
+    }
+    struct capture_key key = {
+        .tgid = pid_tgid >> 32,
+        .sock_id = sock_id((__u64)sk),
+        .dest_ip = d->ip,
+        .dest_port = d->port,
+    };
+    struct capture_state *cap = bpf_map_lookup_elem(&capture_socks, &key);
+    if (cap) {
+        return cap;
+    }
+    struct capture_state fresh = {
+        .probes_left = capture_depth,
+        .need_payload = 1,
+    };
+    bpf_map_update_elem(&capture_socks, &key, &fresh, BPF_NOEXIST);
+    return bpf_map_lookup_elem(&capture_socks, &key);
+}
+
+// Learn from a probed send. Sends with no method field (headers, body
+// continuations) use up probes without deciding anything. Racing updates
+// from other CPUs at worst probe a socket once more or less.
+static __always_inline void capture_learn(struct capture_state *cap, __u16 method_id, int found,
+                                          int batch, char lead) {
+    if (batch || (found && method_id == METHOD_UNKNOWN)) {
+        cap->mixed = 1;
+    } else if (method_id != METHOD_UNKNOWN) {
+        cap->lead = lead;
+        if (cap->method_id == METHOD_UNKNOWN) {
+            cap->method_id = method_id;
+        } else if (cap->method_id != method_id) {
+            cap->mixed = 1;
+        }
+    }
+    if (cap->probes_left > 0) {
+        cap->probes_left--;
+    }
+    if (cap->probes_left == 0 && !cap->mixed && cap->method_id != METHOD_UNKNOWN) {
+        cap->need_payload = 0;
+        cap->stamped = 0;
+    }
+}
+
+// Check a spot-checked send of a metadata-only socket against its learned
+// method. When the socket moved to another method, or to batches, it is
+// probed again from scratch.
+static __always_inline void capture_check(struct capture_state *cap, __u16 method_id, int found,
+                                          int batch) {
+    if (batch || (found && method_id != cap->method_id)) {
+        cap->method_id = METHOD_UNKNOWN;
+        cap->mixed = 0;
+        cap->probes_left = capture_depth;
+        cap->need_payload = 1;
+    }
+}
+
+// First byte of a send, or 0 if it cannot be read. Only that byte is read,
+// so metadata-only sends stay cheap.
+static __always_inline char send_lead(struct msghdr *msg, const void *plain, __u32 size) {
+    struct network_event_t *event = scratch_event();
+    if (!event || read_send_prefix(msg, plain, event->data, size, 1) != 1) {
+        return 0;
+    }
+    return event->data[0];
+}
+
+// Whether data opens an HTTP/1.x request or the HTTP/2 connection preface
+static __always_inline int starts_http(const char *data, __u32 len) {
+    if (len < 4) {
+        return 0;
+    }
+    char a = data[0], b = data[1], c = data[2], e = data[3];
+    return (a == 'P' && b == 'O' && c == 'S' && e == 'T') ||
+           (a == 'G' && b == 'E' && c == 'T' && e == ' ') ||
+           (a == 'P' && b == 'U' && c == 'T' && e == ' ') ||
+           (a == 'P' && b == 'A' && c == 'T' && e == 'C') ||
+           (a == 'P' && b == 'R' && c == 'I' && e == ' ');
+}
+
+// Whether a send with no method field ships its payload for reassembly:
+// only on sockets that have been seen speaking HTTP.
+static __always_inline int reassemble_send(__u64 pid_tgid, struct sock *sk, const struct dest *d,
+                                           const char *data, __u32 len) {
+    if (!reassembly) {
+        return 0;
+    }
+    struct capture_key key = {
+        .tgid = pid_tgid >> 32,
+        .sock_id = sock_id((__u64)sk),
+        .dest_ip = d->ip,
+        .dest_port = d->port,
+    };
+    if (bpf_map_lookup_elem(&http_socks, &key)) {
+        return 1;
+    }
+    if (!starts_http(data, len)) {
+        return 0;
+    }
+    __u8 one = 1;
+    bpf_map_update_elem(&http_socks, &key, &one, BPF_ANY);
+    return 1;
+}
+
+// Common send handling once the task and destination filters have passed.
+// Shared by the kprobe and fentry programs on tcp_sendmsg, which pass msg,
+// and the SSL_write return probe, which passes the plaintext buffer.
+static __always_inline int handle_send(void *ctx, __u64 pid_tgid, const struct comm_key *comm,
+                                       struct sock *sk, struct msghdr *msg, const void *plain,
+                                       __u32 size, const struct dest *d) {
+    // Payload is copied unless capture is metadata only, or the socket's
+    // method has been learned (adaptive capture depth). The learned method
+    // only labels sends that open like the probed ones did (the request line,
+    // or the body of clients writing headers apart); header-only writes and
+    // body tails stay unknown. One such send in capture_verify is copied and
+    // classified instead, so a change of method is noticed.
+    struct capture_state *cap = capture_state(pid_tgid, sk, d);
+    int copy = payload_cap != 0 && (!cap || cap->need_payload);
+    int verify = 0;
+    __u16 method_id = METHOD_UNKNOWN;
+    if (cap && !copy && cap->lead && send_lead(msg, plain, size) == cap->lead) {
+        if (capture_verify && ++cap->stamped >= capture_verify) {
+            cap->stamped = 0;
+            copy = verify = 1;
+        } else {
+            method_id = cap->method_id;
+        }
+    }
+
+    // Metadata-only record: build the header in place in the transport.
+    // Only reserve once the event is known to be wanted, so filtered and
+    // sampled-out sends never touch the transport. IPv6 records are longer
+    // than a header and take the scratch path below, which copies nothing.
+    if (!copy && capture_mode == CAPTURE_EVENTS && !d->v6) {
+        struct rate_key rkey = {
+            .tgid = pid_tgid >> 32,
+            .dest_ip = d->ip,
+            .dest_port = d->port,
+            .method_id = method_id,
+        };
+        __u32 weight = admit(&rkey, bpf_ktime_get_ns());
+        if (!weight) {
+            count_stat(DROP_SAMPLED);
+            return 0;
+        }
+        struct event_hdr *hdr = reserve_hdr();
+        if (!hdr) {
+            return 0;
+        }
+        fill_send_hdr(hdr, pid_tgid, sk, size, d, comm->comm);
+        hdr->method_id = method_id;
+        hdr->weight = weight;
+        submit_hdr(ctx, hdr);
+        return 0;
+    }
+    
+    // Payload capture: the record is built in per-CPU scratch, then trimmed
+    struct network_event_t *event = scratch_event();
+    if (!event) {
+        return 0;
+    }
+    fill_send_hdr(&event->hdr, pid_tgid, sk, size, d, comm->comm);
+    if (!copy) {
+        event->hdr.method_id = method_id;
+        event->hdr.cap_len = 0;
+        return finish_send(ctx, pid_tgid, sk, d, event, plain != 0);
+    }
+    __u32 cap_len = read_send_payload(msg, plain, event->data, size);
     
-    // Get PID and timestamp
-    __u64 id = bpf_get_current_pid_tgid();
-    event.pid = id >> 32;
-    event.timestamp_ns = bpf_ktime_get_ns();
-    event.is_send = 1;
+    // Classify in kernel and drop the payload when the method is known.
+    // Only a method field with an unrecognised name still ships its bytes
+    // so the agent can name it, and a batch so it can count every method;
+    // prefixes with no method field carry nothing userspace could use,
+    // unless it reassembles them with the sends around them on an HTTP
+    // socket.
+    int found, batch;
+    event->hdr.method_id = classify_method(event->data, cap_len, &found, &batch);
+    int ship = batch || (event->hdr.method_id == METHOD_UNKNOWN &&
+                         (found || reassemble_send(pid_tgid, sk, d, event->data, cap_len)));
+    event->hdr.cap_len = ship ? cap_len : 0;
+    if (verify) {
+        capture_check(cap, event->hdr.method_id, found, batch);
+    } else if (cap) {
+        capture_learn(cap, event->hdr.method_id, found, batch, cap_len ? event->data[0] : 0);
+    }
     
-    // Get process name
-    bpf_get_current_comm(&event.comm, sizeof(event.comm));
+    return finish_send(ctx, pid_tgid, sk, d, event, plain != 0);
+}
+
+// Called from tcp_sendmsg when the SSL probes are attached. A send made
+// inside SSL_write, or right after one whose session had no socket yet,
+// is that session's ciphertext: bind the session to the socket (emitting
+// the pending write, if any) and return 1. Sends on sockets already known
+// to carry TLS also return 1, so ciphertext is never recorded.
+static __always_inline int ssl_bind_send(void *ctx, __u64 pid_tgid, const struct comm_key *comm,
+                                         struct sock *sk, const struct dest *d) {
+    __u64 sk_key = (__u64)sk;
+    __u8 one = 1;
+    struct ssl_sock sock = {
+        .sk = sk_key,
+        .dest = *d,
+    };
     
-    // Filter: only "node" processes
-    char node_name[] = "node";
-    char comm[TASK_COMM_LEN];
-    bpf_get_current_comm(&comm, sizeof(comm));
+    struct ssl_call *call = bpf_map_lookup_elem(&ssl_calls, &pid_tgid);
+    if (call && call->is_write) {
+        bpf_map_update_elem(&ssl_socks, &call->ssl, &sock, BPF_ANY);
+        bpf_map_update_elem(&tls_socks, &sk_key, &one, BPF_ANY);
+        return 1;
+    }
     
-    int is_node = 1;
-    for (int i = 0; i < 4; i++) {
-        if (comm[i] != node_name[i]) {
-            is_node = 0;
-            break;
+    struct ssl_pending *pending = bpf_map_lookup_elem(&ssl_pending, &pid_tgid);
+    if (pending) {
+        struct ssl_pending p = *pending;
+        bpf_map_delete_elem(&ssl_pending, &pid_tgid);
+        
+        __u64 now = bpf_ktime_get_ns();
+        if (now - p.timestamp_ns <= SSL_PENDING_TIMEOUT_NS) {
+            bpf_map_update_elem(&ssl_socks, &p.ssl, &sock, BPF_ANY);
+            bpf_map_update_elem(&tls_socks, &sk_key, &one, BPF_ANY);
+            if (!filter_dest(d)) {
+                return 1;
+            }
+            
+            struct network_event_t *event = scratch_event();
+            if (!event) {
+                return 1;
+            }
+            fill_send_hdr(&event->hdr, pid_tgid, sk, p.size, d, comm->comm);
+            event->hdr.timestamp_ns = p.timestamp_ns;
+            event->hdr.method_id = p.method_id;
+            event->hdr.cap_len = 0;
+            finish_send(ctx, pid_tgid, sk, d, event, 1);
+            return 1;
         }
     }
     
-    if (!is_node) {
+    return bpf_map_lookup_elem(&tls_socks, &sk_key) != 0;
+}
+
+// Kprobe on tcp_sendmsg
+SEC("kprobe/tcp_sendmsg")
+int trace_tcp_sendmsg(struct pt_regs *ctx) {
+    if (!active()) {
+        return 0;
+    }
+    struct dest d;
+    struct comm_key comm;
+    
+    // Filter on the task before touching any arguments
+    count_stat(COUNT_CALLS);
+    __u64 pid_tgid = bpf_get_current_pid_tgid();
+    if (!filter_task(pid_tgid, &comm)) {
         return 0;
     }
     
@@ -88,55 +1402,464 @@ int trace_tcp_sendmsg(struct pt_regs *ctx) {
     __u32 size = (__u32)PT_REGS_PARM3(ctx);
     
     if (size == 0 || size > 65536) {
+        count_stat(DROP_SIZE);
         return 0;
     }
     
-    event.data_len = size;
-    
     // Extract destination IP and port
-    if (get_sock_info(sk, &event.dest_ip, &event.dest_port) != 0) {
-        // Not IPv4, skip for now
+    if (get_sock_info(sk, &d) != 0) {
+        // Not an inet socket
+        count_stat(DROP_FAMILY);
+        return 0;
+    }
+    
+    // TLS ciphertext is reported by the SSL probes instead
+    if (ssl_enabled && ssl_bind_send(ctx, pid_tgid, &comm, sk, &d)) {
+        count_stat(DROP_TLS);
+        return 0;
+    }
+    
+    if (!filter_dest(&d)) {
+        return 0;
+    }
+    
+    return handle_send(ctx, pid_tgid, &comm, sk, msg, 0, size, &d);
+}
+
+// fentry on tcp_sendmsg: same as the kprobe, but arguments arrive typed
+// through the BPF trampoline and the socket is read directly
+SEC("fentry/tcp_sendmsg")
+int BPF_PROG(fentry_tcp_sendmsg, struct sock *sk, struct msghdr *msg, __u64 size) {
+    if (!active()) {
+        return 0;
+    }
+    struct dest d;
+    struct comm_key comm;
+    
+    count_stat(COUNT_CALLS);
+    __u64 pid_tgid = bpf_get_current_pid_tgid();
+    if (!filter_task(pid_tgid, &comm)) {
+        return 0;
+    }
+    
+    if (size == 0 || size > 65536) {
+        count_stat(DROP_SIZE);
+        return 0;
+    }
+    
+    if (get_sock_info_btf(sk, &d) != 0) {
+        count_stat(DROP_FAMILY);
+        return 0;
+    }
+    
+    if (ssl_enabled && ssl_bind_send(ctx, pid_tgid, &comm, sk, &d)) {
+        count_stat(DROP_TLS);
+        return 0;
+    }
+    
+    if (!filter_dest(&d)) {
+        return 0;
+    }
+    
+    return handle_send(ctx, pid_tgid, &comm, sk, msg, 0, size, &d);
+}
+
+// Kprobe on tcp_recvmsg: remember the socket for the return probe, but only
+// if it has a request in flight
+SEC("kprobe/tcp_recvmsg")
+int trace_tcp_recvmsg(struct pt_regs *ctx) {
+    if (!active()) {
+        return 0;
+    }
+    __u64 sk = (__u64)PT_REGS_PARM1(ctx);
+    struct flow_t *flow = bpf_map_lookup_elem(&flows, &sk);
+    
+    if (!flow || flow->req_start_ns == 0) {
+        return 0;
+    }
+    
+    __u64 pid_tgid = bpf_get_current_pid_tgid();
+    bpf_map_update_elem(&recv_socks, &pid_tgid, &sk, BPF_ANY);
+    return 0;
+}
+
+// Complete the request in flight on sk with a receive that returned ret.
+// Shared by the kretprobe and fexit programs on tcp_recvmsg (tls = 0) and
+// the SSL_read return probe (tls = 1); a TLS request is only completed by
+// its plaintext response.
+static __always_inline int handle_recv_done(void *ctx, __u64 sk, int ret, __u32 tls) {
+    if (ret <= 0) {
+        return 0;  // Error, EAGAIN or EOF: keep waiting for the response
+    }
+    
+    struct flow_t *flow = bpf_map_lookup_elem(&flows, &sk);
+    if (!flow || flow->req_start_ns == 0 || flow->tls != tls) {
+        return 0;
+    }
+    
+    __u64 now = bpf_ktime_get_ns();
+    
+    if (capture_mode == CAPTURE_HIST) {
+        struct hist_key key = {
+            .dest = flow->dest,
+            .method_id = flow->method_id,
+            .direction = DIR_RECV,
+        };
+        hist_observe(&key, ret, now - flow->req_start_ns);
+        flow->req_start_ns = 0;
+        return 0;
+    }
+    
+    struct rate_key rkey = {
+        .tgid = flow->pid,
+        .dest_ip = flow->dest.ip,
+        .dest_port = flow->dest.port,
+        .method_id = flow->method_id,
+    };
+    __u32 weight = admit(&rkey, now);
+    if (!weight) {
+        count_stat(DROP_SAMPLED);
+        flow->req_start_ns = 0;
+        return 0;
+    }
+    
+    struct rpc_record *rec = (struct rpc_record *)scratch_event();
+    if (!rec) {
+        return 0;
+    }
+    
+    rec->hdr.pid = flow->pid;
+    rec->hdr.timestamp_ns = flow->req_start_ns;
+    rec->hdr.data_len = flow->req_bytes;
+    rec->hdr.sock_id = sock_id(sk);
+    rec->hdr.dest_ip = flow->dest.ip;
+    rec->hdr.dest_port = flow->dest.port;
+    rec->hdr.cap_len = 0;
+    __builtin_memcpy(rec->hdr.comm, flow->comm, TASK_COMM_LEN);
+    rec->hdr.method_id = flow->method_id;
+    rec->hdr.kind = RECORD_RPC;
+    rec->hdr.weight = weight;
+    rec->hdr.cgroup_id = flow->cgroup_id;
+    rec->latency_ns = now - flow->req_start_ns;
+    rec->resp_len = ret;
+    __u32 len = put_dest6(rec, sizeof(*rec), &flow->dest);
+    
+    // Close the request; the next send on this socket starts a new one
+    flow->req_start_ns = 0;
+    
+    if (use_ringbuf) {
+        count_output(bpf_ringbuf_output(&events, rec, len, 0));
+    } else {
+        count_output(bpf_perf_event_output(ctx, &events, BPF_F_CURRENT_CPU, rec, len));
+    }
+    return 0;
+}
+
+// Kretprobe on tcp_recvmsg: the first successful receive after a request
+// completes it
+SEC("kretprobe/tcp_recvmsg")
+int trace_tcp_recvmsg_return(struct pt_regs *ctx) {
+    if (!active()) {
         return 0;
     }
+    __u64 pid_tgid = bpf_get_current_pid_tgid();
+    __u64 *skp = bpf_map_lookup_elem(&recv_socks, &pid_tgid);
     
-    // Filter by destination port (443 for HTTPS RPC calls)
-    // You can adjust this to capture specific ports
-    if (event.dest_port != 443 && event.dest_port != 8545 && event.dest_port != 8547) {
-        return 0;  // Only capture HTTPS (443) or common RPC ports
+    if (!skp) {
+        return 0;
+    }
+    __u64 sk = *skp;
+    bpf_map_delete_elem(&recv_socks, &pid_tgid);
+    
+    return handle_recv_done(ctx, sk, (int)PT_REGS_RC(ctx), 0);
+}
+
+// fexit on tcp_recvmsg sees the socket and the return value together, so
+// it needs neither the entry probe nor recv_socks. Linux 5.19 dropped the
+// nonblock argument; the agent loads the variant matching the kernel's BTF.
+SEC("fexit/tcp_recvmsg")
+int BPF_PROG(fexit_tcp_recvmsg, struct sock *sk, struct msghdr *msg, __u64 len, int flags,
+             int *addr_len, int ret) {
+    if (!active()) {
+        return 0;
+    }
+    return handle_recv_done(ctx, (__u64)sk, ret, 0);
+}
+
+SEC("fexit/tcp_recvmsg")
+int BPF_PROG(fexit_tcp_recvmsg_nonblock, struct sock *sk, struct msghdr *msg, __u64 len,
+             int nonblock, int flags, int *addr_len, int ret) {
+    if (!active()) {
+        return 0;
+    }
+    return handle_recv_done(ctx, (__u64)sk, ret, 0);
+}
+
+// Kprobe on tcp_close: forget the socket's flow so a reused struct sock
+// address cannot inherit a stale request
+SEC("kprobe/tcp_close")
+int trace_tcp_close(struct pt_regs *ctx) {
+    if (!active()) {
+        return 0;
+    }
+    __u64 sk = (__u64)PT_REGS_PARM1(ctx);
+    
+    bpf_map_delete_elem(&flows, &sk);
+    if (ssl_enabled) {
+        bpf_map_delete_elem(&tls_socks, &sk);
+    }
+    return 0;
+}
+
+SEC("fentry/tcp_close")
+int BPF_PROG(fentry_tcp_close, struct sock *sk) {
+    if (!active()) {
+        return 0;
+    }
+    __u64 key = (__u64)sk;
+    
+    bpf_map_delete_elem(&flows, &key);
+    if (ssl_enabled) {
+        bpf_map_delete_elem(&tls_socks, &key);
+    }
+    return 0;
+}
+
+// Uprobes on the TLS library (OpenSSL, BoringSSL), attached by the agent to
+// every binary that exports SSL_write/SSL_read when SSL_PROBES is enabled.
+// They see the plaintext that tcp_sendmsg only sees encrypted.
+
+// SSL_write(SSL *ssl, const void *buf, int num): remember the arguments
+// for the return probe and for tcp_sendmsg calls made inside SSL_write
+SEC("uprobe/SSL_write")
+int trace_ssl_write(struct pt_regs *ctx) {
+    if (!active()) {
+        return 0;
+    }
+    struct comm_key comm;
+    __u64 pid_tgid = bpf_get_current_pid_tgid();
+    
+    if (!filter_task(pid_tgid, &comm)) {
+        return 0;
     }
     
-    // Try to read data from msghdr
-    // This is complex - msghdr contains iov_iter with multiple iovecs
-    // For now, we'll try to read the first iovec
-    struct iovec iov;
-    struct iov_iter *iter;
+    struct ssl_call call = {
+        .ssl = (__u64)PT_REGS_PARM1(ctx),
+        .buf = (__u64)PT_REGS_PARM2(ctx),
+        .is_write = 1,
+    };
+    bpf_map_update_elem(&ssl_calls, &pid_tgid, &call, BPF_ANY);
+    return 0;
+}
+
+// SSL_write returns the plaintext bytes written. Report them against the
+// session's socket, or leave them pending until the socket is known.
+SEC("uretprobe/SSL_write")
+int trace_ssl_write_return(struct pt_regs *ctx) {
+    if (!active()) {
+        return 0;
+    }
+    __u64 pid_tgid = bpf_get_current_pid_tgid();
+    struct ssl_call *callp = bpf_map_lookup_elem(&ssl_calls, &pid_tgid);
     
-    // Read iter from msghdr
-    bpf_probe_read_kernel(&iter, sizeof(iter), &msg->msg_iter);
+    if (!callp) {
+        return 0;
+    }
+    struct ssl_call call = *callp;
+    bpf_map_delete_elem(&ssl_calls, &pid_tgid);
     
-    // Try to read first iovec (simplified - production code needs more robust handling)
-    void *iov_base;
-    unsigned long iov_len;
+    int ret = (int)PT_REGS_RC(ctx);
+    if (!call.is_write || ret <= 0 || ret > 65536) {
+        return 0;
+    }
     
-    // This is a simplified approach - real implementation would need to handle
-    // different iter types (ITER_IOVEC, ITER_KVEC, etc.)
-    // For HTTP/HTTPS traffic, we usually get ITER_IOVEC
+    struct comm_key comm;
+    bpf_get_current_comm(comm.comm, sizeof(comm.comm));
     
-    // Read up to MAX_DATA_SIZE bytes
-    __u32 read_size = size < MAX_DATA_SIZE ? size : MAX_DATA_SIZE;
-    if (read_size > 0 && read_size <= MAX_DATA_SIZE) {
-        // BPF verifier needs bounds check
-        read_size = read_size & (MAX_DATA_SIZE - 1);
-        if (read_size > 0) {
-            // Note: This is a placeholder - actual payload reading from msghdr
-            // requires more complex logic to traverse iov_iter
-            // For now, we just send metadata
+    struct ssl_sock *sockp = bpf_map_lookup_elem(&ssl_socks, &call.ssl);
+    if (sockp) {
+        struct ssl_sock sock = *sockp;
+        if (!filter_dest(&sock.dest)) {
+            return 0;
         }
+        return handle_send(ctx, pid_tgid, &comm, (struct sock *)sock.sk, 0, (const void *)call.buf,
+                           ret, &sock.dest);
+    }
+    
+    // No socket yet: classify now, while the buffer is still valid
+    struct ssl_pending pending = {
+        .ssl = call.ssl,
+        .timestamp_ns = bpf_ktime_get_ns(),
+        .size = ret,
+        .method_id = METHOD_UNKNOWN,
+    };
+    struct network_event_t *event = scratch_event();
+    if (event) {
+        int found, batch;
+        __u32 cap_len = read_send_payload(0, (const void *)call.buf, event->data, ret);
+        pending.method_id = classify_method(event->data, cap_len, &found, &batch);
+    }
+    bpf_map_update_elem(&ssl_pending, &pid_tgid, &pending, BPF_ANY);
+    return 0;
+}
+
+// SSL_read(SSL *ssl, void *buf, int num)
+SEC("uprobe/SSL_read")
+int trace_ssl_read(struct pt_regs *ctx) {
+    if (!active()) {
+        return 0;
+    }
+    __u64 pid_tgid = bpf_get_current_pid_tgid();
+    struct ssl_call call = {
+        .ssl = (__u64)PT_REGS_PARM1(ctx),
+    };
+    
+    // Only sessions bound to a socket can have a request in flight
+    if (!bpf_map_lookup_elem(&ssl_socks, &call.ssl)) {
+        return 0;
+    }
+    bpf_map_update_elem(&ssl_calls, &pid_tgid, &call, BPF_ANY);
+    return 0;
+}
+
+// SSL_read returns the plaintext bytes read: the first successful read after
+// a request completes it
+SEC("uretprobe/SSL_read")
+int trace_ssl_read_return(struct pt_regs *ctx) {
+    if (!active()) {
+        return 0;
+    }
+    __u64 pid_tgid = bpf_get_current_pid_tgid();
+    struct ssl_call *callp = bpf_map_lookup_elem(&ssl_calls, &pid_tgid);
+    
+    if (!callp) {
+        return 0;
+    }
+    __u64 ssl = callp->ssl;
+    __u32 is_write = callp->is_write;
+    bpf_map_delete_elem(&ssl_calls, &pid_tgid);
+    if (is_write) {
+        return 0;
+    }
+    
+    struct ssl_sock *sock = bpf_map_lookup_elem(&ssl_socks, &ssl);
+    if (!sock) {
+        return 0;
     }
+    return handle_recv_done(ctx, sock->sk, (int)PT_REGS_RC(ctx), 1);
+}
+
+// SSL_free(SSL *ssl): forget the session so a reused SSL * address cannot
+// inherit its socket
+SEC("uprobe/SSL_free")
+int trace_ssl_free(struct pt_regs *ctx) {
+    if (!active()) {
+        return 0;
+    }
+    __u64 ssl = (__u64)PT_REGS_PARM1(ctx);
+    
+    bpf_map_delete_elem(&ssl_socks, &ssl);
+    return 0;
+}
+
+// Uprobes on a Go RPC server (geth/nitro), attached by the agent when
+// SERVER_PROBES is enabled: one at the entry of the dispatcher and one at
+// each of its RET instructions. uretprobes rewrite the return address on the
+// goroutine stack, which the Go runtime copies and unwinds, so they are
+// unsafe in Go programs.
+
+// Integer argument n of a function using Go's register ABI (Go 1.17+)
+static __always_inline __u64 go_arg(struct pt_regs *ctx, __s32 n) {
+#if defined(__TARGET_ARCH_x86)
+    switch (n) {
+    case 0: return ctx->ax;
+    case 1: return ctx->bx;
+    case 2: return ctx->cx;
+    case 3: return ctx->di;
+    case 4: return ctx->si;
+    case 5: return ctx->r8;
+    }
+    return 0;
+#elif defined(__TARGET_ARCH_arm64)
+    return n >= 0 && n < 8 ? ctx->regs[n] : 0;
+#endif
+}
+
+// Current goroutine: the g register of Go's ABI (R14 on amd64, R28 on arm64)
+static __always_inline __u64 go_goroutine(struct pt_regs *ctx) {
+#if defined(__TARGET_ARCH_x86)
+    return ctx->r14;
+#elif defined(__TARGET_ARCH_arm64)
+    return ctx->regs[28];
+#endif
+}
+
+// Look up the method of the request in server_method_arg
+static __always_inline __u16 go_request_method(struct pt_regs *ctx) {
+    struct method_key key = {};
+    struct {
+        __u64 ptr;
+        __u64 len;
+    } str;
+    
+    if (server_method_arg < 0) {
+        return METHOD_UNKNOWN;
+    }
+    __u64 req = go_arg(ctx, server_method_arg);
+    if (!req || bpf_probe_read_user(&str, sizeof(str), (void *)(req + server_method_off)) != 0) {
+        return METHOD_UNKNOWN;
+    }
+    if (str.len == 0 || str.len >= METHOD_NAME_LEN) {
+        return METHOD_UNKNOWN;
+    }
+    if (bpf_probe_read_user(key.name, str.len & (METHOD_NAME_LEN - 1), (void *)str.ptr) != 0) {
+        return METHOD_UNKNOWN;
+    }
+    __u16 *id = bpf_map_lookup_elem(&method_ids, &key);
+    return id ? *id : METHOD_UNKNOWN;
+}
+
+SEC("uprobe/go_server_enter")
+int trace_go_server_enter(struct pt_regs *ctx) {
+    if (!active()) {
+        return 0;
+    }
+    struct go_call_key key = {
+        .tgid = bpf_get_current_pid_tgid() >> 32,
+        .g = go_goroutine(ctx),
+    };
+    struct go_call call = {
+        .start_ns = bpf_ktime_get_ns(),
+        .method_id = go_request_method(ctx),
+    };
     
-    // Send event
-    bpf_perf_event_output(ctx, &events, BPF_F_CURRENT_CPU, &event, sizeof(event));
+    // A call that grows its stack re-enters from the top; the later start wins
+    bpf_map_update_elem(&go_calls, &key, &call, BPF_ANY);
+    return 0;
+}
+
+SEC("uprobe/go_server_return")
+int trace_go_server_return(struct pt_regs *ctx) {
+    if (!active()) {
+        return 0;
+    }
+    struct go_call_key key = {
+        .tgid = bpf_get_current_pid_tgid() >> 32,
+        .g = go_goroutine(ctx),
+    };
+    struct go_call *call = bpf_map_lookup_elem(&go_calls, &key);
+    
+    if (!call) {
+        return 0;
+    }
+    struct hist_key hkey = {
+        .method_id = call->method_id,
+        .direction = DIR_SERVER,
+    };
+    __u64 latency_ns = bpf_ktime_get_ns() - call->start_ns;
+    bpf_map_delete_elem(&go_calls, &key);
     
+    hist_observe(&hkey, 0, latency_ns);
     return 0;
 }
 
@@ -0,0 +1,45 @@
+package main
+
+import (
+	"fmt"
+
+	"github.com/cilium/ebpf"
+)
+
+// Sampling configuration - can be overridden by environment variables.
+// Both apply in kernel to events and flows records; histogram mode already
+// aggregates every send in kernel and is never sampled.
+var (
+	SampleEvery = getEnvInt("SAMPLE_EVERY", 1) // Keep 1 in N records at random
+	RateLimit   = getEnvInt("RATE_LIMIT", 0)   // Records per second per (process, destination, method); 0 = unlimited
+	RateBurst   = getEnvInt("RATE_BURST", 0)   // Token bucket size; 0 = RateLimit
+)
+
+// configureSampling sets the sampling and rate limit constants in spec.
+// Emitted records carry a weight: the number of events they stand for.
+func configureSampling(spec *ebpf.CollectionSpec) error {
+	if SampleEvery < 0 || RateLimit < 0 || RateBurst < 0 {
+		return fmt.Errorf("SAMPLE_EVERY, RATE_LIMIT and RATE_BURST must not be negative")
+	}
+	if RateLimit > 1000000 {
+		return fmt.Errorf("RATE_LIMIT must be at most 1000000, got %d", RateLimit)
+	}
+
+	sampleEvery := SampleEvery
+	if sampleEvery == 0 {
+		sampleEvery = 1
+	}
+	burst := RateBurst
+	if burst == 0 {
+		burst = RateLimit
+	}
+	if burst == 0 {
+		burst = 1
+	}
+
+	return spec.RewriteConstants(map[string]interface{}{
+		"sample_every": uint32(sampleEvery),
+		"rate_limit":   uint32(RateLimit),
+		"rate_burst":   uint32(burst),
+	})
+}
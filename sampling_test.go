@@ -0,0 +1,73 @@
+package main
+
+import (
+	"context"
+	"encoding/binary"
+	"testing"
+)
+
+// weighted sets the sample weight of a raw record.
+func weighted(raw []byte, weight uint32) []byte {
+	binary.LittleEndian.PutUint32(raw[offWeight:], weight)
+	return raw
+}
+
+// publishedFeatures processes raw and returns the features it queued.
+func publishedFeatures(t *testing.T, raw []byte) []MonitoringFeature {
+	t.Helper()
+	DebugMode = false
+	ctx, cancel := context.WithCancel(context.Background())
+	defer cancel()
+	a, err := benchAgent(ctx)
+	if err != nil {
+		t.Fatal(err)
+	}
+	p := &eventPipeline{agent: a}
+	var event RPCEvent
+	p.process(raw, &event, nil, false)
+	var features []MonitoringFeature
+	for len(a.Publisher.queue) > 0 {
+		features = append(features, <-a.Publisher.queue)
+	}
+	return features
+}
+
+func TestSampleWeightScalesSend(t *testing.T) {
+	hdr := RPCEventHeader{DataLen: 300, DestPort: 8545, MethodID: 1, Kind: recordSend}
+	features := publishedFeatures(t, weighted(benchRecord(hdr, "", nil), 5))
+	if len(features) != 1 {
+		t.Fatalf("got %d features, want 1", len(features))
+	}
+	d := features[0].Details.(*eventDetails)
+	if features[0].Value != 1500 || d.SizeBytes != 300 || d.Weight != 5 {
+		t.Errorf("value %.0f, size_bytes %d, sample_weight %d; want 1500, 300, 5", features[0].Value, d.SizeBytes, d.Weight)
+	}
+}
+
+func TestSampleWeightScalesBatch(t *testing.T) {
+	payload := `[{"method":"eth_call"},{"method":"eth_call"}]`
+	hdr := RPCEventHeader{DataLen: uint32(len(payload)), DestPort: 8545, Kind: recordSend}
+	features := publishedFeatures(t, weighted(benchRecord(hdr, payload, nil), 3))
+	if len(features) != 1 {
+		t.Fatalf("got %d features, want 1", len(features))
+	}
+	d := features[0].Details.(*eventDetails)
+	if d.BatchCount != 6 || features[0].Value != float64(3*len(payload)) {
+		t.Errorf("batch_count %d, value %.0f; want 6, %d", d.BatchCount, features[0].Value, 3*len(payload))
+	}
+}
+
+func TestSampleWeightScalesCompletion(t *testing.T) {
+	hdr := RPCEventHeader{DataLen: 300, DestPort: 8545, MethodID: 1, Kind: recordRPC}
+	raw := weighted(benchRecord(hdr, "", &rpcRecordTrailer{LatencyNs: 2e6, RespLen: 900}), 4)
+	features := publishedFeatures(t, raw)
+	want := map[string]float64{"request_size": 1200, "response_size": 3600, "latency_ms": 2}
+	if len(features) != len(want) {
+		t.Fatalf("got %d features, want %d", len(features), len(want))
+	}
+	for _, f := range features {
+		if f.Value != want[f.FeatureType] {
+			t.Errorf("%s = %v, want %v", f.FeatureType, f.Value, want[f.FeatureType])
+		}
+	}
+}
@@ -0,0 +1,236 @@
+package main
+
+import (
+	"debug/elf"
+	"debug/gosym"
+	"encoding/binary"
+	"fmt"
+	"log"
+	"os"
+
+	"github.com/cilium/ebpf"
+	"github.com/cilium/ebpf/link"
+)
+
+// Server probe configuration - can be overridden by environment variables.
+// The probed function is TARGET_SYMBOL in TARGET_BINARY. The defaults read
+// the method from the *jsonrpcMessage argument of go-ethereum's
+// (*handler).handleCallMsg, where Method follows Version and ID.
+var (
+	ServerProbes       = getEnv("SERVER_PROBES", "false") == "true"
+	TargetMethodArg    = getEnvInt("TARGET_METHOD_ARG", 2)     // Integer argument pointing to the request (-1 = no method)
+	TargetMethodOffset = getEnvInt("TARGET_METHOD_OFFSET", 40) // Offset of the method string in the request
+)
+
+// maxServerReturns bounds the return probes attached to one function
+const maxServerReturns = 64
+
+// serverHostname is the destination token of server-side subjects
+var serverHostname = func() string {
+	name, err := os.Hostname()
+	if err != nil || name == "" {
+		return "localhost"
+	}
+	return sanitizeHostname(name)
+}()
+
+// serverPrograms time a Go RPC server's dispatcher from entry to each RET
+// and aggregate the result into the DIR_SERVER histograms.
+type serverPrograms struct {
+	TraceGoServerEnter  *ebpf.Program `ebpf:"trace_go_server_enter"`
+	TraceGoServerReturn *ebpf.Program `ebpf:"trace_go_server_return"`
+}
+
+func (p *serverPrograms) Close() error {
+	return closePrograms(p.TraceGoServerEnter, p.TraceGoServerReturn)
+}
+
+// configureServer sets the request method location for the server probes.
+func configureServer(spec *ebpf.CollectionSpec) error {
+	if TargetMethodArg > 5 || TargetMethodOffset < 0 {
+		return fmt.Errorf("TARGET_METHOD_ARG must be at most 5 and TARGET_METHOD_OFFSET non-negative")
+	}
+	return spec.RewriteConstants(map[string]interface{}{
+		"server_method_arg": int32(TargetMethodArg),
+		"server_method_off": uint32(TargetMethodOffset),
+	})
+}
+
+// goFunction is the file offsets of a function's entry and RET instructions.
+type goFunction struct {
+	entry   uint64
+	returns []uint64
+}
+
+// resolveGoFunction finds symbol in the ELF file at path and locates its
+// RET instructions.
+func resolveGoFunction(path, symbol string) (*goFunction, error) {
+	f, err := elf.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+
+	start, end, err := goFunctionBounds(f, symbol)
+	if err != nil {
+		return nil, err
+	}
+	entry, ok := fileOffset(f, start)
+	if !ok {
+		return nil, fmt.Errorf("%s is not in an executable segment", symbol)
+	}
+	code, err := readText(f, start, end)
+	if err != nil {
+		return nil, fmt.Errorf("failed to read %s: %w", symbol, err)
+	}
+
+	var rets []uint64
+	switch f.Machine {
+	case elf.EM_AARCH64:
+		rets = arm64Returns(code)
+	case elf.EM_X86_64:
+		rets = amd64Returns(code)
+	default:
+		return nil, fmt.Errorf("unsupported machine %s", f.Machine)
+	}
+	if len(rets) == 0 {
+		return nil, fmt.Errorf("no return instructions found in %s", symbol)
+	}
+	if len(rets) > maxServerReturns {
+		return nil, fmt.Errorf("%s has %d return instructions, more than %d", symbol, len(rets), maxServerReturns)
+	}
+
+	fn := &goFunction{entry: entry}
+	for _, r := range rets {
+		fn.returns = append(fn.returns, entry+r)
+	}
+	return fn, nil
+}
+
+// goFunctionBounds returns the virtual address range of symbol, from the
+// symbol table or, in stripped binaries, from Go's pclntab.
+func goFunctionBounds(f *elf.File, symbol string) (uint64, uint64, error) {
+	if syms, err := f.Symbols(); err == nil {
+		for _, sym := range syms {
+			if sym.Name == symbol && elf.ST_TYPE(sym.Info) == elf.STT_FUNC && sym.Size > 0 {
+				return sym.Value, sym.Value + sym.Size, nil
+			}
+		}
+	}
+
+	pclntab, text := f.Section(".gopclntab"), f.Section(".text")
+	if pclntab == nil || text == nil {
+		return 0, 0, fmt.Errorf("symbol %s not found and no Go pclntab", symbol)
+	}
+	data, err := pclntab.Data()
+	if err != nil {
+		return 0, 0, fmt.Errorf("failed to read pclntab: %w", err)
+	}
+	table, err := gosym.NewTable(nil, gosym.NewLineTable(data, text.Addr))
+	if err != nil {
+		return 0, 0, fmt.Errorf("failed to parse pclntab: %w", err)
+	}
+	fn := table.LookupFunc(symbol)
+	if fn == nil {
+		return 0, 0, fmt.Errorf("symbol %s not found", symbol)
+	}
+	return fn.Entry, fn.End, nil
+}
+
+// readText reads the code in [start, end) from its executable segment.
+func readText(f *elf.File, start, end uint64) ([]byte, error) {
+	for _, prog := range f.Progs {
+		if prog.Type != elf.PT_LOAD || prog.Flags&elf.PF_X == 0 {
+			continue
+		}
+		if start >= prog.Vaddr && end <= prog.Vaddr+prog.Filesz {
+			code := make([]byte, end-start)
+			if _, err := prog.ReadAt(code, int64(start-prog.Vaddr)); err != nil {
+				return nil, err
+			}
+			return code, nil
+		}
+	}
+	return nil, fmt.Errorf("range %#x-%#x is not in an executable segment", start, end)
+}
+
+// arm64Returns returns the offsets of RET (x30) in code. Instructions are
+// fixed-size and aligned, so this is exact.
+func arm64Returns(code []byte) []uint64 {
+	const ret = 0xd65f03c0
+	var offs []uint64
+	for off := 0; off+4 <= len(code); off += 4 {
+		if binary.LittleEndian.Uint32(code[off:]) == ret {
+			offs = append(offs, uint64(off))
+		}
+	}
+	return offs
+}
+
+// amd64Returns returns the offsets of the RETs of Go's frame epilogue in
+// code: ADDQ $framesize, SP; POPQ BP; RET. x86 instructions are variable
+// length, so a lone 0xc3 byte could sit inside another instruction, and a
+// probe there would corrupt it. Only RETs behind the full epilogue are
+// taken; functions without a frame pointer yield none and are refused.
+func amd64Returns(code []byte) []uint64 {
+	var offs []uint64
+	for off := 0; off+2 <= len(code); off++ {
+		if code[off] != 0x5d || code[off+1] != 0xc3 {
+			continue
+		}
+		imm8 := off >= 4 && code[off-4] == 0x48 && code[off-3] == 0x83 && code[off-2] == 0xc4
+		imm32 := off >= 7 && code[off-7] == 0x48 && code[off-6] == 0x81 && code[off-5] == 0xc4
+		if imm8 || imm32 {
+			offs = append(offs, uint64(off+1))
+		}
+	}
+	return offs
+}
+
+// serverProbe holds the attached server probes.
+type serverProbe struct {
+	progs *serverPrograms
+	links []link.Link
+}
+
+// attachServerProbes loads the server programs on top of the tracer's maps
+// and attaches them to TARGET_SYMBOL in TARGET_BINARY.
+func attachServerProbes(spec *ebpf.CollectionSpec, maps *rpcMaps) (*serverProbe, error) {
+	fn, err := resolveGoFunction(TargetBinary, TargetSymbol)
+	if err != nil {
+		return nil, fmt.Errorf("server probes: %w", err)
+	}
+
+	var progs serverPrograms
+	if err := spec.LoadAndAssign(&progs, collectionOptions(maps.byName())); err != nil {
+		return nil, fmt.Errorf("failed to load server probes: %w", err)
+	}
+	p := &serverProbe{progs: &progs}
+
+	ex, err := link.OpenExecutable(TargetBinary)
+	if err != nil {
+		p.Close()
+		return nil, fmt.Errorf("server probes: %w", err)
+	}
+	l, err := ex.Uprobe(TargetSymbol, progs.TraceGoServerEnter, &link.UprobeOptions{Address: fn.entry, PID: TargetPID})
+	if err != nil {
+		p.Close()
+		return nil, fmt.Errorf("failed to attach Uprobe to %s: %w", TargetSymbol, err)
+	}
+	p.links = append(p.links, l)
+	for _, ret := range fn.returns {
+		l, err := ex.Uprobe(TargetSymbol, progs.TraceGoServerReturn, &link.UprobeOptions{Address: ret, PID: TargetPID})
+		if err != nil {
+			p.Close()
+			return nil, fmt.Errorf("failed to attach Uprobe to %s+%#x: %w", TargetSymbol, ret-fn.entry, err)
+		}
+		p.links = append(p.links, l)
+	}
+	log.Printf("Server probes attached to %s in %s (entry + %d returns)", TargetSymbol, TargetBinary, len(fn.returns))
+	return p, nil
+}
+
+func (p *serverProbe) Close() error {
+	closeLinks(p.links)
+	return p.progs.Close()
+}
@@ -0,0 +1,451 @@
+package main
+
+import (
+	"encoding/binary"
+	"fmt"
+	"log"
+	"math"
+	"os"
+	"path/filepath"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"syscall"
+	"time"
+)
+
+// Spool configuration - can be overridden by environment variables
+var (
+	SpoolDir          = getEnv("SPOOL_DIR", "")                  // Messages are spooled here while NATS is unreachable (empty = off)
+	SpoolMode         = getEnv("SPOOL_MODE", SpoolFallback)      // fallback, or capture to spool every message instead of NATS
+	SpoolMaxBytes     = getEnvInt("SPOOL_MAX_BYTES", 256<<20)    // The oldest segment is dropped beyond this
+	SpoolSegmentBytes = getEnvInt("SPOOL_SEGMENT_BYTES", 16<<20) // Size of each segment file
+	SpoolReplayRate   = getEnvInt("SPOOL_REPLAY_RATE", 2000)     // Spooled messages replayed per second once NATS is back
+)
+
+// Spool modes
+const (
+	SpoolFallback = "fallback"
+	SpoolCapture  = "capture"
+)
+
+// Spooled message kinds, the encoding of the data
+const (
+	spoolJSON    byte = 0
+	spoolMsgpack byte = 1
+)
+
+// A spool is a directory of segment files named by sequence number, each
+// preallocated to SPOOL_SEGMENT_BYTES and memory-mapped. A segment starts
+// with a 16-byte header, the magic "RPCSPOOL" and the little-endian offset
+// replay has reached, followed by records:
+//
+//	u32 length | u16 subject length | u8 kind | subject | data
+//
+// where length counts the bytes after itself. A zero length ends the
+// segment. The length is written last, so a record cut short when the agent
+// dies is never read back.
+const (
+	spoolMagic      = "RPCSPOOL"
+	spoolHeaderSize = 16
+	spoolRecordHead = 7
+	spoolReplayTick = 10 * time.Millisecond
+)
+
+// spoolMessage is one message read back from a spool.
+type spoolMessage struct {
+	subject string
+	kind    byte
+	data    []byte
+}
+
+// spoolSegment is one segment file.
+type spoolSegment struct {
+	seq  uint64
+	path string
+	data []byte // Shared mapping of the whole file
+	end  int    // Write offset
+}
+
+func (s *spoolSegment) cursor() int       { return int(binary.LittleEndian.Uint64(s.data[8:])) }
+func (s *spoolSegment) setCursor(off int) { binary.LittleEndian.PutUint64(s.data[8:], uint64(off)) }
+
+// record parses the record at off. next is the offset after it, or 0 past
+// the last record.
+func (s *spoolSegment) record(off int) (subject, data []byte, kind byte, next int) {
+	le := binary.LittleEndian
+	if off+spoolRecordHead > len(s.data) {
+		return nil, nil, 0, 0
+	}
+	n := int(le.Uint32(s.data[off:]))
+	if n < spoolRecordHead-4 || off+4+n > len(s.data) {
+		return nil, nil, 0, 0
+	}
+	sl := int(le.Uint16(s.data[off+4:]))
+	if spoolRecordHead-4+sl > n {
+		return nil, nil, 0, 0
+	}
+	body := s.data[off+spoolRecordHead : off+4+n]
+	return body[:sl], body[sl:], s.data[off+6], off + 4 + n
+}
+
+// scan finds the end of the written records.
+func (s *spoolSegment) scan() {
+	s.end = spoolHeaderSize
+	for {
+		_, _, _, next := s.record(s.end)
+		if next == 0 {
+			return
+		}
+		s.end = next
+	}
+}
+
+// pending counts the records replay has not reached.
+func (s *spoolSegment) pending() (n int) {
+	for off := s.cursor(); ; n++ {
+		if _, _, _, off = s.record(off); off == 0 {
+			return n
+		}
+	}
+}
+
+func (s *spoolSegment) close() error {
+	return syscall.Munmap(s.data)
+}
+
+// openSegment maps an existing segment file read-write.
+func openSegment(path string) (*spoolSegment, error) {
+	f, err := os.OpenFile(path, os.O_RDWR, 0)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+	fi, err := f.Stat()
+	if err != nil {
+		return nil, err
+	}
+	if fi.Size() < spoolHeaderSize || fi.Size() > math.MaxInt32 {
+		return nil, fmt.Errorf("%s: bad segment size %d", path, fi.Size())
+	}
+	data, err := syscall.Mmap(int(f.Fd()), 0, int(fi.Size()), syscall.PROT_READ|syscall.PROT_WRITE, syscall.MAP_SHARED)
+	if err != nil {
+		return nil, fmt.Errorf("failed to map %s: %w", path, err)
+	}
+	seg := &spoolSegment{path: path, data: data}
+	if string(data[:len(spoolMagic)]) != spoolMagic {
+		seg.close()
+		return nil, fmt.Errorf("%s: not a spool segment", path)
+	}
+	seg.scan()
+	if c := seg.cursor(); c < spoolHeaderSize || c > seg.end {
+		seg.setCursor(spoolHeaderSize)
+	}
+	return seg, nil
+}
+
+// createSegment preallocates and maps a new segment file.
+func createSegment(path string, size int) (*spoolSegment, error) {
+	f, err := os.OpenFile(path, os.O_RDWR|os.O_CREATE|os.O_EXCL, 0o644)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+	if err := f.Truncate(int64(size)); err != nil {
+		os.Remove(path)
+		return nil, err
+	}
+	data, err := syscall.Mmap(int(f.Fd()), 0, size, syscall.PROT_READ|syscall.PROT_WRITE, syscall.MAP_SHARED)
+	if err != nil {
+		os.Remove(path)
+		return nil, fmt.Errorf("failed to map %s: %w", path, err)
+	}
+	copy(data, spoolMagic)
+	seg := &spoolSegment{path: path, data: data, end: spoolHeaderSize}
+	seg.setCursor(spoolHeaderSize)
+	return seg, nil
+}
+
+// segmentPaths lists the segment files of dir, oldest first.
+func segmentPaths(dir string) ([]string, error) {
+	paths, err := filepath.Glob(filepath.Join(dir, "*.seg"))
+	if err != nil {
+		return nil, err
+	}
+	sort.Strings(paths) // Fixed-width hex names
+	return paths, nil
+}
+
+func segmentSeq(path string) (uint64, error) {
+	return strconv.ParseUint(strings.TrimSuffix(filepath.Base(path), ".seg"), 16, 64)
+}
+
+// spool holds messages that could not be published, in order, on disk.
+// The publisher goroutine appends and the replay goroutine consumes.
+type spool struct {
+	dir      string
+	segBytes int
+	maxBytes int
+	capture  bool
+
+	mu   sync.Mutex
+	segs []*spoolSegment // Oldest first; the last is written
+
+	wake     chan struct{} // Signalled on append, wakes replay
+	spooled  atomic.Uint64 // Messages written
+	replayed atomic.Uint64 // Messages replayed to NATS
+	dropped  atomic.Uint64 // Messages lost to SPOOL_MAX_BYTES or too large for a segment
+}
+
+// openSpool opens SPOOL_DIR, or returns nil when spooling is off.
+func openSpool() (*spool, error) {
+	if SpoolDir == "" {
+		return nil, nil
+	}
+	if SpoolMode != SpoolFallback && SpoolMode != SpoolCapture {
+		return nil, fmt.Errorf("unknown SPOOL_MODE %q (want fallback or capture)", SpoolMode)
+	}
+	return newSpool(SpoolDir, SpoolSegmentBytes, SpoolMaxBytes, SpoolMode == SpoolCapture)
+}
+
+// newSpool opens the segments left in dir by a previous agent, so their
+// messages are replayed too.
+func newSpool(dir string, segBytes, maxBytes int, capture bool) (*spool, error) {
+	if segBytes < 4096 || segBytes > math.MaxInt32 || maxBytes < segBytes {
+		return nil, fmt.Errorf("SPOOL_SEGMENT_BYTES must be between 4096 and SPOOL_MAX_BYTES")
+	}
+	if err := os.MkdirAll(dir, 0o700); err != nil {
+		return nil, fmt.Errorf("failed to create spool directory: %w", err)
+	}
+	paths, err := segmentPaths(dir)
+	if err != nil {
+		return nil, fmt.Errorf("failed to list spool segments: %w", err)
+	}
+	s := &spool{dir: dir, segBytes: segBytes, maxBytes: maxBytes, capture: capture, wake: make(chan struct{}, 1)}
+	for _, path := range paths {
+		seq, err := segmentSeq(path)
+		if err != nil {
+			continue
+		}
+		seg, err := openSegment(path)
+		if err != nil {
+			log.Printf("Discarding spool segment: %v", err)
+			os.Remove(path)
+			continue
+		}
+		seg.seq = seq
+		s.segs = append(s.segs, seg)
+	}
+	if backlog := s.backlog(); backlog > 0 {
+		log.Printf("Spool %s holds %d bytes from a previous run", dir, backlog)
+	}
+	return s, nil
+}
+
+// append writes one message, starting a new segment when the current one
+// is full.
+func (s *spool) append(subject string, kind byte, data []byte) error {
+	n := spoolRecordHead + len(subject) + len(data)
+	if n > s.segBytes-spoolHeaderSize || len(subject) > math.MaxUint16 {
+		s.dropped.Add(1)
+		return fmt.Errorf("%d byte message does not fit a %d byte spool segment", n, s.segBytes)
+	}
+
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	seg := s.last()
+	if seg == nil || seg.end+n > len(seg.data) {
+		var err error
+		if seg, err = s.rotate(); err != nil {
+			s.dropped.Add(1)
+			return err
+		}
+	}
+	le := binary.LittleEndian
+	b := seg.data[seg.end : seg.end+n]
+	le.PutUint16(b[4:], uint16(len(subject)))
+	b[6] = kind
+	copy(b[spoolRecordHead:], subject)
+	copy(b[spoolRecordHead+len(subject):], data)
+	le.PutUint32(b, uint32(n-4)) // Last, see the format above
+	seg.end += n
+	s.spooled.Add(1)
+
+	select {
+	case s.wake <- struct{}{}:
+	default:
+	}
+	return nil
+}
+
+func (s *spool) last() *spoolSegment {
+	if len(s.segs) == 0 {
+		return nil
+	}
+	return s.segs[len(s.segs)-1]
+}
+
+// rotate starts a new segment, first dropping the oldest ones so the spool
+// stays within maxBytes. s.mu must be held.
+func (s *spool) rotate() (*spoolSegment, error) {
+	seq := uint64(1)
+	if last := s.last(); last != nil {
+		seq = last.seq + 1
+	}
+	total := 0
+	for _, seg := range s.segs {
+		total += len(seg.data)
+	}
+	for len(s.segs) > 0 && total+s.segBytes > s.maxBytes {
+		oldest := s.segs[0]
+		lost := oldest.pending()
+		if lost > 0 {
+			s.dropped.Add(uint64(lost))
+			log.Printf("Warning: spool full, dropped %d unreplayed messages", lost)
+		}
+		total -= len(oldest.data)
+		s.removeOldest()
+	}
+
+	path := filepath.Join(s.dir, fmt.Sprintf("%016x.seg", seq))
+	seg, err := createSegment(path, s.segBytes)
+	if err != nil {
+		return nil, fmt.Errorf("failed to create spool segment: %w", err)
+	}
+	seg.seq = seq
+	s.segs = append(s.segs, seg)
+	return seg, nil
+}
+
+// removeOldest unmaps and deletes the oldest segment. s.mu must be held.
+func (s *spool) removeOldest() {
+	seg := s.segs[0]
+	s.segs = s.segs[1:]
+	seg.close()
+	if err := os.Remove(seg.path); err != nil {
+		log.Printf("Failed to remove spool segment: %v", err)
+	}
+}
+
+// replay hands the oldest unreplayed message to publish and moves past it
+// once publish succeeds. It returns false when nothing is left. Segments
+// are deleted once replayed, except the one being written.
+func (s *spool) replay(publish func(subject string, kind byte, data []byte) error) (bool, error) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	for len(s.segs) > 0 {
+		seg := s.segs[0]
+		subject, data, kind, next := seg.record(seg.cursor())
+		if next == 0 {
+			if len(s.segs) == 1 {
+				return false, nil
+			}
+			s.removeOldest()
+			continue
+		}
+		if err := publish(string(subject), kind, data); err != nil {
+			return false, err
+		}
+		seg.setCursor(next)
+		s.replayed.Add(1)
+		return true, nil
+	}
+	return false, nil
+}
+
+// backlog returns the bytes spooled but not yet replayed.
+func (s *spool) backlog() int64 {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	var n int64
+	for _, seg := range s.segs {
+		n += int64(seg.end - seg.cursor())
+	}
+	return n
+}
+
+// Close unmaps the segments. The files stay for the next agent.
+func (s *spool) Close() {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	for _, seg := range s.segs {
+		seg.close()
+	}
+	s.segs = nil
+}
+
+// readSpool reads every message in dir, replayed or not, without changing
+// it. It reads captures made with SPOOL_MODE=capture.
+func readSpool(dir string) ([]spoolMessage, error) {
+	paths, err := segmentPaths(dir)
+	if err != nil {
+		return nil, err
+	}
+	var msgs []spoolMessage
+	for _, path := range paths {
+		data, err := os.ReadFile(path)
+		if err != nil {
+			return nil, err
+		}
+		if len(data) < spoolHeaderSize || string(data[:len(spoolMagic)]) != spoolMagic {
+			return nil, fmt.Errorf("%s: not a spool segment", path)
+		}
+		seg := &spoolSegment{data: data}
+		for off := spoolHeaderSize; ; {
+			subject, body, kind, next := seg.record(off)
+			if next == 0 {
+				break
+			}
+			msgs = append(msgs, spoolMessage{string(subject), kind, body})
+			off = next
+		}
+	}
+	if len(msgs) == 0 {
+		return nil, fmt.Errorf("%s: no spooled messages", dir)
+	}
+	return msgs, nil
+}
+
+// replaySpool replays spooled messages while NATS is connected, at most
+// SPOOL_REPLAY_RATE per second and only while the live queue is less than
+// half full, so a backlog never holds up live features. It returns once
+// the publisher stops.
+func (p *publisher) replaySpool() {
+	ticker := time.NewTicker(spoolReplayTick)
+	defer ticker.Stop()
+	perTick := float64(SpoolReplayRate) * spoolReplayTick.Seconds()
+	budget, idle := 0.0, false
+	for {
+		if idle {
+			select {
+			case <-p.stop:
+				return
+			case <-p.spool.wake:
+				idle = false
+			}
+		}
+		select {
+		case <-p.stop:
+			return
+		case <-ticker.C:
+		}
+		if !p.nc.IsConnected() || len(p.queue) > cap(p.queue)/2 {
+			budget = 0
+			continue
+		}
+		budget = min(budget+perTick, max(perTick, 1)) // No bursts after a pause
+		for ; budget >= 1; budget-- {
+			more, err := p.spool.replay(p.publishNATS)
+			if err != nil {
+				log.Printf("Spool replay paused: %v", err)
+				break
+			}
+			if !more {
+				idle = true
+				break
+			}
+		}
+	}
+}
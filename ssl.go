@@ -0,0 +1,388 @@
+package main
+
+import (
+	"bufio"
+	"bytes"
+	"context"
+	"debug/elf"
+	"encoding/hex"
+	"errors"
+	"fmt"
+	"io"
+	"log"
+	"os"
+	"path/filepath"
+	"strconv"
+	"strings"
+	"sync"
+	"time"
+
+	"github.com/cilium/ebpf"
+	"github.com/cilium/ebpf/link"
+)
+
+// SSL probe configuration - can be overridden by environment variables
+var (
+	SSLProbes       = getEnv("SSL_PROBES", "false") == "true"
+	SSLScanInterval = getEnvDuration("SSL_SCAN_INTERVAL", 30*time.Second) // How often /proc is rescanned for new TLS binaries
+)
+
+// TLS library symbols probed in each binary, indexed into sslOffsets
+const (
+	sslWrite = iota
+	sslRead
+	sslFree
+	numSSLSymbols
+)
+
+var sslSymbols = [numSSLSymbols]string{
+	sslWrite: "SSL_write",
+	sslRead:  "SSL_read",
+	sslFree:  "SSL_free",
+}
+
+// sslOffsets are the file offsets of sslSymbols in one binary, as passed
+// to the uprobe (UprobeOptions.Address)
+type sslOffsets [numSSLSymbols]uint64
+
+// sslPrograms are the uprobes on SSL_write, SSL_read and SSL_free. They are
+// loaded on top of the tracer's maps, so TLS sessions are correlated with
+// the sockets seen by the tcp_sendmsg programs.
+type sslPrograms struct {
+	TraceSslWrite       *ebpf.Program `ebpf:"trace_ssl_write"`
+	TraceSslWriteReturn *ebpf.Program `ebpf:"trace_ssl_write_return"`
+	TraceSslRead        *ebpf.Program `ebpf:"trace_ssl_read"`
+	TraceSslReadReturn  *ebpf.Program `ebpf:"trace_ssl_read_return"`
+	TraceSslFree        *ebpf.Program `ebpf:"trace_ssl_free"`
+}
+
+func (p *sslPrograms) Close() error {
+	return closePrograms(p.TraceSslWrite, p.TraceSslWriteReturn, p.TraceSslRead, p.TraceSslReadReturn, p.TraceSslFree)
+}
+
+// symbolCache memoises sslOffsets by ELF build ID. Hundreds of containers
+// running the same image each expose their own copy of node or libssl, but
+// they share a build ID, so the symbol tables are parsed once per build.
+// Builds without the TLS symbols are cached too, as nil.
+type symbolCache struct {
+	byBuildID map[string]*sslOffsets
+}
+
+func newSymbolCache() *symbolCache {
+	return &symbolCache{byBuildID: make(map[string]*sslOffsets)}
+}
+
+// lookup returns the TLS symbol offsets of the ELF file at path, or nil if
+// it does not export them. Only the notes are read on a cache hit.
+func (c *symbolCache) lookup(path string) (*sslOffsets, error) {
+	f, err := elf.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+
+	id := elfBuildID(f)
+	if id != "" {
+		if offsets, ok := c.byBuildID[id]; ok {
+			return offsets, nil
+		}
+	}
+	offsets := resolveSSLOffsets(f)
+	if id != "" {
+		c.byBuildID[id] = offsets
+	}
+	return offsets, nil
+}
+
+// ntGNUBuildID is the note type of the GNU build ID (NT_GNU_BUILD_ID)
+const ntGNUBuildID = 3
+
+// elfBuildID returns the hex GNU build ID of f, or "" if it has none.
+func elfBuildID(f *elf.File) string {
+	for _, prog := range f.Progs {
+		if prog.Type != elf.PT_NOTE {
+			continue
+		}
+		notes, err := io.ReadAll(io.LimitReader(prog.Open(), 64*1024))
+		if err != nil {
+			continue
+		}
+		// Each note: namesz, descsz, type, then name and desc padded to 4 bytes
+		for len(notes) >= 12 {
+			namesz := f.ByteOrder.Uint32(notes[0:])
+			descsz := f.ByteOrder.Uint32(notes[4:])
+			typ := f.ByteOrder.Uint32(notes[8:])
+			nameEnd := 12 + uint64(namesz+3)&^3
+			descEnd := nameEnd + uint64(descsz+3)&^3
+			if descEnd > uint64(len(notes)) {
+				break
+			}
+			name := notes[12 : 12+uint64(namesz)]
+			if typ == ntGNUBuildID && bytes.Equal(name, []byte("GNU\x00")) {
+				return hex.EncodeToString(notes[nameEnd : nameEnd+uint64(descsz)])
+			}
+			notes = notes[descEnd:]
+		}
+	}
+	return ""
+}
+
+// resolveSSLOffsets looks sslSymbols up in the dynamic, then the static,
+// symbol table of f. Returns nil unless all of them are defined.
+func resolveSSLOffsets(f *elf.File) *sslOffsets {
+	var offsets sslOffsets
+	found := 0
+
+	for _, load := range []func() ([]elf.Symbol, error){f.DynamicSymbols, f.Symbols} {
+		syms, err := load()
+		if err != nil {
+			continue
+		}
+		for _, sym := range syms {
+			if elf.ST_TYPE(sym.Info) != elf.STT_FUNC || sym.Value == 0 {
+				continue
+			}
+			for i, name := range sslSymbols {
+				if offsets[i] == 0 && sym.Name == name {
+					if off, ok := fileOffset(f, sym.Value); ok {
+						offsets[i] = off
+						found++
+					}
+				}
+			}
+		}
+		if found == numSSLSymbols {
+			return &offsets
+		}
+	}
+	return nil
+}
+
+// fileOffset converts a virtual address to its offset in the file, using
+// the executable segment that maps it.
+func fileOffset(f *elf.File, addr uint64) (uint64, bool) {
+	for _, prog := range f.Progs {
+		if prog.Type != elf.PT_LOAD || prog.Flags&elf.PF_X == 0 {
+			continue
+		}
+		if addr >= prog.Vaddr && addr < prog.Vaddr+prog.Memsz {
+			return addr - prog.Vaddr + prog.Off, true
+		}
+	}
+	return 0, false
+}
+
+// fileID identifies a mapped file by device and inode, whichever mount
+// namespace it was found through.
+type fileID struct {
+	dev string
+	ino uint64
+}
+
+// pinName names the i-th link of the file under BPF_PIN_PATH/links.
+func (id fileID) pinName(i int) string {
+	return fmt.Sprintf("ssl-%s-%d-%d", strings.ReplaceAll(id.dev, ":", "_"), id.ino, i)
+}
+
+// sslAttacher finds binaries exporting the TLS symbols in running processes
+// and attaches the SSL probes to each once. Uprobes are per file, not per
+// process, so one attachment covers every process mapping that file.
+type sslAttacher struct {
+	progs   *sslPrograms
+	flows   bool // Also attach the SSL_read probes that complete flows
+	symbols *symbolCache
+	mu      sync.Mutex             // Guards files and pinDir against pin
+	files   map[fileID][]link.Link // Inspected files; nil for files without TLS symbols
+	links   int
+	pinDir  string // Links are pinned here once the agent took over
+}
+
+// newSSLAttacher loads the SSL programs, sharing the tracer's maps.
+func newSSLAttacher(spec *ebpf.CollectionSpec, maps *rpcMaps, flows bool) (*sslAttacher, error) {
+	var progs sslPrograms
+	if err := spec.LoadAndAssign(&progs, collectionOptions(maps.byName())); err != nil {
+		return nil, fmt.Errorf("failed to load SSL probes: %w", err)
+	}
+	return &sslAttacher{
+		progs:   &progs,
+		flows:   flows,
+		symbols: newSymbolCache(),
+		files:   make(map[fileID][]link.Link),
+	}, nil
+}
+
+// run rescans /proc for TLS binaries every interval until ctx is done.
+// The caller makes the first scan.
+func (s *sslAttacher) run(ctx context.Context, interval time.Duration) {
+	ticker := time.NewTicker(interval)
+	defer ticker.Stop()
+
+	for {
+		select {
+		case <-ctx.Done():
+			return
+		case <-ticker.C:
+		}
+		s.scan()
+	}
+}
+
+// scan inspects the executable mappings of every running process.
+func (s *sslAttacher) scan() {
+	entries, err := os.ReadDir("/proc")
+	if err != nil {
+		log.Printf("SSL probes: failed to list processes: %v", err)
+		return
+	}
+	before := len(s.files)
+	for _, e := range entries {
+		if pid, err := strconv.Atoi(e.Name()); err == nil {
+			s.mu.Lock()
+			s.scanProcess(pid)
+			s.mu.Unlock()
+		}
+	}
+	if DebugMode && len(s.files) != before {
+		log.Printf("DEBUG: SSL probes: %d files inspected, %d build IDs cached, %d probes attached",
+			len(s.files), len(s.symbols.byBuildID), s.links)
+	}
+}
+
+// scanProcess inspects the main executable of pid (node links OpenSSL
+// statically) and any shared library whose name mentions ssl.
+func (s *sslAttacher) scanProcess(pid int) {
+	proc := "/proc/" + strconv.Itoa(pid)
+	maps, err := os.Open(proc + "/maps")
+	if err != nil {
+		return // Exited
+	}
+	defer maps.Close()
+	exe, _ := os.Readlink(proc + "/exe")
+
+	scanner := bufio.NewScanner(maps)
+	for scanner.Scan() {
+		// address perms offset dev inode path
+		fields := strings.Fields(scanner.Text())
+		if len(fields) < 6 || !strings.Contains(fields[1], "x") || !strings.HasPrefix(fields[5], "/") {
+			continue
+		}
+		path := fields[5]
+		if path != exe && !strings.Contains(filepath.Base(path), "ssl") {
+			continue
+		}
+		ino, err := strconv.ParseUint(fields[4], 10, 64)
+		if err != nil || ino == 0 {
+			continue
+		}
+		id := fileID{dev: fields[3], ino: ino}
+		if _, seen := s.files[id]; seen {
+			continue
+		}
+		// Resolve the path inside the process's mount namespace
+		s.inspect(id, proc+"/root"+path)
+	}
+}
+
+// inspect attaches to the file at path if it exports the TLS symbols.
+func (s *sslAttacher) inspect(id fileID, path string) {
+	offsets, err := s.symbols.lookup(path)
+	if err != nil {
+		if !errors.Is(err, os.ErrNotExist) {
+			log.Printf("SSL probes: failed to read %s: %v", path, err)
+		}
+		return // Retried on the next scan
+	}
+	if offsets == nil {
+		s.files[id] = nil
+		return
+	}
+
+	links, err := s.attach(path, offsets)
+	if err != nil {
+		closeLinks(links)
+		log.Printf("SSL probes: failed to attach to %s: %v", path, err)
+		s.files[id] = nil
+		return
+	}
+	s.files[id] = links
+	s.links += len(links)
+	log.Printf("SSL probes attached to %s", path)
+	if s.pinDir != "" {
+		s.pinFile(id, links)
+	}
+}
+
+// pin pins the links of every file attached so far under dir, and those
+// of files attached later as they are found.
+func (s *sslAttacher) pin(dir string) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	s.pinDir = dir
+	for id, links := range s.files {
+		s.pinFile(id, links)
+	}
+}
+
+// pinFile pins the links of one file, all or none.
+func (s *sslAttacher) pinFile(id fileID, links []link.Link) {
+	for i, l := range links {
+		if err := l.Pin(filepath.Join(s.pinDir, id.pinName(i))); err != nil {
+			log.Printf("SSL probes on %s:%d not pinned (%v); they detach when the agent exits", id.dev, id.ino, err)
+			for _, pinned := range links[:i] {
+				pinned.Unpin()
+			}
+			return
+		}
+	}
+}
+
+// sslProbe is one uprobe or uretprobe on a TLS symbol
+type sslProbe struct {
+	sym  int
+	ret  bool
+	prog *ebpf.Program
+}
+
+// attach links the SSL programs at the resolved offsets, so the
+// executable's symbol table is never parsed again.
+func (s *sslAttacher) attach(path string, offsets *sslOffsets) ([]link.Link, error) {
+	ex, err := link.OpenExecutable(path)
+	if err != nil {
+		return nil, err
+	}
+
+	probes := []sslProbe{
+		{sslWrite, false, s.progs.TraceSslWrite},
+		{sslWrite, true, s.progs.TraceSslWriteReturn},
+		{sslFree, false, s.progs.TraceSslFree},
+	}
+	if s.flows {
+		probes = append(probes,
+			sslProbe{sslRead, false, s.progs.TraceSslRead},
+			sslProbe{sslRead, true, s.progs.TraceSslReadReturn})
+	}
+
+	var links []link.Link
+	for _, p := range probes {
+		opts := &link.UprobeOptions{Address: offsets[p.sym]}
+		var l link.Link
+		if p.ret {
+			l, err = ex.Uretprobe(sslSymbols[p.sym], p.prog, opts)
+		} else {
+			l, err = ex.Uprobe(sslSymbols[p.sym], p.prog, opts)
+		}
+		if err != nil {
+			return links, fmt.Errorf("%s: %w", sslSymbols[p.sym], err)
+		}
+		links = append(links, l)
+	}
+	return links, nil
+}
+
+// Close detaches every probe and unloads the programs.
+func (s *sslAttacher) Close() error {
+	for _, links := range s.files {
+		closeLinks(links)
+	}
+	return s.progs.Close()
+}
@@ -0,0 +1,101 @@
+package main
+
+import (
+	"net/netip"
+	"sync"
+)
+
+// subjectMetric selects the last token of a subject.
+type subjectMetric uint8
+
+// Subject metrics, indexed into subjectMetricNames
+const (
+	metricRequestSize subjectMetric = iota
+	metricResponseSize
+	metricLatencyMs
+	metricRequestSummary
+	metricResponseSummary
+	metricServerSummary
+)
+
+var subjectMetricNames = [...]string{
+	metricRequestSize:     "request_size",
+	metricResponseSize:    "response_size",
+	metricLatencyMs:       "latency_ms",
+	metricRequestSummary:  "request_summary",
+	metricResponseSummary: "response_summary",
+	metricServerSummary:   "server_summary",
+}
+
+func (m subjectMetric) String() string {
+	return subjectMetricNames[m]
+}
+
+// maxCachedSubjects bounds the subject cache. Past it, subjects are still
+// built, just not cached.
+const maxCachedSubjects = 16384
+
+// subjectKey identifies a subject by the compact IDs carried in events.
+// The protocol token is derived from the port.
+type subjectKey struct {
+	destIP   netip.Addr
+	destPort uint16
+	methodID uint16
+	metric   subjectMetric
+}
+
+type subjectEntry struct {
+	hostname string // Destination token the subject was built with
+	subject  string
+}
+
+// subjectCache interns NATS subjects so the hot path returns a cached
+// string instead of formatting one per feature. The destination token comes
+// from the hostname cache and changes when a reverse lookup completes, so
+// each entry remembers the hostname it was built with and is rebuilt when
+// that no longer matches.
+type subjectCache struct {
+	mu      sync.RWMutex
+	entries map[subjectKey]subjectEntry
+}
+
+func newSubjectCache() *subjectCache {
+	return &subjectCache{entries: make(map[subjectKey]subjectEntry)}
+}
+
+// Subject returns rpc.{hostname}.{protocol}.{method}.{metric} for the key.
+func (c *subjectCache) Subject(destIP netip.Addr, destPort, methodID uint16, metric subjectMetric, hostname string) string {
+	key := subjectKey{destIP: destIP, destPort: destPort, methodID: methodID, metric: metric}
+
+	c.mu.RLock()
+	e, ok := c.entries[key]
+	c.mu.RUnlock()
+	if ok && e.hostname == hostname {
+		return e.subject
+	}
+
+	method := methodName(methodID)
+	if method == "" {
+		method = "unknown"
+	}
+	subject := string(appendSubject(nil, hostname, protocolForPort(destPort), method, metric.String()))
+
+	c.mu.Lock()
+	if _, exists := c.entries[key]; exists || len(c.entries) < maxCachedSubjects {
+		c.entries[key] = subjectEntry{hostname: hostname, subject: subject}
+	}
+	c.mu.Unlock()
+	return subject
+}
+
+// appendSubject appends rpc.{destination}.{protocol}.{method}.{metric} to b.
+func appendSubject(b []byte, destination, protocol, method, metric string) []byte {
+	b = append(b, "rpc."...)
+	b = append(b, destination...)
+	b = append(b, '.')
+	b = append(b, protocol...)
+	b = append(b, '.')
+	b = append(b, method...)
+	b = append(b, '.')
+	return append(b, metric...)
+}
@@ -0,0 +1,156 @@
+package main
+
+import (
+	"context"
+	"fmt"
+	"log"
+	"strings"
+
+	"github.com/cilium/ebpf"
+	"github.com/cilium/ebpf/link"
+)
+
+// Tracers is the set of tracers loaded side by side, from TRACERS. The
+// default is tcp, plus ssl with SSL_PROBES=true and server with
+// SERVER_PROBES=true.
+var Tracers = getEnvList("TRACERS", defaultTracers())
+
+func defaultTracers() string {
+	names := []string{"tcp"}
+	if SSLProbes {
+		names = append(names, "ssl")
+	}
+	if ServerProbes {
+		names = append(names, "server")
+	}
+	return strings.Join(names, ",")
+}
+
+// tracer is a group of rpc_tracer.c programs. Every tracer is loaded onto
+// the same maps, so together they feed one event transport and share one
+// set of filter, flow and histogram maps.
+type tracer struct {
+	name  string
+	start func(a *Agent, spec *ebpf.CollectionSpec) (*startedTracer, error)
+}
+
+// startedTracer is an attached tracer.
+type startedTracer struct {
+	name  string
+	progs any              // Program struct, reported in the BPF stats
+	links []link.Link      // Pinned for the next agent, see takeOver
+	pin   func(dir string) // If set, pins the tracer's links instead, including later ones
+	stop  func()           // Stops background work and detaches
+}
+
+// tracerRegistry lists the tracers in the order they start
+var tracerRegistry = []tracer{
+	{"tcp", startTCPTracer},       // tcp_sendmsg, plus tcp_recvmsg/tcp_close outside events mode (tcp_close also with ssl)
+	{"ssl", startSSLTracer},       // SSL_write/SSL_read in every TLS binary
+	{"server", startServerTracer}, // TARGET_SYMBOL in TARGET_BINARY
+}
+
+// selectTracers resolves names against the registry.
+func selectTracers(names []string) ([]tracer, error) {
+	want := make(map[string]bool, len(names))
+	for _, name := range names {
+		want[name] = true
+	}
+	var selected, known []string
+	var tracers []tracer
+	for _, t := range tracerRegistry {
+		known = append(known, t.name)
+		if want[t.name] {
+			tracers = append(tracers, t)
+			selected = append(selected, t.name)
+			delete(want, t.name)
+		}
+	}
+	for name := range want {
+		return nil, fmt.Errorf("unknown tracer %q in TRACERS (want %s)", name, strings.Join(known, ", "))
+	}
+	if len(tracers) == 0 {
+		return nil, fmt.Errorf("TRACERS is empty (want some of %s)", strings.Join(known, ", "))
+	}
+	return tracers, nil
+}
+
+func tracerEnabled(name string) bool {
+	for _, n := range Tracers {
+		if n == name {
+			return true
+		}
+	}
+	return false
+}
+
+// startTracers attaches the selected tracers to the loaded maps. On failure
+// the tracers already started are stopped.
+func (a *Agent) startTracers(spec *ebpf.CollectionSpec, tracers []tracer) ([]*startedTracer, error) {
+	var started []*startedTracer
+	for _, t := range tracers {
+		st, err := t.start(a, spec)
+		if err != nil {
+			stopTracers(started)
+			return nil, fmt.Errorf("%s tracer: %w", t.name, err)
+		}
+		st.name = t.name
+		a.addPrograms(st.progs)
+		started = append(started, st)
+	}
+	return started, nil
+}
+
+// stopTracers stops started in reverse order.
+func stopTracers(started []*startedTracer) {
+	for i := len(started) - 1; i >= 0; i-- {
+		started[i].stop()
+	}
+}
+
+// startTCPTracer attaches to tcp_sendmsg, and in flow and histogram modes
+// to tcp_recvmsg and tcp_close to pair each request with its response.
+// With the ssl tracer tcp_close is attached in every mode, so the TLS mark
+// of a closed socket is never inherited by a plaintext one reusing it.
+func startTCPTracer(a *Agent, spec *ebpf.CollectionSpec) (*startedTracer, error) {
+	objs := a.EBPFObjs
+	recv := CaptureMode != CaptureEvents
+	links, err := attachTCP(spec, objs, recv, recv || tracerEnabled("ssl"))
+	if err != nil {
+		return nil, err
+	}
+	log.Printf("Attached %d %s programs to tcp_sendmsg (and tcp_recvmsg/tcp_close outside events mode, tcp_close with ssl)",
+		len(links), objs.mode)
+	return &startedTracer{progs: objs.programs, links: links, stop: func() { closeLinks(links) }}, nil
+}
+
+// startSSLTracer attaches SSL_write/SSL_read uprobes to the TLS binaries
+// running now, then to new ones as they appear.
+func startSSLTracer(a *Agent, spec *ebpf.CollectionSpec) (*startedTracer, error) {
+	ssl, err := newSSLAttacher(spec, &a.EBPFObjs.rpcMaps, CaptureMode != CaptureEvents)
+	if err != nil {
+		return nil, err
+	}
+	ssl.scan()
+	ctx, cancel := context.WithCancel(a.Ctx)
+	done := make(chan struct{})
+	go func() {
+		defer close(done)
+		ssl.run(ctx, SSLScanInterval)
+	}()
+	log.Printf("SSL probes enabled, scanning for TLS libraries every %s", SSLScanInterval)
+	return &startedTracer{progs: ssl.progs, pin: ssl.pin, stop: func() {
+		cancel()
+		<-done
+		ssl.Close()
+	}}, nil
+}
+
+// startServerTracer times a Go RPC server's dispatcher into the histograms.
+func startServerTracer(a *Agent, spec *ebpf.CollectionSpec) (*startedTracer, error) {
+	server, err := attachServerProbes(spec, &a.EBPFObjs.rpcMaps)
+	if err != nil {
+		return nil, err
+	}
+	return &startedTracer{progs: server.progs, links: server.links, stop: func() { server.Close() }}, nil
+}